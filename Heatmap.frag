@@ -0,0 +1,31 @@
+#version 330
+
+// Colours the march statistics Marcher.frag writes when debugView is set (see RMMarchStats)
+uniform sampler2D tex;
+// Count shown as the hottest colour, anything above stays red
+uniform float scale = 500;
+
+out vec4 fragColor;
+
+// Same stops as RMMarchStats::heat
+vec3 heat(float t) {
+    const vec3 stops[5] = vec3[5](
+        vec3(0, 0, 0.5),
+        vec3(0, 0.5, 1),
+        vec3(0, 0.8, 0.2),
+        vec3(1, 0.9, 0),
+        vec3(1, 0, 0)
+    );
+
+    t = clamp(t, 0., 1.) * 4.;
+    int i = min(int(t), 3);
+    return mix(stops[i], stops[i + 1], t - float(i));
+}
+
+void main() {
+    // The marched texture is the size of the window
+    vec2 encoded = texelFetch(tex, ivec2(gl_FragCoord.xy), 0).rg;
+    float count = floor(encoded.r * 255. + 0.5) * 256. + floor(encoded.g * 255. + 0.5);
+
+    fragColor = vec4(heat(count / max(scale, 1.)), 1);
+}
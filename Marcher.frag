@@ -1,6 +1,7 @@
 #version 330
 
 uniform sampler2D tex;
+// Octahedral map with tonemapping baked in and mips for rough reflections (see RMSkybox)
 uniform sampler2D skybox;
 uniform sampler2D buff;
 uniform sampler2D testTex;
@@ -12,10 +13,18 @@ const float MAX_DISTANCE = 1000.;
 const float TOLERANCE = 0.001;
 const int MAX_STEPS = 500;
 const float PI = 3.14159265359;
+// Baked into the skybox by RMSkybox
 const float GAMMA = 2.5;
 const int MAX_BOUNCES = 3;
+// Surfaces rougher than this take a single bounce and rely on the blurred sky mips
+const float MAX_BOUNCE_ROUGHNESS = 0.5;
 const float SHADOW_STRENGTH = 0.5;
+const int MAX_SHADOW_STEPS = 64;
 const int AO_STEP_SIZE = 1;
+// Distance from the eye to the image plane, uv spans [-1, 1] vertically
+const float FOCAL_LENGTH = 1.5;
+// Over-relaxation factor for sphere tracing (1 = plain sphere tracing)
+const float RELAXATION = 1.6;
 
 // Shape types
 const int SPHERE = 1;
@@ -24,12 +33,15 @@ const int CAPSULE = 3;
 const int PLANE = 4;
 
 // SDF Ops
+const int NOOP = 0;
 const int UNION = 1;
 const int INTERSECTION = 2;
 const int SUBTRACT = 3;
 const int SMOOTH_UNION = 4;
 const int SMOOTH_INTERSECTION = 5;
 const int SMOOTH_SUBTRACT = 6;
+// Surface read from the baked volume, only used by getNormal
+const int BAKED = -1;
 
 vec4 difCol = vec4(1., 1., 1., 1.);
 
@@ -55,12 +67,26 @@ mat3 rotateXYZ(vec3 rot) {
 }
 
 uniform vec2 windowDimensions = vec2(800, 600);
+
+// Radius of a pixel's cone at a distance of 1 (half a pixel is 1 / height in uv units)
+// Set in main, globals can only start from constant expressions
+float pixelCone;
 uniform vec3 camPosition = vec3(0, 1, 0);
 uniform vec3 camRotation = vec3(0);
 
 uniform float time = 0;
 uniform float deltaTime = 0;
 
+// March statistics (see RMMarchStats), 0 shows the shaded scene and otherwise the pixel is
+// the count of one of them: 1 primary steps, 2 shadow steps, 3 bounces, 4 SceneSDF calls
+// Counts are written as 16 bits over red (high) and green (low) for Heatmap.frag to colour
+uniform int debugView = 0;
+
+int statPrimarySteps = 0;
+int statShadowSteps = 0;
+int statBounces = 0;
+int statSceneCalls = 0;
+
 // Used for checking and returning the distance to the scene
 // and the color at that point in a nice package
 
@@ -85,6 +111,9 @@ struct Shape {
 
     int type;
 
+    // Conservative bounding sphere (xyz = center, w = radius, w < 0 if unbounded)
+    vec4 bounds;
+
     // material properties
     float metallic;
     float roughness;
@@ -93,6 +122,25 @@ struct Shape {
 
 uniform Shape shapes[20];
 
+// Sky irradiance / PI as L2 spherical harmonics (see RMSkybox)
+uniform vec3 skyIrradiance[9];
+// Highest mip level of the skybox
+uniform float skyLods = 0;
+
+// Baked distance volume (see RMSdfVolume), blocks of VOLUME_BRICK cells
+// volumeBlocks has a texel per block at (x + z * blocks, y): a = 1 for a brick with its index in rgb,
+// otherwise r and g below hold for the whole block
+// volumeBricks has volumeBrickColumns bricks to a row, each is its VOLUME_BRICK + 1 z slices side by side
+// r = distance mapped from [-volumeBand, volumeBand], g = closest shape index
+const int VOLUME_BRICK = 8;
+uniform sampler2D volumeBlocks;
+uniform sampler2D volumeBricks;
+uniform vec3 volumeMin;
+uniform vec3 volumeMax;
+uniform int volumeResolution = 0;
+uniform int volumeBrickColumns = 1;
+uniform float volumeBand = 1;
+
 uniform vec3 lights[2] = { vec3(0, 1000., 0), vec3(-5, 2, 3) };
 
 // Copied from https://www.shadertoy.com/view/Ml3Gz8
@@ -264,7 +312,82 @@ vec4 GetColorFromTexture(vec3 p, Shape s, sampler2D inputTex) {
     return texture2D(inputTex, uv);
 }
 
+// Maps a direction to the octahedral skybox (y is up)
+vec2 octEncode(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 p = n.xz;
+    if (n.y < 0.) {
+        p = (1. - abs(n.zx)) * vec2(n.x >= 0. ? 1. : -1., n.z >= 0. ? 1. : -1.);
+    }
+    return p * 0.5 + 0.5;
+}
+
+vec3 skyDiffuse(vec3 n) {
+    return skyIrradiance[0] * 0.282095
+         + skyIrradiance[1] * 0.488603 * n.y
+         + skyIrradiance[2] * 0.488603 * n.z
+         + skyIrradiance[3] * 0.488603 * n.x
+         + skyIrradiance[4] * 1.092548 * n.x * n.y
+         + skyIrradiance[5] * 1.092548 * n.y * n.z
+         + skyIrradiance[6] * 0.315392 * (3. * n.z * n.z - 1.)
+         + skyIrradiance[7] * 1.092548 * n.x * n.z
+         + skyIrradiance[8] * 0.546274 * (n.x * n.x - n.y * n.y);
+}
+
+// Rougher surfaces sample blurrier mips and lean towards the diffuse irradiance
+vec4 sampleSky(vec3 rd, float roughness) {
+    vec4 sky = textureLod(skybox, octEncode(rd), roughness * skyLods);
+    sky.rgb = mix(sky.rgb, skyDiffuse(rd), roughness * roughness);
+    return sky;
+}
+
+// Texture coordinates of position local.xy in slice z of the brick starting at texel corner
+vec2 brickUV(vec2 corner, vec2 local, int z) {
+    return (corner + vec2(float(z * (VOLUME_BRICK + 1)), 0.) + local + 0.5) / vec2(textureSize(volumeBricks, 0));
+}
+
+// Same as RMSdfVolume::getDistance
+float sampleVolume(vec3 p, out int id) {
+    vec3 q = clamp(p, volumeMin, volumeMax);
+    float outside = length(p - q);
+
+    float n = float(volumeResolution - 1);
+    vec3 g = (q - volumeMin) / (volumeMax - volumeMin) * n;
+
+    // The block holding the cell, its brick covers the whole cell
+    ivec3 cell = min(ivec3(g), ivec3(volumeResolution - 2));
+    ivec3 block = cell / VOLUME_BRICK;
+    int blocks = (volumeResolution + VOLUME_BRICK - 2) / VOLUME_BRICK;
+    vec4 entry = texelFetch(volumeBlocks, ivec2(block.x + block.z * blocks, block.y), 0);
+
+    float d = entry.r;
+    id = int(entry.g * 255. + 0.5);
+
+    if (entry.a > 0.5) {
+        ivec3 bytes = ivec3(entry.rgb * 255. + 0.5);
+        int brick = bytes.r + bytes.g * 256 + bytes.b * 65536;
+        int samples = VOLUME_BRICK + 1;
+        vec2 corner = vec2(brick % volumeBrickColumns * samples * samples, brick / volumeBrickColumns * samples);
+        vec3 local = g - vec3(block * VOLUME_BRICK);
+
+        ivec3 nearest = ivec3(local + 0.5);
+        id = int(texelFetch(volumeBricks, ivec2(corner) + ivec2(nearest.x + nearest.z * samples, nearest.y), 0).g * 255. + 0.5);
+
+        // Bilinear within the two closest slices, blended here
+        int z = cell.z - block.z * VOLUME_BRICK;
+        d = mix(
+            texture(volumeBricks, brickUV(corner, local.xy, z)).r,
+            texture(volumeBricks, brickUV(corner, local.xy, z + 1)).r,
+            local.z - float(z)
+        );
+    }
+    d = (d * 2. - 1.) * volumeBand;
+
+    return outside > 0. ? max(outside, d - outside) : d;
+}
+
 Shape SceneSDF(vec3 p) {
+    statSceneCalls++;
 
     Shape scene;
 
@@ -275,6 +398,15 @@ Shape SceneSDF(vec3 p) {
     scene.roughness = 0;
     scene.emissive = false;
 
+    if (volumeResolution > 0) {
+        int id;
+        float d = sampleVolume(p, id);
+
+        scene = shapes[id];
+        scene.signedDistance = d;
+        scene.operation = BAKED;
+    }
+
     Shape check;
 
     for (int i = 0; i < 20; i++) {
@@ -288,6 +420,14 @@ Shape SceneSDF(vec3 p) {
             break;
         }
 
+        // Skip the exact SDF if this shape can't be closer than the current best
+        if (check.bounds.w >= 0.) {
+            float bound = length(p - check.bounds.xyz) - check.bounds.w;
+            if (bound > scene.signedDistance) {
+                continue;
+            }
+        }
+
         // Assign sdf of this shape
         check.signedDistance = assignSDF(p, check);
 
@@ -296,7 +436,10 @@ Shape SceneSDF(vec3 p) {
             Shape opd = shapes[check.operandIndex];
             opd.signedDistance = assignSDF(p, opd);
 
+            // Remember which operation produced this surface (used by getNormal)
+            int op = check.operation;
             check = operateSDF(check, opd);
+            check.operation = op;
         }
 
         scene = CheckScene(scene, check);
@@ -305,30 +448,97 @@ Shape SceneSDF(vec3 p) {
 	return scene;
 }
 
-vec3 getNormal(vec3 p) {
-    float dist = SceneSDF(p).signedDistance;
-    vec2 e = vec2(TOLERANCE, 0);
+// Tetrahedral central differences - 4 taps and no center sample
+vec3 estimateNormal(vec3 p) {
+    const vec2 k = vec2(1, -1);
+    float h = TOLERANCE * 0.5773;
 
-    vec3 n = dist - vec3(
-        SceneSDF(p-e.xyy).signedDistance,
-        SceneSDF(p-e.yxy).signedDistance,
-        SceneSDF(p-e.yyx).signedDistance
+    return normalize(
+        k.xyy * SceneSDF(p + k.xyy * h).signedDistance +
+        k.yyx * SceneSDF(p + k.yyx * h).signedDistance +
+        k.yxy * SceneSDF(p + k.yxy * h).signedDistance +
+        k.xxx * SceneSDF(p + k.xxx * h).signedDistance
     );
+}
+
+// Analytic gradients of the primitive SDFs
+vec3 sphereGradient(vec3 p) {
+    return normalize(p);
+}
+
+vec3 boxGradient(vec3 p, vec3 size) {
+    vec3 w = abs(p) - size;
+    float g = max(w.x, max(w.y, w.z));
+    vec3 s = sign(p);
+    return s * (g > 0. ? normalize(max(w, 0.)) : step(w.yzx, w.xyz) * step(w.zxy, w.xyz));
+}
+
+vec3 capsuleGradient(vec3 p, vec3 pos1, vec3 pos2) {
+    vec3 pa = p - pos1;
+    vec3 ba = pos2 - pos1;
+    float h = clamp( dot(pa,ba)/dot(ba,ba), 0.0, 1.0 );
+    return normalize(pa - ba * h);
+}
+
+// Normal at p given the shape SceneSDF returned there
+// Falls back to sampling the scene when the surface is a blend of two shapes
+vec3 getNormal(vec3 p, Shape s) {
+    if (s.operation != NOOP && s.operation != UNION && s.operation != INTERSECTION) {
+        return estimateNormal(p);
+    }
+
+    mat3 rotation = rotateXYZ(s.rotation);
+    vec3 local = (p - s.position) * rotation;
+
+    if (s.type == SPHERE) {
+        return rotation * sphereGradient(local);
+    }
 
-    return normalize(n);
+    if (s.type == BOX) {
+        return rotation * boxGradient(local, s.param1);
+    }
+
+    if (s.type == CAPSULE) {
+        return capsuleGradient(p, s.position, s.param1);
+    }
+
+    if (s.type == PLANE) {
+        return rotation * normalize(s.param1);
+    }
+
+    return estimateNormal(p);
 }
 
 // Used for traversing through the scene until an object is hit
-float RayMarch(vec3 ro, vec3 rd, out vec4 dCol) {
+// Uses over-relaxed sphere tracing (Keinert et al. 2014)
+// The hit threshold grows with the pixel footprint, coneStart is the distance already
+// travelled before ro (for bounces) and skyRoughness blurs the skybox on a miss
+float RayMarch(vec3 ro, vec3 rd, float coneStart, float skyRoughness, out vec4 dCol, out int steps) {
     float distTotal = 0;
     vec4 accCol = vec4(0, 0, 0, 1);
 
-    for (int i = 0; i < MAX_STEPS; i++) {
+    float omega = RELAXATION;
+    float prevRadius = 0;
+    float stepLength = 0;
+
+    for (steps = 0; steps < MAX_STEPS; steps++) {
         vec3 p = ro + rd * distTotal;
         Shape scene = SceneSDF(p);
         float dist = scene.signedDistance;
+        float radius = abs(dist);
+        float eps = max(TOLERANCE, (coneStart + distTotal) * pixelCone);
+
+        // The last two unbounding spheres don't overlap so a surface may have been skipped
+        // Go back to the last safe point and continue with plain sphere tracing
+        if (omega > 1 && radius + prevRadius < stepLength) {
+            distTotal += prevRadius - stepLength;
+            stepLength = prevRadius;
+            omega = 1;
+            continue;
+        }
 
-        if (dist < TOLERANCE) {
+        // Close to the surface from either side, a relaxed step can land inside it
+        if (radius < eps) {
             accCol.rgb += scene.color.rgb * (accCol.a * scene.color.a);
             accCol.a *= (1 - scene.color.a);
                 
@@ -341,15 +551,13 @@ float RayMarch(vec3 ro, vec3 rd, out vec4 dCol) {
             }
         }
 
-        distTotal += abs(dist);
+        // Don't relax inside of (transparent) objects so they keep accumulating color the same way
+        stepLength = radius < eps ? radius : radius * omega;
+        prevRadius = radius;
+        distTotal += stepLength;
 
         if (distTotal > MAX_DISTANCE) {
-            vec2 uv;
-            uv.x = 0.5 + atan(rd.x, rd.z)/(2 * PI);
-            uv.y = 0.5 - asin(rd.y) / PI;
-            dCol = texture2D(skybox, uv);
-            vec4 mapped = dCol / (dCol + vec4(1.));
-            mapped = pow(mapped, vec4(1 / GAMMA));
+            vec4 mapped = sampleSky(rd, skyRoughness);
             accCol.rgb += mapped.rgb * (accCol.a * mapped.a);
             accCol.a *= (1 - mapped.a);
             dCol = accCol;
@@ -363,53 +571,59 @@ float RayMarch(vec3 ro, vec3 rd, out vec4 dCol) {
 }
 
 // Used for proper lighting & shading
-float lightMarch(vec3 ro, vec3 rd, int lightID, float k) {
+// Soft shadows using penumbra estimation (improved technique by Inigo Quilez)
+// Returns 0 when the light is blocked and 1 when fully lit, k controls the softness
+float lightMarch(vec3 ro, vec3 rd, float maxDist, float k) {
     float distTotal = 0;
     float res = 1.;
-    vec4 accCol = vec4(0, 0, 0, 1);
-    vec4 baseCol = SceneSDF(ro).color;
-    float m = SceneSDF(ro).metallic;
-    float alpha;
 
-    for (int i = 0; i < MAX_STEPS; i++) {
-        Shape scene = SceneSDF(ro + rd * distTotal);
-        float dist = scene.signedDistance;
+    float omega = RELAXATION;
+    float prevRadius = 0;
+    float stepLength = 0;
 
-        if (dist < TOLERANCE) {
-            return SHADOW_STRENGTH;
-            if (scene.color.a > 1 - TOLERANCE) {
-                
-            }
+    for (int i = 0; i < MAX_SHADOW_STEPS && distTotal < maxDist; i++) {
+        statShadowSteps++;
+        float dist = SceneSDF(ro + rd * distTotal).signedDistance;
 
-            // Colored shadows (WIP)
-            accCol.rgb += scene.color.rgb * (accCol.a * scene.color.a);
-            accCol.a *= (1 - scene.color.a);
-                
-            if (scene.color.a <= 1 - TOLERANCE)
-                distTotal += TOLERANCE;
+        // Overshot, see RayMarch
+        if (omega > 1 && abs(dist) + prevRadius < stepLength) {
+            distTotal += prevRadius - stepLength;
+            stepLength = prevRadius;
+            omega = 1;
+            continue;
+        }
 
-            if (accCol.a < TOLERANCE) {
-                return res;
-            }
+        if (dist < TOLERANCE) {
+            return 0.;
+        }
 
-            alpha = scene.color.a;
+        // The closest point to the occluder is where the last two spheres intersect
+        // When they don't (one contains the other) fall back to the plain estimate
+        float y = 0;
+        if (stepLength > 0) {
+            y = (stepLength * stepLength + dist * dist - prevRadius * prevRadius) / (2. * stepLength);
         }
 
-        dist = max(abs(dist), TOLERANCE);
-        res = min(res, k * dist / distTotal + SHADOW_STRENGTH);
-        distTotal += abs(dist);
+        if (y > 0 && y < dist && distTotal - y > TOLERANCE) {
+            res = min(res, k * sqrt(dist * dist - y * y) / (distTotal - y));
+        } else {
+            res = min(res, k * dist / max(TOLERANCE, distTotal));
+        }
 
-        if (distTotal > length(lights[lightID] - ro)) {
-            return res;
+        // Fully in the penumbra, nothing further along can make it darker
+        if (res < TOLERANCE) {
+            return 0.;
         }
 
-        //if (distTotal > MAX_DISTANCE) break;
+        stepLength = dist * omega;
+        prevRadius = dist;
+        distTotal += stepLength;
     }
 
     return res;
 }
 
-float getLight(vec3 p, int lightID, vec4 color) {
+float getLight(vec3 p, vec3 n, int lightID, vec4 color) {
     // Allows the skybox to be unaffected by lighting
     if (length(p - camPosition) > MAX_DISTANCE - TOLERANCE) {
         return 1;
@@ -419,19 +633,17 @@ float getLight(vec3 p, int lightID, vec4 color) {
     lightPos = rotateXYZ(vec3(0, 0, PI / 12)) * lightPos;
     lightPos = rotateXYZ(vec3(0, mod(time, 2 * PI), 0)) * lightPos;
     vec3 l = normalize(lightPos - p);
-    vec3 n = getNormal(p);
     float dif = clamp(dot(n, l), SHADOW_STRENGTH, 1.);
     
-    // Diffuse lighting and shadows
-    float light = lightMarch(p + n * TOLERANCE, l, lightID, 28);
+    // Diffuse lighting and shadows (only up to the light)
+    float light = min(1., SHADOW_STRENGTH + lightMarch(p + n * TOLERANCE, l, length(lightPos - p), 28));
 
     return light * dif;
 }
 
-float aoMarch(vec3 p) {
+float aoMarch(vec3 p, vec3 n) {
     float sum = 0;
     float maxSum = 0;
-    vec3 n = getNormal(p);
     for (int i = 0; i < MAX_STEPS / 50; i++) {
         vec3 pos = p + n * (i+1) * AO_STEP_SIZE;
         sum    += 1. / pow(2., i) * abs(SceneSDF(pos).signedDistance);
@@ -441,34 +653,37 @@ float aoMarch(vec3 p) {
     return sum / maxSum;
 }
 
-void main() {
+vec4 shadePixel() {
     vec2 uv = (2 * gl_FragCoord.xy - windowDimensions.xy) / windowDimensions.y;
 
-    vec3 rd = normalize(vec3(uv.x, -uv.y, 1.5));
+    vec3 rd = normalize(vec3(uv.x, -uv.y, FOCAL_LENGTH));
     rd = rotateXYZ(camRotation) * rd;
 
-    float dist = RayMarch(camPosition, rd, difCol);
+    int steps;
+    float dist = RayMarch(camPosition, rd, 0, 0, difCol, steps);
+    statPrimarySteps = steps;
 
     vec3 pos = camPosition + rd * dist;
 
     if (dist > MAX_DISTANCE - TOLERANCE || difCol.a < 0) {
         difCol.a = 1.;
-        FragColor = difCol;
-        return;
+        return difCol;
     }
 
-    float ao = aoMarch(pos);
-    float shade = getLight(pos, 0, difCol);
-
+    // The normal is only computed once per hit and shared between the lighting stages
     Shape scene = SceneSDF(pos);
+    vec3 sn = getNormal(pos, scene);
+
+    float ao = aoMarch(pos, sn);
+    float shade = getLight(pos, sn, 0, difCol);
 
     // Indirect illumination (Need to implement progressive rendering to get a better look)
     // Doesn't put reflections on transparent objects yet
     Shape bounceScene = scene;
     vec4 accCol = vec4(0);
     vec4 indCol = vec4(0);
-    vec3 sn = getNormal(pos);
     vec3 refpos = pos;
+    float pathLength = dist;
 
     int bounce = 0;
     for (bounce = 0; bounce < MAX_BOUNCES; bounce++) {
@@ -479,18 +694,27 @@ void main() {
                 ) - 0.5;
         random *= bounceScene.roughness;
         vec3 refd = reflect(rd, sn + random);
-        dist = RayMarch(refpos + sn * TOLERANCE, refd, indCol);
+        statBounces++;
+        dist = RayMarch(refpos + sn * TOLERANCE, refd, pathLength, bounceScene.roughness, indCol, steps);
 
         refpos = refpos + refd * dist;
+        pathLength += dist;
+
+        // Skybox hits don't need a normal since they aren't lit
+        bool escaped = dist > MAX_DISTANCE - TOLERANCE;
+        if (!escaped) {
+            bounceScene = SceneSDF(refpos);
+            sn = getNormal(refpos, bounceScene);
+        }
 
-        float indShade = getLight(refpos, 0, indCol);
+        float indShade = getLight(refpos, sn, 0, indCol);
         //indCol.a = SceneSDF(refpos).metallic;
         accCol += indCol * indShade;
 
-        if (dist > MAX_DISTANCE - TOLERANCE || indCol.a < 0) break;
+        if (escaped || indCol.a < 0) break;
 
-        sn = getNormal(refpos);
-        bounceScene = SceneSDF(refpos);
+        // Rough surfaces get their blur from the sky mips instead of more noisy bounces
+        if (bounceScene.roughness > MAX_BOUNCE_ROUGHNESS) break;
     }
 
     accCol /= bounce + 1;
@@ -501,5 +725,21 @@ void main() {
 
     difCol.a = 1;
     vec4 bufCol = texture2D(buff, gl_FragCoord.xy / windowDimensions.xy);
-	FragColor = difCol;
+	return difCol;
+}
+
+void main() {
+    pixelCone = 1. / (windowDimensions.y * FOCAL_LENGTH);
+
+    vec4 color = shadePixel();
+    if (debugView == 0) {
+        FragColor = color;
+        return;
+    }
+
+    int count = debugView == 1 ? statPrimarySteps :
+                debugView == 2 ? statShadowSteps :
+                debugView == 3 ? statBounces : statSceneCalls;
+    count = clamp(count, 0, 65535);
+    FragColor = vec4(float(count / 256) / 255., float(count % 256) / 255., 0, 1);
 }
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "RMAssetLoader.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <memory>
+#include <chrono>
+
+#include "RMProfiler.h"
+
+rm::RMAssetLoader::RMAssetLoader() {
+    total = 0;
+    finished = 0;
+}
+
+void rm::RMAssetLoader::add(const std::string& name, std::function<bool()> work, std::function<bool()> finish, std::function<void()> onReady) {
+    Job job;
+    job.name = name;
+    const char* scope = RMProfiler::intern("Load " + name);
+    job.work = std::async(std::launch::async, [work, scope]() {
+        RMProfiler::setThreadName("Asset loader");
+        RM_PROFILE_SCOPE(scope);
+        return work();
+    });
+    job.finish = finish;
+    job.onReady = onReady;
+
+    jobs.push_back(std::move(job));
+    total++;
+}
+
+void rm::RMAssetLoader::makePlaceholder(sf::Texture* texture) {
+    sf::Uint8 white[4] = { 255, 255, 255, 255 };
+    texture->create(1, 1);
+    texture->update(white);
+}
+
+#pragma region Asset Types
+void rm::RMAssetLoader::loadShader(sf::Shader* shader, const std::string& filename, sf::Shader::Type type, std::function<void()> onReady) {
+    std::shared_ptr<std::string> source = std::make_shared<std::string>();
+
+    // Read in the background, compile as soon as the source is there
+    add(filename,
+        [filename, source]() {
+            std::ifstream file(filename);
+            if (!file) {
+                return false;
+            }
+
+            std::stringstream stream;
+            stream << file.rdbuf();
+            *source = stream.str();
+            return true;
+        },
+        [shader, type, source]() {
+            return shader->loadFromMemory(*source, type);
+        },
+        onReady
+    );
+}
+
+void rm::RMAssetLoader::loadTexture(sf::Texture* texture, const std::string& filename, std::function<void()> onReady) {
+    makePlaceholder(texture);
+
+    std::shared_ptr<sf::Image> image = std::make_shared<sf::Image>();
+
+    add(filename,
+        [filename, image]() {
+            return image->loadFromFile(filename);
+        },
+        [texture, image]() {
+            return texture->loadFromImage(*image);
+        },
+        onReady
+    );
+}
+
+void rm::RMAssetLoader::loadSkybox(RMSkybox* skybox, const std::string& filename, std::function<void()> onReady) {
+    makePlaceholder(&skybox->getTexture());
+
+    add(filename,
+        [skybox, filename]() {
+            return skybox->prepare(filename);
+        },
+        [skybox]() {
+            return skybox->upload();
+        },
+        onReady
+    );
+}
+#pragma endregion
+
+void rm::RMAssetLoader::update() {
+    for (auto it = jobs.begin(); it != jobs.end();) {
+        if (it->work.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            it++;
+            continue;
+        }
+
+        RM_PROFILE_SCOPE("Finish asset");
+
+        // Failed assets keep their placeholder
+        if (it->work.get() && it->finish()) {
+            std::cout << "Loaded " << it->name << std::endl;
+
+            if (it->onReady) {
+                it->onReady();
+            }
+        }
+        else {
+            std::cout << "Failed to load " << it->name << std::endl;
+        }
+
+        finished++;
+        it = jobs.erase(it);
+    }
+}
+
+bool rm::RMAssetLoader::isDone() {
+    return jobs.empty();
+}
+
+float rm::RMAssetLoader::getProgress() {
+    if (total == 0) {
+        return 1.f;
+    }
+
+    return (float)finished / (float)total;
+}
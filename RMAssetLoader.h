@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <future>
+#include <functional>
+#include <SFML/Graphics.hpp>
+
+#include "RMSkybox.h"
+
+namespace rm {
+
+    /*
+    Loads assets on worker threads so the window can show up right away.
+    File reads and image decoding happen in the background. Anything that needs
+    OpenGL (texture uploads, shader compiles) is finished by update() on the
+    main thread as soon as its background part is done.
+    Textures are given a 1x1 white placeholder until they are ready.
+    */
+    class RMAssetLoader {
+    private:
+        struct Job {
+            std::string name;
+            std::future<bool> work;
+            // Runs on the main thread once work is done
+            std::function<bool()> finish;
+            std::function<void()> onReady;
+        };
+
+        std::vector<Job> jobs;
+        unsigned int total;
+        unsigned int finished;
+
+        void add(const std::string& name, std::function<bool()> work, std::function<bool()> finish, std::function<void()> onReady);
+        static void makePlaceholder(sf::Texture* texture);
+
+    public:
+        RMAssetLoader();
+
+        // onReady is called on the main thread from update() once the asset can be used
+        void loadShader(sf::Shader* shader, const std::string& filename, sf::Shader::Type type, std::function<void()> onReady = nullptr);
+        void loadTexture(sf::Texture* texture, const std::string& filename, std::function<void()> onReady = nullptr);
+        void loadSkybox(RMSkybox* skybox, const std::string& filename, std::function<void()> onReady = nullptr);
+
+        // Finishes any assets whose background work is done, call once per frame
+        void update();
+
+        bool isDone();
+        // Fraction of the queued assets that are finished
+        float getProgress();
+    };
+}
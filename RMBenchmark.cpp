@@ -0,0 +1,162 @@
+#include "RMBenchmark.h"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstdlib>
+
+#include "RMShape.h"
+#include "RMSceneText.h"
+#include "Rotations.h"
+
+// Results go here so the compiler can't drop the work
+static volatile float sink;
+
+// Box distance the way getSignedDistance worked out the local point before rotations were cached
+static float boxEuler(Vec3 p, Vec3 position, Vec3 rotation, Vec3 size) {
+    p = inverseRotateXYZ(p - position, rotation);
+    Vec3 q = Vec3(std::fabs(p.x), std::fabs(p.y), std::fabs(p.z)) - size;
+    return rm::VectorHelper::length(rm::VectorHelper::vectorMax(q, Vec3(0, 0, 0))) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.f);
+}
+
+double rm::RMBenchmark::time(const Settings& settings, const std::function<float()>& run) {
+    typedef std::chrono::high_resolution_clock Clock;
+    double best = DBL_MAX;
+
+    for (unsigned int r = 0; r < std::max(settings.repeats, 1u); r++) {
+        Clock::time_point start = Clock::now();
+        sink = run();
+        std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+        best = std::min(best, elapsed.count() / std::max(settings.points, 1u));
+    }
+
+    return best;
+}
+
+// A scene as full as the shader allows, every statement and most properties, with comments
+static std::string benchmarkScene() {
+    std::string text = "# Generated for the parse benchmark\n";
+
+    for (int i = 0; i < rm::RMShape::MAX_SHAPES; i++) {
+        std::string n = std::to_string(i);
+        text += "material m" + n + " albedo 0.8 0.25 0.125 1 roughness 0.35 metallic 0 emissive 0\n";
+        text += (i % 2 == 0 ? "sphere s" : "box s") + n + " pos 1.25 -0.5 " + n + ".75 rot 0.1 0.2 0.3 "
+            + (i % 2 == 0 ? "radius 0.75" : "size 1 0.5 2") + " material m" + n + "  # shape " + n + "\n";
+
+        if (i > 0) text += "op s" + n + " smoothUnion s" + std::to_string(i - 1) + "\n";
+        text += "body s" + n + (i % 4 == 0 ? " static\n" : "\n");
+    }
+
+    return text;
+}
+
+int rm::RMBenchmark::runCommandLine(int argc, char** argv) {
+    Settings settings;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--points" || arg == "--repeats") {
+            if (i + 1 >= argc) {
+                std::cout << "Missing value for " << arg << std::endl;
+                return 1;
+            }
+
+            unsigned int value = (unsigned int)std::max(atoi(argv[++i]), 1);
+            if (arg == "--points") settings.points = value;
+            else settings.repeats = value;
+        }
+        else {
+            std::cout << "Usage: bench [--points n] [--repeats n]" << std::endl;
+            return 1;
+        }
+    }
+
+    // Points around the box, the same every run
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> coordinate(-4.f, 4.f);
+    std::vector<float> xs(settings.points), ys(settings.points), zs(settings.points);
+    for (unsigned int i = 0; i < settings.points; i++) {
+        xs[i] = coordinate(random);
+        ys[i] = coordinate(random);
+        zs[i] = coordinate(random);
+    }
+    std::vector<float> distances(settings.points);
+
+    const Vec3 position(0.5f, 1.f, -0.5f);
+    const Vec3 rotation(0.3f, 0.7f, 1.1f);
+    const Vec3 size(1.f, 0.5f, 2.f);
+    const Rotation cached = Rotation::fromEulerXYZ(rotation);
+    RMShape* box = RMShape::createBox(position, rotation, size);
+
+    struct Case {
+        const char* name;
+        std::function<float()> run;
+    };
+
+    const unsigned int n = settings.points;
+    Case cases[] = {
+        { "inverseRotateXYZ", [&]() {
+            float sum = 0.f;
+            for (unsigned int i = 0; i < n; i++) sum += inverseRotateXYZ(Vec3(xs[i], ys[i], zs[i]), rotation).x;
+            return sum;
+        } },
+        { "Rotation::inverseRotate", [&]() {
+            float sum = 0.f;
+            for (unsigned int i = 0; i < n; i++) sum += cached.inverseRotate(Vec3(xs[i], ys[i], zs[i])).x;
+            return sum;
+        } },
+        { "Box SDF with inverseRotateXYZ", [&]() {
+            float sum = 0.f;
+            for (unsigned int i = 0; i < n; i++) sum += boxEuler(Vec3(xs[i], ys[i], zs[i]), position, rotation, size);
+            return sum;
+        } },
+        { "RMShape::getSignedDistance (box)", [&]() {
+            float sum = 0.f;
+            for (unsigned int i = 0; i < n; i++) sum += box->getSignedDistance(Vec3(xs[i], ys[i], zs[i]));
+            return sum;
+        } },
+        { "RMShape::getSignedDistances (box)", [&]() {
+            box->getSignedDistances(xs.data(), ys.data(), zs.data(), n, distances.data());
+            return distances[n - 1];
+        } },
+    };
+
+    std::cout << n << " points, best of " << settings.repeats << " runs" << std::endl;
+    for (const Case& c : cases) {
+        std::cout << "  " << std::left << std::setw(36) << c.name << std::right << std::fixed << std::setprecision(2)
+            << std::setw(8) << time(settings, c.run) << " ns" << std::endl;
+    }
+
+    // Parsing is timed per byte, the same scene a thousandth of --points times per run
+    const std::string scene = benchmarkScene();
+    RMSceneText::Description check;
+    std::string error;
+    if (!RMSceneText::parse(scene.data(), scene.size(), check, &error)) {
+        std::cout << "Benchmark scene doesn't parse: " << error << std::endl;
+        return 1;
+    }
+
+    Settings parse = settings;
+    const unsigned int copies = std::max(settings.points / 1000, 1u);
+    parse.points = (unsigned int)(scene.size() * copies);
+    double nanosecondsPerByte = time(parse, [&]() {
+        size_t shapes = 0;
+        for (unsigned int i = 0; i < copies; i++) {
+            RMSceneText::Description description;
+            RMSceneText::parse(scene.data(), scene.size(), description);
+            shapes += description.shapes.size();
+        }
+        return (float)shapes;
+    });
+
+    std::cout << "  " << std::left << std::setw(36) << "RMSceneText::parse" << std::right
+        << std::setw(8) << 1e9 / nanosecondsPerByte / (1024.0 * 1024.0) << " MB/s" << std::endl;
+
+    return 0;
+}
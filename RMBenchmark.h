@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <functional>
+
+namespace rm {
+
+    /*
+    Microbenchmarks for the CPU hot paths, run with "RayMarchingCpp bench"
+    Every case walks the same random points (fixed seed) and reports the best of a few runs in
+    nanoseconds per point, on one core. Scene text parsing is reported in MB/s instead.
+    Build with optimisations on, the numbers mean little otherwise.
+    */
+    class RMBenchmark {
+    public:
+        struct Settings {
+            unsigned int points = 1000000;
+            unsigned int repeats = 5;
+        };
+
+        // Best time of settings.repeats runs of run(), in nanoseconds per point
+        static double time(const Settings& settings, const std::function<float()>& run);
+
+        // Parses the arguments after "bench", runs every case and prints the results, returns the exit code
+        static int runCommandLine(int argc, char** argv);
+    };
+}
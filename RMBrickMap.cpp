@@ -0,0 +1,346 @@
+#include "RMBrickMap.h"
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+const unsigned int rm::RMBrickMap::BRICK = 8;
+const sf::Uint32 rm::RMBrickMap::SPLIT = 0xFFFFFFFE;
+const sf::Uint32 rm::RMBrickMap::SOLID = 0xFFFFFFFF;
+std::vector<rm::RMBrickMap*> rm::RMBrickMap::maps;
+
+// Rough cost of one hash map entry
+static const size_t NODE_BYTES = 32;
+
+rm::RMBrickMap::RMBrickMap() {
+    origin = Vec3(0, 0, 0);
+    cellSize = 0;
+    band = 0;
+}
+
+rm::RMBrickMap::~RMBrickMap() {
+    release();
+}
+
+sf::Uint64 rm::RMBrickMap::key(unsigned int x, unsigned int y, unsigned int z) {
+    return (sf::Uint64)x | ((sf::Uint64)y << 21) | ((sf::Uint64)z << 42);
+}
+
+// Distances in [-band, band] map to 0 - 255
+static sf::Uint8 encodeDistance(float d, float band) {
+    float t = std::min(std::max(d / band, -1.f), 1.f) * 0.5f + 0.5f;
+    return (sf::Uint8)(t * 255.f + 0.5f);
+}
+
+// Closest of the shapes being built
+static float shapesDistance(const std::vector<rm::RMShape*>& shapes, Vec3 p, int* index) {
+    float best = FLT_MAX;
+    for (rm::RMShape* s : shapes) {
+        if (!s->isVisible() || s->getBoundDistance(p) > best) continue;
+
+        float d = s->getSignedDistance(p);
+        if (d < best) {
+            best = d;
+            *index = s->getIndex();
+        }
+    }
+    return best;
+}
+
+#pragma region Building
+bool rm::RMBrickMap::build(const std::vector<RMShape*>& shapes, Vec3 min, Vec3 max, const Settings& settings, std::string* error, Stats* stats) {
+    auto fail = [&](const std::string& reason) {
+        if (error != nullptr) *error = reason;
+        return false;
+    };
+
+    if (shapes.empty() || max.x <= min.x || max.y <= min.y || max.z <= min.z || settings.voxelSize <= 0.f) {
+        return fail("Nothing to build");
+    }
+
+    for (RMShape* s : shapes) {
+        if (s->getIndex() > 255) {
+            return fail("Only the first 256 shapes can be baked");
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Cells per side, rounded up to a power of two so the tree has one root
+    float size = std::max(max.x - min.x, std::max(max.y - min.y, max.z - min.z));
+    float cell = settings.voxelSize * BRICK;
+    unsigned int depth = 0;
+    while ((float)(1u << depth) * cell < size) {
+        depth++;
+        // Keys have 21 bits per axis
+        if (depth > 20) {
+            return fail("The box is too large for this voxel size");
+        }
+    }
+
+    release();
+
+    this->shapes = shapes;
+    origin = min;
+    cellSize = cell;
+    band = settings.bandVoxels * settings.voxelSize;
+    levels.assign(depth + 1, std::unordered_map<sf::Uint64, sf::Uint32>());
+
+    unsigned int threadCount = settings.threads != 0 ? settings.threads : std::max(std::thread::hardware_concurrency(), 1u);
+    auto runParallel = [&](const std::function<void()>& work) {
+        std::vector<std::thread> pool;
+        for (unsigned int i = 1; i < threadCount; i++) {
+            pool.emplace_back(work);
+        }
+        work();
+        for (std::thread& t : pool) {
+            t.join();
+        }
+    };
+
+    struct Node {
+        unsigned int x, y, z;
+    };
+
+    // Top down, a node is only split when a surface might pass through it
+    std::vector<Node> frontier({ { 0, 0, 0 } });
+    std::vector<Node> cells;
+    size_t nodes = 0;
+
+    for (int level = (int)depth; level >= 0; level--) {
+        float nodeSize = cell * (float)(1u << level);
+        float reach = nodeSize * 0.8660254f + band;
+
+        std::vector<std::vector<std::pair<sf::Uint64, sf::Uint32>>> found(threadCount);
+        std::vector<std::vector<Node>> next(threadCount);
+        std::atomic<size_t> nextNode(0);
+        std::atomic<unsigned int> nextThread(0);
+
+        runParallel([&]() {
+            unsigned int t = nextThread++;
+            int index;
+            size_t i;
+            while ((i = nextNode++) < frontier.size()) {
+                const Node& n = frontier[i];
+                Vec3 center = origin + Vec3(n.x + 0.5f, n.y + 0.5f, n.z + 0.5f) * nodeSize;
+                float d = shapesDistance(shapes, center, &index);
+
+                sf::Uint64 k = key(n.x, n.y, n.z);
+                if (fabs(d) > reach) {
+                    if (d < 0.f) {
+                        found[t].emplace_back(k, SOLID);
+                    }
+                }
+                else if (level == 0) {
+                    found[t].emplace_back(k, 0);
+                    next[t].push_back(n);
+                }
+                else {
+                    found[t].emplace_back(k, SPLIT);
+                    for (unsigned int c = 0; c < 8; c++) {
+                        next[t].push_back({ n.x * 2 + (c & 1), n.y * 2 + ((c >> 1) & 1), n.z * 2 + (c >> 2) });
+                    }
+                }
+            }
+        });
+
+        frontier.clear();
+        for (unsigned int t = 0; t < threadCount; t++) {
+            levels[level].insert(found[t].begin(), found[t].end());
+            frontier.insert(frontier.end(), next[t].begin(), next[t].end());
+            nodes += found[t].size();
+        }
+
+        size_t samples = BRICK + 1;
+        size_t bytes = nodes * NODE_BYTES + (level == 0 ? frontier.size() * samples * samples * samples * 2 : 0);
+        if (bytes > settings.memoryBudget) {
+            release();
+            return fail("Over the memory budget, " + std::to_string(bytes >> 20) + " MB needed by level " + std::to_string(level));
+        }
+    }
+
+    // The frontier is now every cell near a surface, in brick order
+    cells.swap(frontier);
+    for (size_t i = 0; i < cells.size(); i++) {
+        const Node& n = cells[i];
+        auto cellNode = levels[0].find(key(n.x, n.y, n.z));
+        cellNode->second = (sf::Uint32)i;
+    }
+
+    const size_t samples = BRICK + 1;
+    const size_t brickSize = samples * samples * samples;
+    distances.assign(cells.size() * brickSize, 0);
+    shapeIndices.assign(cells.size() * brickSize, 0);
+
+    float voxel = settings.voxelSize;
+    std::atomic<size_t> nextBrick(0);
+    runParallel([&]() {
+        std::vector<RMShape*> region;
+        std::vector<float> xs(brickSize), ys(brickSize), zs(brickSize), d(brickSize);
+        std::vector<int> index(brickSize);
+        size_t b;
+        while ((b = nextBrick++) < cells.size()) {
+            Vec3 corner = origin + Vec3((float)cells[b].x, (float)cells[b].y, (float)cells[b].z) * cell;
+            size_t first = b * brickSize;
+
+            // Only the shapes that can be closest within the band somewhere in this cell
+            RMShape::pruneShapes(shapes, corner, corner + Vec3(cell, cell, cell), region, band);
+
+            if (region.empty()) {
+                std::fill(distances.begin() + first, distances.begin() + first + brickSize, encodeDistance(band, band));
+                std::fill(shapeIndices.begin() + first, shapeIndices.begin() + first + brickSize, (sf::Uint8)shapes.front()->getIndex());
+                continue;
+            }
+
+            // The whole brick goes through the shapes in one batch
+            size_t i = 0;
+            for (size_t z = 0; z < samples; z++) {
+                for (size_t y = 0; y < samples; y++) {
+                    for (size_t x = 0; x < samples; x++, i++) {
+                        xs[i] = corner.x + (float)x * voxel;
+                        ys[i] = corner.y + (float)y * voxel;
+                        zs[i] = corner.z + (float)z * voxel;
+                    }
+                }
+            }
+            RMShape::getDistances(region, xs.data(), ys.data(), zs.data(), brickSize, d.data(), index.data());
+
+            for (i = 0; i < brickSize; i++) {
+                distances[first + i] = encodeDistance(d[i], band);
+                shapeIndices[first + i] = (sf::Uint8)(index[i] < 0 ? shapes.front()->getIndex() : index[i]);
+            }
+        }
+    });
+
+    for (RMShape* s : shapes) {
+        for (RMShape* part = s; part != nullptr; part = part->operandIndex < 0 ? nullptr : RMShape::shapes[part->operandIndex]) {
+            part->baked = true;
+        }
+    }
+
+    maps.push_back(this);
+
+    if (stats != nullptr) {
+        stats->bricks = cells.size();
+        stats->nodes = nodes;
+        stats->bytes = getMemoryUsage();
+        stats->levels = depth + 1;
+        stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    return true;
+}
+
+void rm::RMBrickMap::release() {
+    for (RMShape* s : shapes) {
+        for (RMShape* part = s; part != nullptr; part = part->operandIndex < 0 ? nullptr : RMShape::shapes[part->operandIndex]) {
+            part->baked = false;
+        }
+    }
+
+    shapes.clear();
+    levels.clear();
+    distances.clear();
+    distances.shrink_to_fit();
+    shapeIndices.clear();
+    shapeIndices.shrink_to_fit();
+    maps.erase(std::remove(maps.begin(), maps.end(), this), maps.end());
+}
+
+size_t rm::RMBrickMap::getMemoryUsage() {
+    size_t nodes = 0;
+    for (auto const& level : levels) {
+        nodes += level.size();
+    }
+    return nodes * NODE_BYTES + distances.size() + shapeIndices.size();
+}
+#pragma endregion
+
+#pragma region Sampling
+float rm::RMBrickMap::sampleBrick(sf::Uint32 brick, Vec3 local, int* shapeIndex) {
+    const unsigned int samples = BRICK + 1;
+    const sf::Uint8* d = &distances[(size_t)brick * samples * samples * samples];
+
+    Vec3 g = local * (float)BRICK;
+    unsigned int x = std::min((unsigned int)g.x, BRICK - 1);
+    unsigned int y = std::min((unsigned int)g.y, BRICK - 1);
+    unsigned int z = std::min((unsigned int)g.z, BRICK - 1);
+    float fx = g.x - x;
+    float fy = g.y - y;
+    float fz = g.z - z;
+
+    if (shapeIndex != nullptr) {
+        *shapeIndex = shapeIndices[(size_t)brick * samples * samples * samples
+            + ((z + (fz > 0.5f)) * samples + (y + (fy > 0.5f))) * samples + (x + (fx > 0.5f))];
+    }
+
+    auto at = [&](unsigned int dx, unsigned int dy, unsigned int dz) {
+        return (float)d[((z + dz) * samples + (y + dy)) * samples + (x + dx)];
+    };
+
+    float c00 = at(0, 0, 0) + (at(1, 0, 0) - at(0, 0, 0)) * fx;
+    float c10 = at(0, 1, 0) + (at(1, 1, 0) - at(0, 1, 0)) * fx;
+    float c01 = at(0, 0, 1) + (at(1, 0, 1) - at(0, 0, 1)) * fx;
+    float c11 = at(0, 1, 1) + (at(1, 1, 1) - at(0, 1, 1)) * fx;
+
+    float c0 = c00 + (c10 - c00) * fy;
+    float c1 = c01 + (c11 - c01) * fy;
+
+    return ((c0 + (c1 - c0) * fz) / 255.f * 2.f - 1.f) * band;
+}
+
+float rm::RMBrickMap::getDistance(Vec3 p, int* shapeIndex) {
+    if (shapeIndex != nullptr) {
+        *shapeIndex = -1;
+    }
+
+    if (levels.empty()) {
+        return FLT_MAX;
+    }
+
+    // Position in cells
+    const unsigned int depth = (unsigned int)levels.size() - 1;
+    const float cells = (float)(1u << depth);
+    Vec3 c = (p - origin) / cellSize;
+    Vec3 q = VectorHelper::vectorMin(VectorHelper::vectorMax(c, Vec3(0, 0, 0)), Vec3(cells, cells, cells));
+
+    // Nothing was built outside the tree
+    float outside = VectorHelper::length(c - q) * cellSize;
+    if (outside > 0.f) {
+        return outside;
+    }
+
+    unsigned int x = std::min((unsigned int)q.x, (1u << depth) - 1);
+    unsigned int y = std::min((unsigned int)q.y, (1u << depth) - 1);
+    unsigned int z = std::min((unsigned int)q.z, (1u << depth) - 1);
+
+    // Down from the root until a node isn't split
+    for (int level = (int)depth; level >= 0; level--) {
+        auto node = levels[level].find(key(x >> level, y >> level, z >> level));
+
+        if (node != levels[level].end() && node->second == SPLIT) {
+            continue;
+        }
+
+        if (node != levels[level].end() && node->second != SOLID) {
+            return sampleBrick(node->second, c - Vec3((float)x, (float)y, (float)z), shapeIndex);
+        }
+
+        // Every surface is at least the band beyond the faces of this node
+        float nodeSize = (float)(1u << level);
+        Vec3 low((float)((x >> level) << level), (float)((y >> level) << level), (float)((z >> level) << level));
+        Vec3 toLow = c - low;
+        Vec3 toHigh = low + Vec3(nodeSize, nodeSize, nodeSize) - c;
+        float faces = std::min(std::min(std::min(toLow.x, toHigh.x), std::min(toLow.y, toHigh.y)), std::min(toLow.z, toHigh.z));
+        float d = faces * cellSize + band;
+
+        return node == levels[level].end() ? d : -d;
+    }
+
+    return FLT_MAX;
+}
+#pragma endregion
@@ -0,0 +1,87 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <SFML/Graphics.hpp>
+
+#include "RMShape.h"
+
+namespace rm {
+
+    /*
+    Sparse distance field for scenes too large for an RMSdfVolume
+    Space is split into an octree of cubic nodes, the smallest ones (cells) are BRICK voxels across.
+    Only cells within the band of a surface get a brick, every other node is left out (empty space)
+    or marked solid, so memory grows with surface area rather than with the size of the world.
+    Each level of the tree is a hash map from node coordinates so nothing is stored for empty space at all.
+
+    In a node without surfaces the distance to the node's faces plus the band is a safe lower bound,
+    so a ray far from everything takes steps the size of the largest empty node around it.
+    The brick map is read on the CPU (RMShape::getSceneDistance), the shader keeps drawing the shapes themselves.
+    */
+    class RMBrickMap {
+    public:
+        struct Settings {
+            // Size of one voxel in world units
+            float voxelSize = 0.05f;
+            // Width of the stored band in voxels
+            float bandVoxels = 2.f;
+            // Build fails rather than going over this many bytes of bricks and nodes
+            size_t memoryBudget = (size_t)512 << 20;
+            // 0 uses every core
+            unsigned int threads = 0;
+        };
+
+        struct Stats {
+            size_t bricks = 0;
+            size_t nodes = 0;
+            size_t bytes = 0;
+            unsigned int levels = 0;
+            double seconds = 0;
+        };
+
+        RMBrickMap();
+        ~RMBrickMap();
+
+        /*
+        Builds the map for the shapes inside the box from min to max
+        The box is rounded up to a power of two number of cells, planes are cut off at its edges
+        */
+        bool build(const std::vector<RMShape*>& shapes, Vec3 min, Vec3 max, const Settings& settings, std::string* error = nullptr, Stats* stats = nullptr);
+
+        // Gives the shapes back to the analytic path and frees the bricks
+        void release();
+
+        // Lower bound away from surfaces, interpolated near them. shapeIndex is -1 when no brick was read
+        float getDistance(Vec3 p, int* shapeIndex = nullptr);
+
+        size_t getMemoryUsage();
+
+        // Voxels per brick side
+        static const unsigned int BRICK;
+
+        // Every built map, read by RMShape::getSceneDistance
+        static std::vector<RMBrickMap*> maps;
+
+    private:
+        // Node values, anything else at level 0 is a brick index
+        static const sf::Uint32 SPLIT;
+        static const sf::Uint32 SOLID;
+
+        std::vector<RMShape*> shapes;
+
+        Vec3 origin;
+        float cellSize;
+        float band;
+
+        // levels[0] holds cells, levels[i] nodes 2^i cells across. Missing nodes are empty
+        std::vector<std::unordered_map<sf::Uint64, sf::Uint32>> levels;
+
+        // (BRICK + 1)^3 samples per brick so cells don't need their neighbours
+        std::vector<sf::Uint8> distances;
+        std::vector<sf::Uint8> shapeIndices;
+
+        static sf::Uint64 key(unsigned int x, unsigned int y, unsigned int z);
+        float sampleBrick(sf::Uint32 brick, Vec3 local, int* shapeIndex);
+    };
+}
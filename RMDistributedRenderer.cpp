@@ -0,0 +1,607 @@
+#include "RMDistributedRenderer.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+const unsigned short rm::RMDistributedRenderer::DEFAULT_PORT = 5417;
+const sf::Uint32 rm::RMDistributedRenderer::PROTOCOL_VERSION = 2;
+const unsigned int rm::RMDistributedRenderer::TILES_IN_FLIGHT = 3;
+
+struct TileJob {
+    sf::Uint32 frame;
+    sf::Uint32 x0, y0, x1, y1;
+};
+
+#pragma region Helpers
+// FNV-1a, only has to tell scenes apart
+static sf::Uint64 hashData(const std::string& data) {
+    sf::Uint64 hash = 14695981039346656037ull;
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool readFile(const std::string& filename, std::string& data) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::stringstream stream;
+    stream << file.rdbuf();
+    data = stream.str();
+    return true;
+}
+
+static void writeTile(sf::Packet& packet, const TileJob& tile) {
+    packet << tile.frame << tile.x0 << tile.y0 << tile.x1 << tile.y1;
+}
+
+static bool readTile(sf::Packet& packet, TileJob& tile) {
+    return (bool)(packet >> tile.frame >> tile.x0 >> tile.y0 >> tile.x1 >> tile.y1);
+}
+
+// Only what changes the pixels, the output is the coordinator's business
+static void writeSettings(sf::Packet& packet, const rm::RMOfflineRenderer::Settings& settings) {
+    packet << (sf::Uint32)settings.width << (sf::Uint32)settings.height << (sf::Uint32)settings.frames
+        << settings.fps << settings.startTime << (sf::Int32)settings.maxSteps << settings.sky
+        << (sf::Int32)settings.heatmap << (sf::Uint32)settings.heatmapScale;
+}
+
+static bool readSettings(sf::Packet& packet, rm::RMOfflineRenderer::Settings& settings) {
+    sf::Uint32 width, height, frames, heatmapScale;
+    sf::Int32 maxSteps, heatmap;
+    if (!(packet >> width >> height >> frames >> settings.fps >> settings.startTime >> maxSteps >> settings.sky >> heatmap >> heatmapScale)) {
+        return false;
+    }
+
+    settings.width = width;
+    settings.height = height;
+    settings.frames = frames;
+    settings.maxSteps = maxSteps;
+    settings.heatmap = heatmap;
+    settings.heatmapScale = heatmapScale;
+    return true;
+}
+
+static void writePath(sf::Packet& packet, const std::vector<rm::RMOfflineRenderer::Keyframe>& path) {
+    packet << (sf::Uint32)path.size();
+    for (const rm::RMOfflineRenderer::Keyframe& k : path) {
+        packet << k.time << k.position.x << k.position.y << k.position.z << k.rotation.x << k.rotation.y << k.rotation.z;
+    }
+}
+
+static bool readPath(sf::Packet& packet, std::vector<rm::RMOfflineRenderer::Keyframe>& path) {
+    sf::Uint32 count;
+    if (!(packet >> count)) {
+        return false;
+    }
+
+    path.resize(count);
+    for (rm::RMOfflineRenderer::Keyframe& k : path) {
+        if (!(packet >> k.time >> k.position.x >> k.position.y >> k.position.z >> k.rotation.x >> k.rotation.y >> k.rotation.z)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+#pragma endregion
+
+#pragma region Coordinator
+struct RemoteWorker {
+    std::unique_ptr<sf::TcpSocket> socket;
+    std::string name;
+    bool ready = false;
+    sf::Uint32 threads = 1;
+    std::deque<TileJob> inFlight;
+
+    // For the report at the end
+    unsigned int tiles = 0;
+    double rays = 0;
+    double busySeconds = 0;
+    double steps = 0;
+};
+
+struct PendingFrame {
+    std::vector<float> rgb;
+    unsigned int tilesLeft;
+};
+
+int rm::RMDistributedRenderer::runCoordinator(int argc, char** argv, const std::string& executable) {
+    RMOfflineRenderer::Settings settings;
+    unsigned short port = DEFAULT_PORT;
+    unsigned int localWorkers = 0;
+    bool baseline = false;
+
+    for (int i = 1; i < argc;) {
+        std::string arg = argv[i];
+
+        if (arg == "--baseline") {
+            baseline = true;
+            i++;
+            continue;
+        }
+
+        if ((arg == "--port" || arg == "--local") && i + 1 < argc) {
+            int value = atoi(argv[i + 1]);
+            if (arg == "--port") port = (unsigned short)value;
+            else localWorkers = (unsigned int)std::max(value, 0);
+            i += 2;
+            continue;
+        }
+
+        int used = RMOfflineRenderer::parseOption(argc, argv, i, settings);
+        if (used < 0) {
+            return 1;
+        }
+
+        if (used == 0) {
+            if (arg[0] == '-') {
+                std::cout << "Unknown option " << arg << std::endl;
+                return 1;
+            }
+
+            settings.scene = arg;
+            used = 1;
+        }
+
+        i += used;
+    }
+
+    if (settings.scene.empty()) {
+        std::cout << "Usage: coordinate <scene.rms|scene.rmsc> [render options] [--port p] [--local n] [--baseline]" << std::endl;
+        return 1;
+    }
+
+    // The scene goes to the workers as it is on disk
+    std::string sceneData;
+    if (!readFile(settings.scene, sceneData)) {
+        std::cout << "Could not open " << settings.scene << std::endl;
+        return 1;
+    }
+
+    sf::Uint64 sceneHash = hashData(sceneData);
+    size_t dot = settings.scene.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : settings.scene.substr(dot);
+
+    std::vector<RMOfflineRenderer::Keyframe> path;
+    std::string error;
+    if (!settings.camera.empty() && !RMOfflineRenderer::loadPath(settings.camera, path, &error)) {
+        std::cout << error << std::endl;
+        return 1;
+    }
+
+    // Only used to name and write the frames
+    RMOfflineRenderer output(settings);
+
+    // Every tile of every frame, in order so few frames are in flight at once
+    const unsigned int tileSize = std::max(settings.tileSize, 1u);
+    std::deque<TileJob> queue;
+    for (sf::Uint32 frame = 0; frame < settings.frames; frame++) {
+        for (sf::Uint32 y = 0; y < settings.height; y += tileSize) {
+            for (sf::Uint32 x = 0; x < settings.width; x += tileSize) {
+                queue.push_back({ frame, x, y, std::min(x + tileSize, settings.width), std::min(y + tileSize, settings.height) });
+            }
+        }
+    }
+    const unsigned int tilesPerFrame = (unsigned int)(queue.size() / settings.frames);
+
+    // Frame 0 again for the single worker baseline, only handed out while baselineLeft > 0
+    const std::deque<TileJob> baselineTiles(queue.begin(), queue.begin() + tilesPerFrame);
+    std::deque<TileJob> baselineQueue = baselineTiles;
+    unsigned int baselineLeft = baseline ? tilesPerFrame : 0;
+    RemoteWorker* baselineWorker = nullptr;
+    auto baselineStart = std::chrono::high_resolution_clock::now();
+    double baselineSeconds = 0;
+
+    sf::TcpListener listener;
+    if (listener.listen(port) != sf::Socket::Done) {
+        std::cout << "Could not listen on port " << port << std::endl;
+        return 1;
+    }
+
+    sf::SocketSelector selector;
+    selector.add(listener);
+
+    for (unsigned int i = 0; i < localWorkers; i++) {
+        unsigned int threads = std::max(std::thread::hardware_concurrency() / localWorkers, 1u);
+        std::string command = "\"" + executable + "\" worker 127.0.0.1:" + std::to_string(port) + " --threads " + std::to_string(threads);
+#ifdef _WIN32
+        // cmd.exe drops the outer pair of quotes
+        command = "\"" + command + "\"";
+#endif
+        std::thread([command]() { std::system(command.c_str()); }).detach();
+    }
+
+    std::cout << "Waiting for workers on port " << port << std::endl;
+
+    std::vector<std::unique_ptr<RemoteWorker>> workers;
+    std::vector<std::unique_ptr<RemoteWorker>> finished;
+    std::map<sf::Uint32, PendingFrame> frames;
+    unsigned int framesLeft = settings.frames;
+
+    // Timed from the first ready worker (or the end of the baseline) so start up isn't counted against the workers
+    auto start = std::chrono::high_resolution_clock::now();
+    bool started = false;
+
+    // Puts a worker's unfinished tiles back at the front of the queue
+    auto drop = [&](size_t index) {
+        RemoteWorker& w = *workers[index];
+        std::cout << "Lost worker " << w.name << std::endl;
+
+        if (baselineLeft > 0) {
+            // The baseline has to be one worker from start to end, so it starts over on the next one
+            if (&w == baselineWorker) {
+                baselineQueue = baselineTiles;
+                baselineLeft = tilesPerFrame;
+                baselineWorker = nullptr;
+            }
+        }
+        else {
+            queue.insert(queue.begin(), w.inFlight.begin(), w.inFlight.end());
+        }
+        selector.remove(*w.socket);
+        finished.push_back(std::move(workers[index]));
+        workers.erase(workers.begin() + index);
+    };
+
+    while (framesLeft > 0) {
+        if (!selector.wait(sf::seconds(5))) {
+            if (workers.empty()) std::cout << "Still waiting for workers" << std::endl;
+            continue;
+        }
+
+        if (selector.isReady(listener)) {
+            std::unique_ptr<RemoteWorker> w(new RemoteWorker());
+            w->socket.reset(new sf::TcpSocket());
+
+            if (listener.accept(*w->socket) == sf::Socket::Done) {
+                w->name = w->socket->getRemoteAddress().toString() + ":" + std::to_string(w->socket->getRemotePort());
+                selector.add(*w->socket);
+                workers.push_back(std::move(w));
+            }
+        }
+
+        for (size_t i = 0; i < workers.size(); i++) {
+            RemoteWorker& w = *workers[i];
+            if (!selector.isReady(*w.socket)) continue;
+
+            sf::Packet packet;
+            sf::Uint8 message;
+            if (w.socket->receive(packet) != sf::Socket::Done || !(packet >> message)) {
+                drop(i--);
+                continue;
+            }
+
+            bool ok = true;
+            sf::Packet reply;
+
+            if (message == Hello) {
+                sf::Uint32 version;
+                ok = (packet >> version >> w.threads) && version == PROTOCOL_VERSION;
+
+                reply << (sf::Uint8)Scene << sceneHash << extension;
+                writeSettings(reply, settings);
+                writePath(reply, path);
+            }
+            else if (message == SceneStatus) {
+                bool cached;
+                ok = (bool)(packet >> cached);
+                if (!cached) {
+                    reply << (sf::Uint8)SceneData << sceneData;
+                }
+            }
+            else if (message == Ready) {
+                ok = (packet >> w.ready) && w.ready;
+                if (ok) {
+                    std::cout << "Worker " << w.name << " ready with " << w.threads << " threads" << std::endl;
+
+                    if (!started) {
+                        start = std::chrono::high_resolution_clock::now();
+                        started = true;
+                    }
+                }
+            }
+            else if (message == TileResult) {
+                TileJob tile;
+                sf::Uint64 steps;
+                float seconds;
+                ok = readTile(packet, tile) && (packet >> steps >> seconds);
+
+                // Has to be a tile this worker was given, pixels are the rest of the packet
+                auto job = std::find_if(w.inFlight.begin(), w.inFlight.end(), [&](const TileJob& t) {
+                    return t.frame == tile.frame && t.x0 == tile.x0 && t.y0 == tile.y0;
+                });
+                size_t columns = ok ? tile.x1 - tile.x0 : 0;
+                size_t bytes = ok ? columns * (tile.y1 - tile.y0) * 3 * sizeof(float) : 0;
+                ok = ok && job != w.inFlight.end() && job->x1 == tile.x1 && job->y1 == tile.y1 && packet.getDataSize() >= bytes;
+
+                if (ok && baselineLeft > 0) {
+                    // Only timed, the real frame 0 is still in the queue
+                    w.inFlight.erase(job);
+                    if (--baselineLeft == 0) {
+                        start = std::chrono::high_resolution_clock::now();
+                        baselineSeconds = std::chrono::duration<double>(start - baselineStart).count();
+                        std::cout << "Baseline frame took " << baselineSeconds << "s on " << w.name << std::endl;
+                    }
+                }
+                else if (ok) {
+                    w.inFlight.erase(job);
+                    w.tiles++;
+                    w.rays += (double)columns * (tile.y1 - tile.y0);
+                    w.busySeconds += seconds;
+                    w.steps += (double)steps;
+
+                    PendingFrame& frame = frames[tile.frame];
+                    if (frame.rgb.empty()) {
+                        frame.rgb.resize((size_t)settings.width * settings.height * 3);
+                        frame.tilesLeft = tilesPerFrame;
+                    }
+
+                    // Stitch the rows into the frame
+                    const char* pixels = (const char*)packet.getData() + packet.getDataSize() - bytes;
+                    for (sf::Uint32 y = tile.y0; y < tile.y1; y++) {
+                        memcpy(&frame.rgb[((size_t)y * settings.width + tile.x0) * 3], pixels, columns * 3 * sizeof(float));
+                        pixels += columns * 3 * sizeof(float);
+                    }
+
+                    if (--frame.tilesLeft == 0) {
+                        if (!output.saveFrame(tile.frame, frame.rgb, &error)) {
+                            std::cout << error << std::endl;
+                        }
+
+                        frames.erase(tile.frame);
+                        framesLeft--;
+                    }
+                }
+            }
+            else {
+                ok = false;
+            }
+
+            if (!ok || (reply.getDataSize() > 0 && w.socket->send(reply) != sf::Socket::Done)) {
+                drop(i--);
+            }
+        }
+
+        // The baseline goes to the first ready worker, everyone else waits for it
+        if (baselineLeft > 0 && baselineWorker == nullptr) {
+            for (std::unique_ptr<RemoteWorker>& w : workers) {
+                if (w->ready && w->inFlight.empty()) {
+                    baselineWorker = w.get();
+                    baselineStart = std::chrono::high_resolution_clock::now();
+                    break;
+                }
+            }
+        }
+
+        // Keep every ready worker a few tiles ahead
+        for (size_t i = 0; i < workers.size(); i++) {
+            RemoteWorker& w = *workers[i];
+            std::deque<TileJob>& source = baselineLeft > 0 ? baselineQueue : queue;
+            if (baselineLeft > 0 && &w != baselineWorker) continue;
+
+            while (w.ready && w.inFlight.size() < TILES_IN_FLIGHT && !source.empty()) {
+                sf::Packet packet;
+                packet << (sf::Uint8)Tile;
+                writeTile(packet, source.front());
+
+                if (w.socket->send(packet) != sf::Socket::Done) {
+                    drop(i--);
+                    break;
+                }
+
+                w.inFlight.push_back(source.front());
+                source.pop_front();
+            }
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    for (std::unique_ptr<RemoteWorker>& w : workers) {
+        sf::Packet packet;
+        packet << (sf::Uint8)Quit;
+        w->socket->send(packet);
+        finished.push_back(std::move(w));
+    }
+
+    double totalRays = (double)settings.width * settings.height * settings.frames;
+    double steps = 0;
+    unsigned int rendered = 0;
+    for (std::unique_ptr<RemoteWorker>& w : finished) {
+        steps += w->steps;
+        if (w->tiles > 0) rendered++;
+    }
+
+    printf("Rendered %u frames in %.3fs (%.2f Mrays/s, %.1f steps per ray)\n", settings.frames, elapsed.count(),
+        totalRays / elapsed.count() / 1e6, steps / totalRays);
+
+    // Busy is the share of the wall time a worker spent rendering, the rest went to the network or waiting
+    for (std::unique_ptr<RemoteWorker>& w : finished) {
+        if (w->tiles == 0) continue;
+
+        printf("  %-21s %3u threads %6u tiles %7.2f Mrays/s  %5.1f%% busy\n",
+            w->name.c_str(), w->threads, w->tiles,
+            w->busySeconds > 0 ? w->rays / w->busySeconds / 1e6 : 0.0,
+            100.0 * w->busySeconds / elapsed.count());
+    }
+
+    // Efficiency is throughput(n) / (n * throughput(1)), 100% when every worker added a whole worker's worth
+    if (baselineSeconds > 0 && rendered > 0) {
+        double single = (double)settings.width * settings.height / baselineSeconds;
+        double throughput = totalRays / elapsed.count();
+        printf("One worker %.2f Mrays/s, %u workers %.2fx faster (%.1f%% efficiency)\n",
+            single / 1e6, rendered, throughput / single, 100.0 * throughput / (rendered * single));
+    }
+
+    return 0;
+}
+#pragma endregion
+
+#pragma region Worker
+int rm::RMDistributedRenderer::runWorker(int argc, char** argv) {
+    if (argc < 2) {
+        std::cout << "Usage: worker <host[:port]> [--threads n]" << std::endl;
+        return 1;
+    }
+
+    std::string host = argv[1];
+    unsigned short port = DEFAULT_PORT;
+    size_t colon = host.find(':');
+    if (colon != std::string::npos) {
+        port = (unsigned short)atoi(host.c_str() + colon + 1);
+        host.erase(colon);
+    }
+
+    unsigned int threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (std::string(argv[i]) == "--threads") {
+            threadCount = (unsigned int)std::max(atoi(argv[i + 1]), 1);
+        }
+    }
+
+    // The coordinator may still be starting up
+    sf::TcpSocket socket;
+    int attempts = 0;
+    while (socket.connect(sf::IpAddress(host), port, sf::seconds(2)) != sf::Socket::Done) {
+        if (++attempts == 10) {
+            std::cout << "Could not connect to " << host << ":" << port << std::endl;
+            return 1;
+        }
+        sf::sleep(sf::milliseconds(500));
+    }
+
+    sf::Packet hello;
+    hello << (sf::Uint8)Hello << PROTOCOL_VERSION << (sf::Uint32)threadCount;
+    if (socket.send(hello) != sf::Socket::Done) {
+        return 1;
+    }
+
+    std::unique_ptr<RMOfflineRenderer> renderer;
+    RMOfflineRenderer::Settings settings;
+    std::vector<RMOfflineRenderer::Keyframe> path;
+    std::string cacheFile;
+    sf::Uint64 sceneHash = 0;
+
+    // Loads the cached scene and tells the coordinator if it worked
+    auto loadScene = [&]() {
+        std::string error;
+        settings.scene = cacheFile;
+        renderer.reset(new RMOfflineRenderer(settings));
+
+        bool loaded = renderer->load(&error);
+        if (loaded) {
+            renderer->setPath(path);
+        }
+        else {
+            std::cout << error << std::endl;
+        }
+
+        sf::Packet packet;
+        packet << (sf::Uint8)Ready << loaded;
+        return socket.send(packet) == sf::Socket::Done && loaded;
+    };
+
+    sf::Packet packet;
+    while (socket.receive(packet) == sf::Socket::Done) {
+        sf::Uint8 message;
+        if (!(packet >> message)) break;
+
+        if (message == Scene) {
+            std::string extension;
+            if (!(packet >> sceneHash >> extension) || !readSettings(packet, settings) || !readPath(packet, path)) break;
+
+            char name[32];
+            snprintf(name, sizeof(name), "rmcache_%016llx", (unsigned long long)sceneHash);
+            cacheFile = name + extension;
+
+            // Anything that doesn't hash the same is stale
+            std::string cached;
+            bool hit = readFile(cacheFile, cached) && hashData(cached) == sceneHash;
+
+            sf::Packet status;
+            status << (sf::Uint8)SceneStatus << hit;
+            if (socket.send(status) != sf::Socket::Done) break;
+
+            if (hit && !loadScene()) break;
+        }
+        else if (message == SceneData) {
+            std::string data;
+            if (!(packet >> data) || hashData(data) != sceneHash) break;
+
+            // Written under another name first so a cut off write is never mistaken for the scene
+            std::string partial = cacheFile + ".part";
+            {
+                std::ofstream file(partial, std::ios::binary);
+                file.write(data.data(), data.size());
+            }
+            std::remove(cacheFile.c_str());
+            std::rename(partial.c_str(), cacheFile.c_str());
+
+            if (!loadScene()) break;
+        }
+        else if (message == Tile) {
+            TileJob tile;
+            if (renderer == nullptr || !readTile(packet, tile) || tile.x1 > settings.width || tile.y1 > settings.height ||
+                tile.x0 >= tile.x1 || tile.y0 >= tile.y1) break;
+
+            size_t stride = (size_t)(tile.x1 - tile.x0) * 3;
+            std::vector<float> pixels(stride * (tile.y1 - tile.y0));
+            std::atomic<sf::Uint32> nextRow(tile.y0);
+            std::atomic<long long> steps(0);
+
+            auto start = std::chrono::high_resolution_clock::now();
+
+            // Rows of the tile are shared between the cores
+            auto work = [&]() {
+                sf::Uint32 y;
+                while ((y = nextRow++) < tile.y1) {
+                    steps += renderer->renderTile(tile.frame, tile.x0, y, tile.x1, y + 1, &pixels[(y - tile.y0) * stride], stride);
+                }
+            };
+
+            std::vector<std::thread> threads;
+            for (unsigned int i = 1; i < threadCount; i++) {
+                threads.emplace_back(work);
+            }
+            work();
+            for (std::thread& t : threads) {
+                t.join();
+            }
+
+            std::chrono::duration<float> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            sf::Packet result;
+            result << (sf::Uint8)TileResult;
+            writeTile(result, tile);
+            result << (sf::Uint64)steps << elapsed.count();
+            result.append(pixels.data(), pixels.size() * sizeof(float));
+
+            if (socket.send(result) != sf::Socket::Done) break;
+        }
+        else {
+            // Quit or something this worker doesn't understand
+            break;
+        }
+
+        packet.clear();
+    }
+
+    return 0;
+}
+#pragma endregion
@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <SFML/Network.hpp>
+
+#include "RMOfflineRenderer.h"
+
+namespace rm {
+
+    /*
+    Splits an offline render between worker processes over TCP
+    The coordinator sends each worker the scene and camera path once, workers keep the scene in a
+    cache file named after its hash so later jobs with the same scene skip the transfer.
+    Tiles are then handed out a few at a time and stitched into frames as they come back.
+    Workers render a tile with all of their cores, can join at any point and the tiles
+    of a worker that drops out go back in the queue.
+
+    Command line (run.cpp forwards these):
+        coordinate <scene> [render options from RMOfflineRenderer.h] [--port p] [--local n] [--baseline]
+        worker <host[:port]> [--threads n]
+    --local starts n workers on this machine that connect through loopback.
+    --baseline first renders frame 0 on the first ready worker alone (and throws it away), then reports
+    the speedup and scaling efficiency of the whole job against it. The workers are taken to be alike.
+    A --sky image has to exist at the same path on every worker.
+    */
+    class RMDistributedRenderer {
+    public:
+        // First value of every packet
+        enum Message : sf::Uint8 {
+            Hello = 1,      // worker -> coordinator: version, threads
+            Scene,          // coordinator -> worker: scene hash, extension, settings, camera path
+            SceneStatus,    // worker -> coordinator: whether the scene was in the cache
+            SceneData,      // coordinator -> worker: the scene file
+            Ready,          // worker -> coordinator: whether the scene loaded
+            Tile,           // coordinator -> worker: frame, x0, y0, x1, y1
+            TileResult,     // worker -> coordinator: the tile, march steps, seconds spent, RGB floats
+            Quit            // coordinator -> worker
+        };
+
+        // executable is used to start local workers
+        static int runCoordinator(int argc, char** argv, const std::string& executable);
+        static int runWorker(int argc, char** argv);
+
+        static const unsigned short DEFAULT_PORT;
+        static const sf::Uint32 PROTOCOL_VERSION;
+        // Tiles queued on a worker so it never waits on the network
+        static const unsigned int TILES_IN_FLIGHT;
+    };
+}
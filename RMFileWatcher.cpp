@@ -0,0 +1,128 @@
+#include "RMFileWatcher.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <climits>
+#endif
+
+const float rm::RMFileWatcher::SETTLE_TIME = 0.1f;
+const float rm::RMFileWatcher::POLL_INTERVAL = 0.25f;
+
+// Modification time and size, both 0 when the file doesn't exist
+static void fileState(const std::string& filename, long long& modified, long long& size) {
+#ifdef _WIN32
+    struct _stat64 info;
+    bool exists = _stat64(filename.c_str(), &info) == 0;
+#else
+    struct stat info;
+    bool exists = stat(filename.c_str(), &info) == 0;
+#endif
+
+    modified = exists ? (long long)info.st_mtime : 0;
+    size = exists ? (long long)info.st_size : 0;
+}
+
+rm::RMFileWatcher::RMFileWatcher() {
+    lastPoll = 0.f;
+
+#ifdef __linux__
+    inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+rm::RMFileWatcher::~RMFileWatcher() {
+#ifdef __linux__
+    // Closing the descriptor also removes its watches
+    if (inotify >= 0) close(inotify);
+#endif
+}
+
+void rm::RMFileWatcher::watch(const std::string& filename, std::function<void()> onChange) {
+    Watch w;
+    w.filename = filename;
+    w.onChange = onChange;
+
+    size_t slash = filename.find_last_of("/\\");
+    w.directory = slash == std::string::npos ? "." : filename.substr(0, slash);
+    w.name = slash == std::string::npos ? filename : filename.substr(slash + 1);
+
+    fileState(filename, w.modified, w.size);
+
+#ifdef __linux__
+    if (inotify >= 0) {
+        // Writes that finish and files moved into place (how most editors save)
+        int wd = inotify_add_watch(inotify, w.directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd >= 0) {
+            directories[wd] = w.directory;
+            w.polled = false;
+        }
+    }
+#endif
+
+    watches.push_back(w);
+}
+
+void rm::RMFileWatcher::poll() {
+    float now = clock.getElapsedTime().asSeconds();
+
+#ifdef __linux__
+    if (inotify >= 0) {
+        alignas(inotify_event) char buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+
+        ssize_t length;
+        while ((length = read(inotify, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + length;) {
+                const inotify_event* event = (const inotify_event*)p;
+                p += sizeof(inotify_event) + event->len;
+
+                auto dir = directories.find(event->wd);
+                if (event->len == 0 || dir == directories.end()) continue;
+
+                for (Watch& w : watches) {
+                    if (!w.polled && w.directory == dir->second && w.name == event->name) {
+                        w.pending = true;
+                        w.lastEvent = now;
+                    }
+                }
+            }
+        }
+    }
+#endif
+
+    if (now - lastPoll < POLL_INTERVAL) {
+        return;
+    }
+    lastPoll = now;
+
+    for (Watch& w : watches) {
+        if (!w.polled) continue;
+
+        long long modified, size;
+        fileState(w.filename, modified, size);
+
+        if (modified != w.modified || size != w.size) {
+            w.modified = modified;
+            w.size = size;
+            w.pending = true;
+            w.lastEvent = now;
+        }
+    }
+}
+
+void rm::RMFileWatcher::update() {
+    poll();
+
+    float now = clock.getElapsedTime().asSeconds();
+    for (Watch& w : watches) {
+        if (!w.pending || now - w.lastEvent < SETTLE_TIME) continue;
+
+        w.pending = false;
+        if (w.onChange) {
+            w.onChange();
+        }
+    }
+}
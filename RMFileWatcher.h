@@ -0,0 +1,63 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <SFML/System.hpp>
+
+namespace rm {
+
+    /*
+    Calls back when a file on disk changes, used to reload scenes and shaders without restarting.
+    Uses inotify on Linux, other platforms (and directories inotify can't watch) compare modification times a few times a second.
+    The directory is watched instead of the file so editors that save by replacing the file
+    still count, and a change only fires once the file has stopped changing for SETTLE_TIME.
+    */
+    class RMFileWatcher {
+    private:
+        struct Watch {
+            std::string filename;
+            std::string directory;
+            std::string name;
+            std::function<void()> onChange;
+
+            // Last known state for polling
+            long long modified = 0;
+            long long size = 0;
+
+            bool pending = false;
+            float lastEvent = 0.f;
+
+            // inotify couldn't watch its directory (out of watches, directory missing), so it is polled instead
+            bool polled = true;
+        };
+
+        std::vector<Watch> watches;
+        sf::Clock clock;
+        float lastPoll;
+
+#ifdef __linux__
+        int inotify;
+        // Watch descriptor to directory
+        std::unordered_map<int, std::string> directories;
+#endif
+
+        // Marks watches whose file changed as pending
+        void poll();
+
+    public:
+        RMFileWatcher();
+        ~RMFileWatcher();
+
+        // onChange is called from update() on the thread calling it
+        void watch(const std::string& filename, std::function<void()> onChange);
+
+        // Calls back for any file that changed, call once per frame
+        void update();
+
+        // Seconds a file has to be left alone before it counts as changed
+        static const float SETTLE_TIME;
+        // Seconds between checks when polling
+        static const float POLL_INTERVAL;
+    };
+}
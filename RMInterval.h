@@ -0,0 +1,46 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+
+namespace rm {
+
+    // Range of values an expression can take over a region, used to bound SDFs over boxes
+    struct Interval {
+        float lo;
+        float hi;
+
+        Interval() : lo(0.f), hi(0.f) {}
+        Interval(float value) : lo(value), hi(value) {}
+        Interval(float low, float high) : lo(low), hi(high) {}
+
+        Interval operator+(Interval b) const { return Interval(lo + b.lo, hi + b.hi); }
+        Interval operator-(Interval b) const { return Interval(lo - b.hi, hi - b.lo); }
+        Interval operator-() const { return Interval(-hi, -lo); }
+        Interval operator*(float s) const { return s >= 0.f ? Interval(lo * s, hi * s) : Interval(hi * s, lo * s); }
+    };
+
+    namespace IntervalHelper {
+        inline Interval abs(Interval a) {
+            if (a.lo >= 0.f) return a;
+            if (a.hi <= 0.f) return -a;
+            return Interval(0.f, std::max(-a.lo, a.hi));
+        }
+
+        inline Interval square(Interval a) {
+            Interval b = abs(a);
+            return Interval(b.lo * b.lo, b.hi * b.hi);
+        }
+
+        inline Interval sqrt(Interval a) {
+            return Interval(std::sqrt(std::max(a.lo, 0.f)), std::sqrt(std::max(a.hi, 0.f)));
+        }
+
+        inline Interval min(Interval a, Interval b) {
+            return Interval(std::min(a.lo, b.lo), std::min(a.hi, b.hi));
+        }
+
+        inline Interval max(Interval a, Interval b) {
+            return Interval(std::max(a.lo, b.lo), std::max(a.hi, b.hi));
+        }
+    }
+}
@@ -0,0 +1,175 @@
+#include "RMMarchStats.h"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstdio>
+
+#pragma region Counters
+const char* rm::RMMarchStats::getName(Counter counter) {
+    switch (counter) {
+    case PrimarySteps: return "Primary steps";
+    case ShadowSteps: return "Shadow steps";
+    case Bounces: return "Bounces";
+    case SceneCalls: return "SceneSDF calls";
+    default: return "";
+    }
+}
+
+bool rm::RMMarchStats::parseCounter(const std::string& name, Counter* counter) {
+    const char* names[] = { "steps", "shadow", "bounces", "sdf" };
+    for (int i = 0; i < COUNTERS; i++) {
+        if (name == names[i]) {
+            *counter = (Counter)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+sf::Vector3f rm::RMMarchStats::heat(float t) {
+    static const sf::Vector3f stops[5] = {
+        sf::Vector3f(0, 0, 0.5f),
+        sf::Vector3f(0, 0.5f, 1),
+        sf::Vector3f(0, 0.8f, 0.2f),
+        sf::Vector3f(1, 0.9f, 0),
+        sf::Vector3f(1, 0, 0)
+    };
+
+    t = std::min(std::max(t, 0.f), 1.f) * 4.f;
+    int i = std::min((int)t, 3);
+    return stops[i] + (stops[i + 1] - stops[i]) * (t - i);
+}
+#pragma endregion
+
+#pragma region Gathering
+void rm::RMMarchStats::add(Counter counter, unsigned int value) {
+    std::vector<unsigned long long>& histogram = histograms[counter];
+    if (value >= histogram.size()) {
+        histogram.resize(value + 1, 0);
+    }
+    histogram[value]++;
+}
+
+void rm::RMMarchStats::merge(const RMMarchStats& other) {
+    for (int c = 0; c < COUNTERS; c++) {
+        std::vector<unsigned long long>& histogram = histograms[c];
+        const std::vector<unsigned long long>& from = other.histograms[c];
+
+        if (from.size() > histogram.size()) {
+            histogram.resize(from.size(), 0);
+        }
+        for (size_t v = 0; v < from.size(); v++) {
+            histogram[v] += from[v];
+        }
+    }
+}
+
+void rm::RMMarchStats::clear() {
+    for (int c = 0; c < COUNTERS; c++) {
+        histograms[c].clear();
+    }
+}
+
+void rm::RMMarchStats::addImage(Counter counter, const sf::Image& image) {
+    const sf::Uint8* pixels = image.getPixelsPtr();
+    size_t count = (size_t)image.getSize().x * image.getSize().y;
+
+    for (size_t i = 0; i < count; i++) {
+        add(counter, pixels[i * 4] * 256u + pixels[i * 4 + 1]);
+    }
+}
+#pragma endregion
+
+#pragma region Summaries
+rm::RMMarchStats::Summary rm::RMMarchStats::summarize(Counter counter, unsigned int budget) const {
+    const std::vector<unsigned long long>& histogram = histograms[counter];
+    Summary summary;
+
+    double sum = 0;
+    for (size_t v = 0; v < histogram.size(); v++) {
+        summary.pixels += histogram[v];
+        sum += (double)v * histogram[v];
+        if (histogram[v] != 0) summary.maximum = (unsigned int)v;
+        if (budget != 0 && v >= budget) summary.atBudget += histogram[v];
+    }
+
+    if (summary.pixels == 0) {
+        return summary;
+    }
+    summary.average = sum / summary.pixels;
+
+    // Smallest value with at least that fraction of the pixels at or below it
+    unsigned int* percentiles[] = { &summary.median, &summary.p95, &summary.p99 };
+    double fractions[] = { 0.5, 0.95, 0.99 };
+    unsigned long long below = 0;
+    int next = 0;
+    for (size_t v = 0; v < histogram.size() && next < 3; v++) {
+        below += histogram[v];
+        while (next < 3 && below >= (unsigned long long)std::ceil(fractions[next] * summary.pixels)) {
+            *percentiles[next++] = (unsigned int)v;
+        }
+    }
+
+    return summary;
+}
+
+std::vector<float> rm::RMMarchStats::getHistogram(Counter counter, unsigned int buckets) const {
+    const std::vector<unsigned long long>& histogram = histograms[counter];
+    std::vector<float> out(std::max(buckets, 1u), 0.f);
+
+    size_t values = histogram.size();
+    while (values > 0 && histogram[values - 1] == 0) {
+        values--;
+    }
+
+    // Values per bucket, rounded up so the largest one still fits
+    size_t width = std::max((values + out.size() - 1) / out.size(), (size_t)1);
+    for (size_t v = 0; v < values; v++) {
+        out[v / width] += (float)histogram[v];
+    }
+
+    return out;
+}
+
+void rm::RMMarchStats::drawOverlay(int* view, float* scale, bool* open) const {
+    if (!ImGui::Begin("March stats", open)) {
+        ImGui::End();
+        return;
+    }
+
+    const char* views[] = { "Shaded", "Primary steps", "Shadow steps", "Bounces", "SceneSDF calls" };
+    ImGui::Combo("View", view, views, IM_ARRAYSIZE(views));
+
+    if (*view <= 0 || *view > COUNTERS) {
+        ImGui::TextDisabled("Pick a count to see it as a heatmap");
+        ImGui::End();
+        return;
+    }
+
+    // Red is also the budget, so setting it to MAX_STEPS counts the pixels that ran out of steps
+    ImGui::SliderFloat("Red at", scale, 1.f, 4000.f, "%.0f", ImGuiSliderFlags_Logarithmic);
+
+    Counter counter = (Counter)(*view - 1);
+    unsigned int budget = (unsigned int)std::max(*scale, 1.f);
+    Summary summary = summarize(counter, budget);
+    if (summary.pixels == 0) {
+        ImGui::Text("Waiting for the first read back");
+        ImGui::End();
+        return;
+    }
+
+    ImGui::Text("Average %.1f, median %u, 95%% %u, 99%% %u, max %u", summary.average, summary.median, summary.p95, summary.p99, summary.maximum);
+    ImGui::Text("%.2f%% of pixels at %u or more", 100.0 * summary.atBudget / summary.pixels, budget);
+
+    std::vector<float> buckets = getHistogram(counter, 64);
+    char label[32];
+    snprintf(label, sizeof(label), "0 - %u", summary.maximum);
+    ImGui::PlotHistogram("##counts", buckets.data(), (int)buckets.size(), 0, label, 0.f, FLT_MAX, ImVec2(-1, 80));
+
+    ImGui::End();
+}
+#pragma endregion
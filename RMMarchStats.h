@@ -0,0 +1,62 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <SFML/Graphics.hpp>
+
+namespace rm {
+
+    /*
+    Per pixel counts of the work the marcher did, to find what blows the MAX_STEPS budget
+    Marcher.frag writes one count per pixel when its debugView uniform is set (Heatmap.frag colours it)
+    and the offline renderer counts every pixel on the CPU. Either way the counts are gathered into a
+    histogram of exact values so percentiles come out exact and histograms of several frames merge.
+    */
+    class RMMarchStats {
+    public:
+        // debugView in Marcher.frag is one more than these
+        enum Counter {
+            PrimarySteps,
+            ShadowSteps,
+            Bounces,
+            SceneCalls,
+            COUNTERS
+        };
+
+        struct Summary {
+            unsigned long long pixels = 0;
+            double average = 0;
+            unsigned int median = 0;
+            unsigned int p95 = 0;
+            unsigned int p99 = 0;
+            unsigned int maximum = 0;
+            // Pixels that reached the budget given to summarize
+            unsigned long long atBudget = 0;
+        };
+
+        static const char* getName(Counter counter);
+        // "steps", "shadow", "bounces" or "sdf"
+        static bool parseCounter(const std::string& name, Counter* counter);
+        // Dark blue at 0 through green and yellow to red at 1 (and above), same as Heatmap.frag
+        static sf::Vector3f heat(float t);
+
+        void add(Counter counter, unsigned int value);
+        void merge(const RMMarchStats& other);
+        void clear();
+        // Adds every pixel of an image Marcher.frag rendered with debugView set to counter + 1
+        void addImage(Counter counter, const sf::Image& image);
+
+        Summary summarize(Counter counter, unsigned int budget = 0) const;
+        // Pixels in each of buckets equal ranges from 0 to the largest value
+        std::vector<float> getHistogram(Counter counter, unsigned int buckets) const;
+
+        /*
+        ImGui window picking what Marcher.frag shows, with the summary and histogram of these stats
+        view is 0 for the shaded scene or counter + 1 and scale is the count shown red
+        */
+        void drawOverlay(int* view, float* scale, bool* open = nullptr) const;
+
+    private:
+        // Pixels with each value
+        std::vector<unsigned long long> histograms[COUNTERS];
+    };
+}
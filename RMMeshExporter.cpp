@@ -0,0 +1,462 @@
+#include "RMMeshExporter.h"
+
+#include "RMSceneFile.h"
+#include "RMSceneText.h"
+#include "RMRegionGrid.h"
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+static sf::Uint64 cellKey(unsigned int x, unsigned int y, unsigned int z) {
+    return (sf::Uint64)x | ((sf::Uint64)y << 21) | ((sf::Uint64)z << 42);
+}
+
+static Vec3 cross(Vec3 a, Vec3 b) {
+    return Vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static float sceneDistance(Vec3 p) {
+    return rm::RMShape::getSceneDistance(p, FLT_MAX);
+}
+
+static Vec3 sceneGradient(Vec3 p, float h) {
+    return rm::VectorHelper::normalize(Vec3(
+        sceneDistance(p + Vec3(h, 0, 0)) - sceneDistance(p - Vec3(h, 0, 0)),
+        sceneDistance(p + Vec3(0, h, 0)) - sceneDistance(p - Vec3(0, h, 0)),
+        sceneDistance(p + Vec3(0, 0, h)) - sceneDistance(p - Vec3(0, 0, h))
+    ));
+}
+
+// Position of a sorted key, -1 if it isn't there
+static long long findKey(const std::vector<sf::Uint64>& keys, sf::Uint64 k) {
+    auto it = std::lower_bound(keys.begin(), keys.end(), k);
+    return it != keys.end() && *it == k ? it - keys.begin() : -1;
+}
+
+#pragma region Extraction
+bool rm::RMMeshExporter::extract(const Settings& settings, std::string* error, Stats* stats) {
+    auto fail = [&](const std::string& reason) {
+        if (error != nullptr) *error = reason;
+        return false;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    Vec3 min = settings.min;
+    Vec3 max = settings.max;
+    const float cell = settings.cellSize;
+    if (cell <= 0.f) {
+        return fail("The cell size has to be positive");
+    }
+
+    if (max.x <= min.x || max.y <= min.y || max.z <= min.z) {
+        min = Vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+        max = Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+        for (RMShape* s : RMShape::shapes) {
+            Vec4 b = s->getBounds();
+            if (b.w < 0.f || !s->isVisible()) continue;
+
+            min = VectorHelper::vectorMin(min, Vec3(b.x - b.w, b.y - b.w, b.z - b.w));
+            max = VectorHelper::vectorMax(max, Vec3(b.x + b.w, b.y + b.w, b.z + b.w));
+        }
+
+        if (max.x < min.x) {
+            return fail("No bounded shapes, --bounds is needed");
+        }
+
+        // Room for the cells outside the surface
+        min = min - Vec3(cell, cell, cell) * 2.f;
+        max = max + Vec3(cell, cell, cell) * 2.f;
+    }
+
+    // Cells per side, rounded up to a power of two so the tree has one root
+    float size = std::max(max.x - min.x, std::max(max.y - min.y, max.z - min.z));
+    unsigned int depth = 0;
+    while ((float)(1u << depth) * cell < size) {
+        depth++;
+        // Keys have 21 bits per axis and corners go one past the last cell
+        if (depth > 20) {
+            return fail("The bounds are too large for this cell size");
+        }
+    }
+
+    vertices.clear();
+    normals.clear();
+    indices.clear();
+
+    // Prune the scene once for coarse regions of the box, the scene doesn't move while extracting
+    RMRegionGrid regions;
+    RMRegionGrid* previous = RMRegionGrid::active;
+    regions.build(min, max, 32, settings.threads);
+    RMRegionGrid::active = &regions;
+
+    unsigned int threadCount = settings.threads != 0 ? settings.threads : std::max(std::thread::hardware_concurrency(), 1u);
+    auto runParallel = [&](const std::function<void(unsigned int)>& work) {
+        std::vector<std::thread> pool;
+        for (unsigned int t = 1; t < threadCount; t++) {
+            pool.emplace_back(work, t);
+        }
+        work(0);
+        for (std::thread& t : pool) {
+            t.join();
+        }
+    };
+
+    struct Node {
+        unsigned int x, y, z;
+    };
+
+    // Top down, only nodes the surface could pass through are split
+    std::vector<Node> frontier({ { 0, 0, 0 } });
+    size_t nodes = 0;
+
+    for (int level = (int)depth; level > 0; level--) {
+        float nodeSize = cell * (float)(1u << level);
+        float reach = nodeSize * 0.8660254f;
+
+        std::vector<std::vector<Node>> next(threadCount);
+        std::atomic<size_t> nextNode(0);
+
+        runParallel([&](unsigned int t) {
+            size_t i;
+            while ((i = nextNode++) < frontier.size()) {
+                const Node& n = frontier[i];
+                Vec3 center = min + Vec3(n.x + 0.5f, n.y + 0.5f, n.z + 0.5f) * nodeSize;
+                if (fabs(sceneDistance(center)) > reach) continue;
+
+                for (unsigned int c = 0; c < 8; c++) {
+                    next[t].push_back({ n.x * 2 + (c & 1), n.y * 2 + ((c >> 1) & 1), n.z * 2 + (c >> 2) });
+                }
+            }
+        });
+
+        nodes += frontier.size();
+        frontier.clear();
+        for (auto& found : next) {
+            frontier.insert(frontier.end(), found.begin(), found.end());
+        }
+    }
+
+    // Every corner of the candidate cells is sampled once
+    std::vector<sf::Uint64> cornerKeys;
+    cornerKeys.reserve(frontier.size() * 8);
+    for (const Node& n : frontier) {
+        for (unsigned int c = 0; c < 8; c++) {
+            cornerKeys.push_back(cellKey(n.x + (c & 1), n.y + ((c >> 1) & 1), n.z + (c >> 2)));
+        }
+    }
+    std::sort(cornerKeys.begin(), cornerKeys.end());
+    cornerKeys.erase(std::unique(cornerKeys.begin(), cornerKeys.end()), cornerKeys.end());
+
+    const sf::Uint64 mask = (1u << 21) - 1;
+    std::vector<float> corners(cornerKeys.size());
+    // Corners are handed out in chunks that go through the scene as one batch
+    const size_t CHUNK = 256;
+    std::atomic<size_t> nextCorner(0);
+    runParallel([&](unsigned int) {
+        float xs[CHUNK], ys[CHUNK], zs[CHUNK];
+        size_t first;
+        while ((first = nextCorner.fetch_add(CHUNK)) < cornerKeys.size()) {
+            size_t count = std::min(CHUNK, cornerKeys.size() - first);
+            for (size_t i = 0; i < count; i++) {
+                sf::Uint64 k = cornerKeys[first + i];
+                Vec3 p = min + Vec3((float)(k & mask), (float)((k >> 21) & mask), (float)(k >> 42)) * cell;
+                xs[i] = p.x;
+                ys[i] = p.y;
+                zs[i] = p.z;
+            }
+            rm::RMShape::getSceneDistances(xs, ys, zs, count, &corners[first]);
+        }
+    });
+    nodes += frontier.size();
+
+    // Cells in key order so the quads can find their neighbours
+    std::vector<sf::Uint64> cellKeys(frontier.size());
+    for (size_t i = 0; i < frontier.size(); i++) {
+        cellKeys[i] = cellKey(frontier[i].x, frontier[i].y, frontier[i].z);
+    }
+    std::sort(cellKeys.begin(), cellKeys.end());
+
+    // One vertex per cell the surface crosses
+    std::vector<Vec3> cellVertex(cellKeys.size());
+    std::vector<Vec3> cellNormal(cellKeys.size());
+    std::vector<char> crossed(cellKeys.size(), 0);
+    std::atomic<size_t> nextCell(0);
+
+    runParallel([&](unsigned int) {
+        size_t i;
+        while ((i = nextCell++) < cellKeys.size()) {
+            sf::Uint64 k = cellKeys[i];
+            unsigned int x = (unsigned int)(k & mask), y = (unsigned int)((k >> 21) & mask), z = (unsigned int)(k >> 42);
+
+            float d[8];
+            for (unsigned int c = 0; c < 8; c++) {
+                d[c] = corners[findKey(cornerKeys, cellKey(x + (c & 1), y + ((c >> 1) & 1), z + (c >> 2)))];
+            }
+
+            // Average of the crossings on the 12 edges
+            Vec3 sum(0, 0, 0);
+            int count = 0;
+            for (unsigned int a = 0; a < 8; a++) {
+                for (unsigned int bit = 1; bit < 8; bit <<= 1) {
+                    unsigned int b = a | bit;
+                    if ((a & bit) || (d[a] < 0.f) == (d[b] < 0.f)) continue;
+
+                    float t = d[a] / (d[a] - d[b]);
+                    Vec3 pa((float)(a & 1), (float)((a >> 1) & 1), (float)(a >> 2));
+                    Vec3 pb((float)(b & 1), (float)((b >> 1) & 1), (float)(b >> 2));
+                    sum += pa + (pb - pa) * t;
+                    count++;
+                }
+            }
+
+            if (count == 0) continue;
+
+            Vec3 low = min + Vec3((float)x, (float)y, (float)z) * cell;
+            Vec3 p = low + sum / (float)count * cell;
+
+            // Onto the surface, without leaving the cell
+            Vec3 n = sceneGradient(p, cell * 0.1f);
+            p -= n * sceneDistance(p);
+            p = VectorHelper::vectorMin(VectorHelper::vectorMax(p, low), low + Vec3(cell, cell, cell));
+
+            cellVertex[i] = p;
+            cellNormal[i] = sceneGradient(p, cell * 0.1f);
+            crossed[i] = 1;
+        }
+    });
+
+    std::vector<unsigned int> vertexIndex(cellKeys.size(), 0);
+    for (size_t i = 0; i < cellKeys.size(); i++) {
+        if (!crossed[i]) continue;
+
+        vertexIndex[i] = (unsigned int)vertices.size();
+        vertices.push_back(cellVertex[i]);
+        normals.push_back(cellNormal[i]);
+    }
+
+    // A quad around every crossed edge, from the vertices of the four cells sharing it
+    std::vector<std::vector<unsigned int>> triangles(threadCount);
+    nextCell = 0;
+
+    runParallel([&](unsigned int t) {
+        size_t i;
+        while ((i = nextCell++) < cellKeys.size()) {
+            if (!crossed[i]) continue;
+
+            sf::Uint64 k = cellKeys[i];
+            unsigned int c[3] = { (unsigned int)(k & mask), (unsigned int)((k >> 21) & mask), (unsigned int)(k >> 42) };
+            float d0 = corners[findKey(cornerKeys, k)];
+
+            for (int axis = 0; axis < 3; axis++) {
+                int u = (axis + 1) % 3;
+                int v = (axis + 2) % 3;
+                if (c[u] == 0 || c[v] == 0) continue;
+
+                unsigned int e[3] = { c[0], c[1], c[2] };
+                e[axis]++;
+                float d1 = corners[findKey(cornerKeys, cellKey(e[0], e[1], e[2]))];
+                if ((d0 < 0.f) == (d1 < 0.f)) continue;
+
+                // Cells around the edge, in order around it
+                const unsigned int offsets[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+                unsigned int quad[4];
+                bool complete = true;
+                for (int q = 0; q < 4 && complete; q++) {
+                    unsigned int n[3] = { c[0], c[1], c[2] };
+                    n[u] -= offsets[q][0];
+                    n[v] -= offsets[q][1];
+
+                    long long neighbour = findKey(cellKeys, cellKey(n[0], n[1], n[2]));
+                    complete = neighbour >= 0 && crossed[neighbour];
+                    if (complete) quad[q] = vertexIndex[neighbour];
+                }
+
+                if (!complete) continue;
+
+                // Facing from inside to outside
+                Vec3 outward(0, 0, 0);
+                (axis == 0 ? outward.x : axis == 1 ? outward.y : outward.z) = d0 < 0.f ? 1.f : -1.f;
+                Vec3 facing = cross(vertices[quad[2]] - vertices[quad[0]], vertices[quad[3]] - vertices[quad[1]]);
+                if (VectorHelper::dot(facing, outward) < 0.f) {
+                    std::swap(quad[1], quad[3]);
+                }
+
+                // Split along the shorter diagonal
+                std::vector<unsigned int>& out = triangles[t];
+                if (VectorHelper::length(vertices[quad[0]] - vertices[quad[2]]) <= VectorHelper::length(vertices[quad[1]] - vertices[quad[3]])) {
+                    out.insert(out.end(), { quad[0], quad[1], quad[2], quad[0], quad[2], quad[3] });
+                }
+                else {
+                    out.insert(out.end(), { quad[0], quad[1], quad[3], quad[1], quad[2], quad[3] });
+                }
+            }
+        }
+    });
+
+    for (auto& found : triangles) {
+        indices.insert(indices.end(), found.begin(), found.end());
+    }
+
+    RMRegionGrid::active = previous;
+
+    if (stats != nullptr) {
+        stats->nodes = nodes;
+        stats->cells = cellKeys.size();
+        stats->vertices = vertices.size();
+        stats->triangles = indices.size() / 3;
+        stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        stats->cellsPerSecond = stats->cells / std::max(stats->seconds, 1e-9);
+        stats->trianglesPerSecond = stats->triangles / std::max(stats->seconds, 1e-9);
+    }
+
+    return true;
+}
+#pragma endregion
+
+#pragma region Files
+bool rm::RMMeshExporter::save(const std::string& filename, std::string* error) {
+    bool ply = filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".ply") == 0;
+    if (ply ? savePly(filename) : saveObj(filename)) {
+        return true;
+    }
+
+    if (error != nullptr) *error = "Could not write " + filename;
+    return false;
+}
+
+bool rm::RMMeshExporter::saveObj(const std::string& filename) {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+
+    fprintf(file, "# %zu vertices, %zu triangles\n", vertices.size(), indices.size() / 3);
+    for (Vec3 v : vertices) {
+        fprintf(file, "v %g %g %g\n", v.x, v.y, v.z);
+    }
+    for (Vec3 n : normals) {
+        fprintf(file, "vn %g %g %g\n", n.x, n.y, n.z);
+    }
+    // OBJ counts from 1
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        unsigned int a = indices[i] + 1, b = indices[i + 1] + 1, c = indices[i + 2] + 1;
+        fprintf(file, "f %u//%u %u//%u %u//%u\n", a, a, b, b, c, c);
+    }
+
+    return fclose(file) == 0;
+}
+
+bool rm::RMMeshExporter::savePly(const std::string& filename) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    file << "ply\nformat binary_little_endian 1.0\n"
+        << "element vertex " << vertices.size() << "\n"
+        << "property float x\nproperty float y\nproperty float z\n"
+        << "property float nx\nproperty float ny\nproperty float nz\n"
+        << "element face " << indices.size() / 3 << "\n"
+        << "property list uchar uint vertex_indices\nend_header\n";
+
+    for (size_t i = 0; i < vertices.size(); i++) {
+        float v[6] = { vertices[i].x, vertices[i].y, vertices[i].z, normals[i].x, normals[i].y, normals[i].z };
+        file.write((const char*)v, sizeof(v));
+    }
+
+    const unsigned char corners = 3;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        file.write((const char*)&corners, 1);
+        file.write((const char*)&indices[i], 3 * sizeof(unsigned int));
+    }
+
+    return (bool)file;
+}
+
+const std::vector<Vec3>& rm::RMMeshExporter::getVertices() {
+    return vertices;
+}
+
+const std::vector<Vec3>& rm::RMMeshExporter::getNormals() {
+    return normals;
+}
+
+const std::vector<unsigned int>& rm::RMMeshExporter::getIndices() {
+    return indices;
+}
+#pragma endregion
+
+int rm::RMMeshExporter::runCommandLine(int argc, char** argv) {
+    Settings settings;
+    std::string scene;
+    std::string output = "mesh.obj";
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--bounds") {
+            if (i + 6 >= argc) {
+                std::cout << "Expected --bounds x0 y0 z0 x1 y1 z1" << std::endl;
+                return 1;
+            }
+            settings.min = Vec3((float)atof(argv[i + 1]), (float)atof(argv[i + 2]), (float)atof(argv[i + 3]));
+            settings.max = Vec3((float)atof(argv[i + 4]), (float)atof(argv[i + 5]), (float)atof(argv[i + 6]));
+            i += 6;
+        }
+        else if (arg == "--out" || arg == "--cell" || arg == "--threads") {
+            if (i + 1 >= argc) {
+                std::cout << "Missing value for " << arg << std::endl;
+                return 1;
+            }
+
+            const char* value = argv[++i];
+            if (arg == "--out") output = value;
+            else if (arg == "--cell") settings.cellSize = (float)atof(value);
+            else settings.threads = (unsigned int)std::max(atoi(value), 0);
+        }
+        else if (arg[0] == '-') {
+            std::cout << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+        else {
+            scene = arg;
+        }
+    }
+
+    if (scene.empty()) {
+        std::cout << "Usage: mesh <scene.rms|scene.rmsc> [--out mesh.obj|.ply] [--cell size] [--bounds x0 y0 z0 x1 y1 z1] [--threads n]" << std::endl;
+        return 1;
+    }
+
+    std::string error;
+    bool loaded;
+    if (scene.size() > 4 && scene.compare(scene.size() - 4, 4, ".rms") == 0) {
+        loaded = RMSceneText::loadFromFile(scene, &error);
+    }
+    else {
+        loaded = RMSceneFile::loadFromFile(scene);
+        if (!loaded) error = "Could not load " + scene;
+    }
+
+    RMMeshExporter exporter;
+    Stats stats;
+    if (!loaded || !exporter.extract(settings, &error, &stats) || !exporter.save(output, &error)) {
+        std::cout << error << std::endl;
+        return 1;
+    }
+
+    printf("Extracted %zu triangles and %zu vertices from %zu cells in %.3fs (%.2f Mcells/s, %.2f Mtriangles/s)\n",
+        stats.triangles, stats.vertices, stats.cells, stats.seconds,
+        stats.cellsPerSecond / 1e6, stats.trianglesPerSecond / 1e6);
+
+    return 0;
+}
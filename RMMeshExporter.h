@@ -0,0 +1,66 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <SFML/Graphics.hpp>
+
+#include "RMShape.h"
+
+namespace rm {
+
+    /*
+    Turns the scene into a triangle mesh for collision meshes and other tools
+    The box is split top down like an octree and only cells the surface might pass through are kept,
+    so the work grows with surface area instead of volume. Every kept cell the surface crosses gets one
+    vertex (the average of its edge crossings, pulled onto the surface) and every crossed edge becomes a
+    quad between the four cells around it. Cells share their vertex so the mesh comes out welded.
+    All of it is split between threads, distances come from RMShape::getSceneDistance.
+    Creases and parts thinner than a cell are rounded off and can leave a few non-manifold edges.
+
+    Command line (run.cpp forwards "RayMarchingCpp mesh ..."):
+        mesh <scene.rms|scene.rmsc> [--out mesh.obj|.ply] [--cell size] [--bounds x0 y0 z0 x1 y1 z1] [--threads n]
+    Without --bounds the bounds of every visible bounded shape are used, planes are cut off at them.
+    */
+    class RMMeshExporter {
+    public:
+        struct Settings {
+            // Empty means the bounds of the bounded shapes
+            Vec3 min = Vec3(0, 0, 0);
+            Vec3 max = Vec3(0, 0, 0);
+            float cellSize = 0.05f;
+            // 0 uses every core
+            unsigned int threads = 0;
+        };
+
+        struct Stats {
+            // Octree nodes the distance was checked for
+            size_t nodes = 0;
+            // Finest cells near the surface
+            size_t cells = 0;
+            size_t vertices = 0;
+            size_t triangles = 0;
+            double seconds = 0;
+            double cellsPerSecond = 0;
+            double trianglesPerSecond = 0;
+        };
+
+        bool extract(const Settings& settings, std::string* error = nullptr, Stats* stats = nullptr);
+
+        // Picks OBJ or binary PLY from the extension
+        bool save(const std::string& filename, std::string* error = nullptr);
+        bool saveObj(const std::string& filename);
+        bool savePly(const std::string& filename);
+
+        const std::vector<Vec3>& getVertices();
+        const std::vector<Vec3>& getNormals();
+        // Three per triangle, counter clockwise seen from outside
+        const std::vector<unsigned int>& getIndices();
+
+        // Parses the arguments after "mesh", extracts, saves and reports the timings, returns the exit code
+        static int runCommandLine(int argc, char** argv);
+
+    private:
+        std::vector<Vec3> vertices;
+        std::vector<Vec3> normals;
+        std::vector<unsigned int> indices;
+    };
+}
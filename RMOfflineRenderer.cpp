@@ -0,0 +1,784 @@
+#include "RMOfflineRenderer.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+#include "RMSceneText.h"
+#include "RMSceneFile.h"
+#include "Rotations.h"
+#include "RMProfiler.h"
+
+// Same as the constants in Marcher.frag
+static const float MAX_DISTANCE = 1000.f;
+static const float SHADOW_STRENGTH = 0.5f;
+static const float FOCAL_LENGTH = 1.5f;
+static const float PI = 3.14159265359f;
+
+using namespace rm::VectorHelper;
+
+static Vec3 reflect(Vec3 d, Vec3 n) {
+    return d - n * (2.f * dot(d, n));
+}
+
+static Vec3 multiply(Vec3 a, Vec3 b) {
+    return Vec3(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+rm::RMOfflineRenderer::RMOfflineRenderer(const Settings& settings) : settings(settings) {
+    hasSky = false;
+}
+
+rm::RMOfflineRenderer::~RMOfflineRenderer() {
+    if (RMRegionGrid::active == &regions) {
+        RMRegionGrid::active = nullptr;
+    }
+}
+
+#pragma region Loading
+bool rm::RMOfflineRenderer::loadPath(const std::string& filename, std::vector<Keyframe>& path, std::string* error) {
+    std::ifstream file(filename);
+    if (!file) {
+        if (error != nullptr) *error = "Could not open " + filename;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+        Keyframe k;
+        std::istringstream stream(line);
+        if (!(stream >> k.time >> k.position.x >> k.position.y >> k.position.z >> k.rotation.x >> k.rotation.y >> k.rotation.z)) {
+            if (error != nullptr) *error = filename + " line " + std::to_string(lineNumber) + ": Expected time px py pz rx ry rz";
+            return false;
+        }
+
+        path.push_back(k);
+    }
+
+    std::sort(path.begin(), path.end(), [](const Keyframe& a, const Keyframe& b) { return a.time < b.time; });
+    return true;
+}
+
+bool rm::RMOfflineRenderer::load(std::string* error) {
+    bool loaded;
+    if (settings.scene.size() > 4 && settings.scene.compare(settings.scene.size() - 4, 4, ".rms") == 0) {
+        loaded = RMSceneText::loadFromFile(settings.scene, error);
+    }
+    else {
+        loaded = RMSceneFile::loadFromFile(settings.scene);
+        if (!loaded && error != nullptr) *error = "Could not load " + settings.scene;
+    }
+
+    if (!loaded) {
+        return false;
+    }
+
+    if (!settings.camera.empty() && !loadPath(settings.camera, path, error)) {
+        return false;
+    }
+
+    if (regions.build(16, settings.threads)) {
+        RMRegionGrid::active = &regions;
+    }
+
+    // Same starting camera as main.cpp
+    if (path.empty()) {
+        path.push_back({ 0.f, Vec3(0, 0.1f, 0), Vec3(0, 0, 0) });
+    }
+
+    if (!settings.sky.empty()) {
+        // Only the CPU side of the skybox is needed unless the shader draws it
+        hasSky = skybox.prepare(settings.sky);
+        if (!hasSky) {
+            if (error != nullptr) *error = "Could not load " + settings.sky;
+            return false;
+        }
+    }
+
+    return true;
+}
+#pragma endregion
+
+rm::RMOfflineRenderer::Keyframe rm::RMOfflineRenderer::getCamera(float time) {
+    if (time <= path.front().time) return path.front();
+    if (time >= path.back().time) return path.back();
+
+    size_t next = 1;
+    while (path[next].time < time) next++;
+
+    const Keyframe& a = path[next - 1];
+    const Keyframe& b = path[next];
+    float t = (time - a.time) / (b.time - a.time);
+
+    Keyframe k;
+    k.time = time;
+    k.position = a.position + (b.position - a.position) * t;
+    k.rotation = a.rotation + (b.rotation - a.rotation) * t;
+    return k;
+}
+
+const rm::RMOfflineRenderer::Settings& rm::RMOfflineRenderer::getSettings() {
+    return settings;
+}
+
+const std::vector<rm::RMOfflineRenderer::Keyframe>& rm::RMOfflineRenderer::getPath() {
+    return path;
+}
+
+void rm::RMOfflineRenderer::setPath(const std::vector<Keyframe>& keyframes) {
+    if (!keyframes.empty()) {
+        path = keyframes;
+    }
+}
+
+std::string rm::RMOfflineRenderer::getFrameName(unsigned int frame) {
+    std::string name = settings.output;
+
+    size_t start = name.find('#');
+    if (start == std::string::npos) {
+        // Keep frames from overwriting each other
+        if (settings.frames <= 1) return name;
+
+        size_t dot = name.find_last_of('.');
+        start = dot == std::string::npos ? name.size() : dot;
+        name.insert(start, "_####");
+        start++;
+    }
+
+    size_t end = name.find_first_not_of('#', start);
+    if (end == std::string::npos) end = name.size();
+
+    std::string number = std::to_string(frame);
+    if (number.size() < end - start) {
+        number.insert(0, end - start - number.size(), '0');
+    }
+
+    return name.replace(start, end - start, number);
+}
+
+#pragma region Shading
+Vec3 rm::RMOfflineRenderer::sampleSky(Vec3 direction, float roughness) {
+    if (hasSky) {
+        return skybox.sample(direction, roughness);
+    }
+
+    // Plain gradient when there is no sky image
+    float t = clamp(direction.y * 0.5f + 0.5f, 0.f, 1.f);
+    return Vec3(1, 1, 1) + (Vec3(0.5f, 0.7f, 1.f) - Vec3(1, 1, 1)) * t;
+}
+
+// getLight in Marcher.frag
+static float getLight(Vec3 p, Vec3 n, float time) {
+    static const Rotation tilt = Rotation::fromEulerXYZ(Vec3(0, 0, PI / 12));
+
+    Vec3 lightPos(p.x, 100, p.z);
+    lightPos = Rotation::fromEulerXYZ(Vec3(0, fmodf(time, 2 * PI), 0)).rotate(tilt.rotate(lightPos));
+
+    Vec3 l = normalize(lightPos - p);
+    float dif = clamp(dot(n, l), SHADOW_STRENGTH, 1.f);
+
+    float light = std::fmin(1.f, SHADOW_STRENGTH + rm::RMShape::softShadow(p + n * rm::RMShape::EPSILON, l, length(lightPos - p), 28));
+    return light * dif;
+}
+
+// aoMarch in Marcher.frag
+static float aoMarch(Vec3 p, Vec3 n) {
+    float sum = 0;
+    float maxSum = 0;
+    for (int i = 0; i < 10; i++) {
+        Vec3 pos = p + n * (float)(i + 1);
+        float weight = 1.f / (float)(1 << i);
+        sum += weight * std::fabs(rm::RMShape::getSceneDistance(pos, MAX_DISTANCE));
+        maxSum += weight * (i + 1);
+    }
+
+    return sum / maxSum;
+}
+
+Vec3 rm::RMOfflineRenderer::shadeHit(RMShape* shape, Vec3 p, Vec3 normal, float time) {
+    RMMaterial& material = shape->getMaterial();
+    return Vec3(material.albedo.x, material.albedo.y, material.albedo.z) * getLight(p, normal, time);
+}
+
+Vec3 rm::RMOfflineRenderer::trace(Vec3 origin, Vec3 direction, float time, float pixelCone, int& steps, int& bounces) {
+    float distance;
+    RMShape* hit = RMShape::raymarch(origin, direction, MAX_DISTANCE, (float)settings.maxSteps, &steps, pixelCone, &distance);
+    bounces = 0;
+
+    if (hit == nullptr) {
+        return sampleSky(direction, 0.f);
+    }
+
+    Vec3 p = origin + direction * distance;
+    Vec3 n = hit->getNormal(p);
+    RMMaterial& material = hit->getMaterial();
+
+    Vec3 color(material.albedo.x, material.albedo.y, material.albedo.z);
+
+    // One mirror bounce for metals, rough ones get the blurrier sky
+    if (material.metallic > 0.f) {
+        Vec3 rd = reflect(direction, n);
+        Vec3 ro = p + n * (RMShape::EPSILON * 2.f);
+        bounces++;
+
+        float bounceDistance;
+        RMShape* bounce = RMShape::raymarch(ro, rd, MAX_DISTANCE, (float)settings.maxSteps, nullptr, pixelCone, &bounceDistance);
+
+        Vec3 reflected;
+        if (bounce == nullptr) {
+            reflected = sampleSky(rd, material.roughness);
+        }
+        else {
+            Vec3 q = ro + rd * bounceDistance;
+            reflected = shadeHit(bounce, q, bounce->getNormal(q), time);
+        }
+
+        color = color + (reflected - color) * std::fmin(material.metallic, 0.9f);
+    }
+
+    return color * (getLight(p, n, time) * aoMarch(p, n));
+}
+
+Vec3 rm::RMOfflineRenderer::heatColor(unsigned int count) {
+    unsigned int scale = settings.heatmapScale;
+    if (scale == 0) {
+        // Roughly the most each count can reach, with 3 bounces like Marcher.frag
+        switch (settings.heatmap) {
+        case RMMarchStats::PrimarySteps: scale = (unsigned int)settings.maxSteps; break;
+        case RMMarchStats::ShadowSteps: scale = 64 * 4; break;
+        case RMMarchStats::Bounces: scale = 3; break;
+        default: scale = (unsigned int)settings.maxSteps * 4; break;
+        }
+    }
+
+    return RMMarchStats::heat((float)count / std::max(scale, 1u));
+}
+#pragma endregion
+
+#pragma region Rendering
+long long rm::RMOfflineRenderer::renderTile(unsigned int frame, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, float* out, size_t stride, RMMarchStats* march) {
+    const float width = (float)settings.width;
+    const float height = (float)settings.height;
+    const float pixelCone = 1.f / (height * FOCAL_LENGTH);
+
+    float time = settings.startTime + frame / settings.fps;
+    Keyframe camera = getCamera(time);
+    Rotation view = Rotation::fromEulerXYZ(camera.rotation);
+
+    long long steps = 0;
+    for (unsigned int y = y0; y < y1; y++) {
+        float* row = out + (y - y0) * stride;
+
+        for (unsigned int x = x0; x < x1; x++) {
+            // Same camera as main() in Marcher.frag, rows go top to bottom here
+            float u = (2.f * (x + 0.5f) - width) / height;
+            float v = (2.f * (y + 0.5f) - height) / height;
+            Vec3 rd = view.rotate(normalize(Vec3(u, -v, FOCAL_LENGTH)));
+
+            RMShape::Counters before = RMShape::counters;
+            int pixelSteps, bounces;
+            Vec3 color = trace(camera.position, rd, time, pixelCone, pixelSteps, bounces);
+            steps += pixelSteps;
+
+            if (march != nullptr || settings.heatmap >= 0) {
+                unsigned int counts[RMMarchStats::COUNTERS];
+                counts[RMMarchStats::PrimarySteps] = (unsigned int)pixelSteps;
+                counts[RMMarchStats::ShadowSteps] = RMShape::counters.shadowSteps - before.shadowSteps;
+                counts[RMMarchStats::Bounces] = (unsigned int)bounces;
+                counts[RMMarchStats::SceneCalls] = RMShape::counters.sceneCalls - before.sceneCalls;
+
+                if (march != nullptr) {
+                    for (int c = 0; c < RMMarchStats::COUNTERS; c++) {
+                        march->add((RMMarchStats::Counter)c, counts[c]);
+                    }
+                }
+                if (settings.heatmap >= 0 && settings.heatmap < RMMarchStats::COUNTERS) {
+                    color = heatColor(counts[settings.heatmap]);
+                }
+            }
+
+            float* pixel = row + (x - x0) * 3;
+            pixel[0] = color.x;
+            pixel[1] = color.y;
+            pixel[2] = color.z;
+        }
+    }
+
+    return steps;
+}
+
+bool rm::RMOfflineRenderer::renderCPU(Stats* stats, std::string* error) {
+    const unsigned int width = settings.width;
+    const unsigned int height = settings.height;
+    const unsigned int tileSize = std::max(settings.tileSize, 1u);
+    const unsigned int tilesX = (width + tileSize - 1) / tileSize;
+    const unsigned int tilesY = (height + tileSize - 1) / tileSize;
+    const unsigned int tilesPerFrame = tilesX * tilesY;
+    const size_t jobCount = (size_t)tilesPerFrame * settings.frames;
+
+    struct Frame {
+        std::vector<float> rgb;
+        std::atomic<unsigned int> tilesLeft;
+    };
+
+    // Frames in flight, made by their first tile and written by their last
+    std::map<unsigned int, std::unique_ptr<Frame>> frames;
+    std::mutex framesMutex;
+
+    std::atomic<size_t> nextJob(0);
+    std::atomic<long long> totalSteps(0);
+    std::atomic<bool> failed(false);
+    std::string failure;
+    RMMarchStats march;
+
+    auto worker = [&]() {
+        long long steps = 0;
+        RMMarchStats workerMarch;
+
+        size_t job;
+        while (!failed && (job = nextJob++) < jobCount) {
+            unsigned int frameIndex = (unsigned int)(job / tilesPerFrame);
+            unsigned int tile = (unsigned int)(job % tilesPerFrame);
+
+            Frame* frame;
+            {
+                std::lock_guard<std::mutex> lock(framesMutex);
+                std::unique_ptr<Frame>& slot = frames[frameIndex];
+                if (slot == nullptr) {
+                    slot.reset(new Frame());
+                    slot->rgb.resize((size_t)width * height * 3);
+                    slot->tilesLeft = tilesPerFrame;
+                }
+                frame = slot.get();
+            }
+
+            unsigned int x0 = (tile % tilesX) * tileSize;
+            unsigned int y0 = (tile / tilesX) * tileSize;
+            unsigned int x1 = std::min(x0 + tileSize, width);
+            unsigned int y1 = std::min(y0 + tileSize, height);
+
+            {
+                RM_PROFILE_SCOPE("Tile");
+                steps += renderTile(frameIndex, x0, y0, x1, y1, &frame->rgb[((size_t)y0 * width + x0) * 3], (size_t)width * 3, &workerMarch);
+            }
+
+            if (--frame->tilesLeft == 0) {
+                RM_PROFILE_SCOPE("Save frame");
+                std::string frameError;
+                if (!saveFrame(frameIndex, frame->rgb, &frameError)) {
+                    std::lock_guard<std::mutex> lock(framesMutex);
+                    failure = frameError;
+                    failed = true;
+                }
+
+                std::lock_guard<std::mutex> lock(framesMutex);
+                frames.erase(frameIndex);
+            }
+        }
+
+        totalSteps += steps;
+
+        std::lock_guard<std::mutex> lock(framesMutex);
+        march.merge(workerMarch);
+    };
+
+    unsigned int threadCount = settings.threads != 0 ? settings.threads : std::max(std::thread::hardware_concurrency(), 1u);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < threadCount; i++) {
+        threads.emplace_back([&]() {
+            RMProfiler::setThreadName("Render worker");
+            worker();
+        });
+    }
+    worker();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    if (failed) {
+        if (error != nullptr) *error = failure;
+        return false;
+    }
+
+    if (stats != nullptr) {
+        double rays = (double)width * height * settings.frames;
+        stats->frames = settings.frames;
+        stats->seconds = elapsed.count();
+        stats->raysPerSecond = elapsed.count() > 0 ? rays / elapsed.count() : 0;
+        stats->averageSteps = rays > 0 ? totalSteps / rays : 0;
+        stats->march = march;
+    }
+
+    return true;
+}
+
+bool rm::RMOfflineRenderer::renderGPU(Stats* stats, std::string* error) {
+    sf::RenderTexture target;
+    sf::Shader marcher;
+
+    if (!target.create(settings.width, settings.height)) {
+        if (error != nullptr) *error = "No OpenGL context for the offscreen render";
+        return false;
+    }
+
+    // SFML prints the compiler's log
+    if (!marcher.loadFromFile("Marcher.frag", sf::Shader::Type::Fragment)) {
+        if (error != nullptr) *error = "Marcher.frag didn't compile";
+        return false;
+    }
+
+    // The shader needs the texture, the prepared map is kept for nothing else
+    if (hasSky) {
+        skybox.upload();
+        skybox.bind(&marcher);
+    }
+
+    marcher.setUniform("windowDimensions", sf::Vector2f((float)settings.width, (float)settings.height));
+
+    // The shader writes the heatmap's count instead of the colour
+    bool heatmap = settings.heatmap >= 0 && settings.heatmap < RMMarchStats::COUNTERS;
+    marcher.setUniform("debugView", heatmap ? settings.heatmap + 1 : 0);
+    RMMarchStats march;
+
+    sf::RectangleShape screen(sf::Vector2f((float)settings.width, (float)settings.height));
+    std::vector<float> rgb((size_t)settings.width * settings.height * 3);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (unsigned int frame = 0; frame < settings.frames; frame++) {
+        RM_PROFILE_SCOPE("Frame");
+        float time = settings.startTime + frame / settings.fps;
+        Keyframe camera = getCamera(time);
+
+        marcher.setUniform("camPosition", camera.position);
+        marcher.setUniform("camRotation", camera.rotation);
+        marcher.setUniform("time", time);
+        marcher.setUniform("buff", target.getTexture());
+
+        for (RMShape* shape : RMShape::shapes) {
+            shape->draw(&marcher);
+        }
+
+        target.clear(sf::Color::Black);
+        target.draw(screen, &marcher);
+        target.display();
+
+        sf::Image image = target.getTexture().copyToImage();
+        const sf::Uint8* pixels = image.getPixelsPtr();
+        for (size_t i = 0; i < rgb.size() / 3; i++) {
+            if (heatmap) {
+                Vec3 color = heatColor(pixels[i * 4 + 0] * 256u + pixels[i * 4 + 1]);
+                rgb[i * 3 + 0] = color.x;
+                rgb[i * 3 + 1] = color.y;
+                rgb[i * 3 + 2] = color.z;
+                continue;
+            }
+
+            rgb[i * 3 + 0] = pixels[i * 4 + 0] / 255.f;
+            rgb[i * 3 + 1] = pixels[i * 4 + 1] / 255.f;
+            rgb[i * 3 + 2] = pixels[i * 4 + 2] / 255.f;
+        }
+
+        if (heatmap) {
+            march.addImage((RMMarchStats::Counter)settings.heatmap, image);
+        }
+
+        if (!saveFrame(frame, rgb, error)) {
+            return false;
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    if (stats != nullptr) {
+        double rays = (double)settings.width * settings.height * settings.frames;
+        stats->frames = settings.frames;
+        stats->seconds = elapsed.count();
+        stats->raysPerSecond = elapsed.count() > 0 ? rays / elapsed.count() : 0;
+        // The shader only reports the heatmap's count
+        if (heatmap && settings.heatmap == RMMarchStats::PrimarySteps) {
+            stats->averageSteps = march.summarize(RMMarchStats::PrimarySteps).average;
+        }
+        stats->march = march;
+    }
+
+    return true;
+}
+
+bool rm::RMOfflineRenderer::render(Stats* stats, std::string* error) {
+    if (settings.gpu) {
+        std::string failure;
+        if (renderGPU(stats, &failure)) {
+            return true;
+        }
+
+        std::cout << failure << ", using the CPU" << std::endl;
+    }
+
+    return renderCPU(stats, error);
+}
+#pragma endregion
+
+#pragma region Output
+bool rm::RMOfflineRenderer::saveFrame(unsigned int frame, const std::vector<float>& rgb, std::string* error) {
+    std::string filename = getFrameName(frame);
+
+    bool saved;
+    if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".exr") == 0) {
+        saved = writeExr(filename, rgb, settings.width, settings.height);
+    }
+    else {
+        sf::Image image;
+        image.create(settings.width, settings.height);
+
+        for (unsigned int y = 0; y < settings.height; y++) {
+            for (unsigned int x = 0; x < settings.width; x++) {
+                const float* c = &rgb[((size_t)y * settings.width + x) * 3];
+                image.setPixel(x, y, sf::Color(
+                    (sf::Uint8)(clamp(c[0], 0.f, 1.f) * 255.f + 0.5f),
+                    (sf::Uint8)(clamp(c[1], 0.f, 1.f) * 255.f + 0.5f),
+                    (sf::Uint8)(clamp(c[2], 0.f, 1.f) * 255.f + 0.5f)
+                ));
+            }
+        }
+
+        saved = image.saveToFile(filename);
+    }
+
+    if (!saved && error != nullptr) {
+        *error = "Could not write " + filename;
+    }
+
+    return saved;
+}
+
+// Appends the raw bytes of value, EXR is little endian like every platform this builds for
+template <typename T>
+static void put(std::vector<char>& out, T value) {
+    const char* bytes = (const char*)&value;
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+static void putString(std::vector<char>& out, const char* s) {
+    out.insert(out.end(), s, s + strlen(s) + 1);
+}
+
+static void putAttribute(std::vector<char>& out, const char* name, const char* type, int32_t size) {
+    putString(out, name);
+    putString(out, type);
+    put(out, size);
+}
+
+bool rm::RMOfflineRenderer::writeExr(const std::string& filename, const std::vector<float>& rgb, unsigned int width, unsigned int height) {
+    std::vector<char> out;
+
+    // Magic number and version 2, single part scanline file
+    put<int32_t>(out, 20000630);
+    put<int32_t>(out, 2);
+
+    // Channels are stored in alphabetical order
+    const char* channels[3] = { "B", "G", "R" };
+    putAttribute(out, "channels", "chlist", 3 * 18 + 1);
+    for (const char* channel : channels) {
+        putString(out, channel);
+        put<int32_t>(out, 2); // FLOAT
+        put<int32_t>(out, 0); // pLinear and reserved
+        put<int32_t>(out, 1); // x sampling
+        put<int32_t>(out, 1); // y sampling
+    }
+    out.push_back(0);
+
+    putAttribute(out, "compression", "compression", 1);
+    out.push_back(0); // None
+
+    const int32_t window[4] = { 0, 0, (int32_t)width - 1, (int32_t)height - 1 };
+    putAttribute(out, "dataWindow", "box2i", 16);
+    for (int32_t v : window) put(out, v);
+    putAttribute(out, "displayWindow", "box2i", 16);
+    for (int32_t v : window) put(out, v);
+
+    putAttribute(out, "lineOrder", "lineOrder", 1);
+    out.push_back(0); // Increasing y
+
+    putAttribute(out, "pixelAspectRatio", "float", 4);
+    put(out, 1.f);
+    putAttribute(out, "screenWindowCenter", "v2f", 8);
+    put(out, 0.f);
+    put(out, 0.f);
+    putAttribute(out, "screenWindowWidth", "float", 4);
+    put(out, 1.f);
+    out.push_back(0);
+
+    // Offset table, then one block per scanline
+    const uint32_t rowBytes = width * 3 * sizeof(float);
+    const uint64_t tableEnd = out.size() + (uint64_t)height * sizeof(uint64_t);
+    for (unsigned int y = 0; y < height; y++) {
+        put<uint64_t>(out, tableEnd + (uint64_t)y * (8 + rowBytes));
+    }
+
+    out.reserve(out.size() + (size_t)height * (8 + rowBytes));
+    for (unsigned int y = 0; y < height; y++) {
+        put<int32_t>(out, (int32_t)y);
+        put<uint32_t>(out, rowBytes);
+
+        for (int c = 2; c >= 0; c--) {
+            for (unsigned int x = 0; x < width; x++) {
+                put(out, rgb[((size_t)y * width + x) * 3 + c]);
+            }
+        }
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    file.write(out.data(), out.size());
+    return (bool)file;
+}
+#pragma endregion
+
+int rm::RMOfflineRenderer::parseOption(int argc, char** argv, int i, Settings& settings) {
+    std::string arg = argv[i];
+
+    if (arg == "--gpu") {
+        settings.gpu = true;
+        return 1;
+    }
+
+    const char* options[] = { "--camera", "--sky", "--out", "--frames", "--fps", "--start", "--threads", "--tile", "--steps", "--size", "--trace", "--heatmap", "--heat-scale" };
+    if (std::find(std::begin(options), std::end(options), arg) == std::end(options)) {
+        return 0;
+    }
+
+    if (i + 1 >= argc) {
+        std::cout << "Missing value for " << arg << std::endl;
+        return -1;
+    }
+
+    const char* value = argv[i + 1];
+    if (arg == "--camera") settings.camera = value;
+    else if (arg == "--sky") settings.sky = value;
+    else if (arg == "--out") settings.output = value;
+    else if (arg == "--frames") settings.frames = (unsigned int)std::max(atoi(value), 1);
+    else if (arg == "--fps") settings.fps = std::max((float)atof(value), 0.001f);
+    else if (arg == "--start") settings.startTime = (float)atof(value);
+    else if (arg == "--threads") settings.threads = (unsigned int)std::max(atoi(value), 0);
+    else if (arg == "--tile") settings.tileSize = (unsigned int)std::max(atoi(value), 1);
+    else if (arg == "--steps") settings.maxSteps = std::max(atoi(value), 1);
+    else if (arg == "--trace") settings.trace = value;
+    else if (arg == "--heat-scale") settings.heatmapScale = (unsigned int)std::max(atoi(value), 0);
+    else if (arg == "--heatmap") {
+        RMMarchStats::Counter counter;
+        if (!RMMarchStats::parseCounter(value, &counter)) {
+            std::cout << "Expected --heatmap steps, shadow, bounces or sdf" << std::endl;
+            return -1;
+        }
+        settings.heatmap = counter;
+    }
+    else {
+        unsigned int w, h;
+        if (sscanf(value, "%ux%u", &w, &h) != 2 || w == 0 || h == 0) {
+            std::cout << "Expected --size WxH" << std::endl;
+            return -1;
+        }
+        settings.width = w;
+        settings.height = h;
+    }
+
+    return 2;
+}
+
+int rm::RMOfflineRenderer::runCommandLine(int argc, char** argv) {
+    Settings settings;
+
+    for (int i = 1; i < argc;) {
+        int used = parseOption(argc, argv, i, settings);
+        if (used < 0) {
+            return 1;
+        }
+
+        if (used == 0) {
+            if (argv[i][0] == '-') {
+                std::cout << "Unknown option " << argv[i] << std::endl;
+                return 1;
+            }
+
+            settings.scene = argv[i];
+            used = 1;
+        }
+
+        i += used;
+    }
+    if (settings.scene.empty()) {
+        std::cout << "Usage: render <scene.rms|scene.rmsc> [--camera path.txt] [--frames n] [--fps f] [--start seconds]" << std::endl;
+        std::cout << "              [--size WxH] [--out frame_####.png|.exr] [--threads n] [--tile n] [--sky image.hdr] [--steps n] [--gpu]" << std::endl;
+        std::cout << "              [--trace trace.json] [--heatmap steps|shadow|bounces|sdf] [--heat-scale n]" << std::endl;
+        return 1;
+    }
+
+    RMOfflineRenderer renderer(settings);
+    Stats stats;
+    std::string error;
+
+    if (!settings.trace.empty()) {
+        RMProfiler::setThreadName("Main");
+        RMProfiler::setTracing(true);
+    }
+
+    if (!renderer.load(&error) || !renderer.render(&stats, &error)) {
+        std::cout << error << std::endl;
+        return 1;
+    }
+
+    if (!settings.trace.empty() && !RMProfiler::saveTrace(settings.trace, &error)) {
+        std::cout << error << std::endl;
+    }
+
+    printf("Rendered %u frames in %.3fs (%.3fs per frame, %.2f Mrays/s",
+        stats.frames, stats.seconds, stats.seconds / std::max(stats.frames, 1u), stats.raysPerSecond / 1e6);
+    if (stats.averageSteps >= 0) {
+        printf(", %.1f steps per ray", stats.averageSteps);
+    }
+    printf(")\n");
+
+    // Per pixel percentiles of the march work, primary steps also say how many rays ran out of steps
+    for (int c = 0; c < RMMarchStats::COUNTERS; c++) {
+        RMMarchStats::Counter counter = (RMMarchStats::Counter)c;
+        RMMarchStats::Summary summary = stats.march.summarize(counter, counter == RMMarchStats::PrimarySteps ? (unsigned int)settings.maxSteps : 0);
+        if (summary.pixels == 0) {
+            continue;
+        }
+
+        printf("  %-15s avg %.1f, median %u, 95%% %u, 99%% %u, max %u", RMMarchStats::getName(counter),
+            summary.average, summary.median, summary.p95, summary.p99, summary.maximum);
+        if (counter == RMMarchStats::PrimarySteps) {
+            printf(", %.2f%% at --steps", 100.0 * summary.atBudget / summary.pixels);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <SFML/Graphics.hpp>
+
+#include "RMShape.h"
+#include "RMSkybox.h"
+#include "RMRegionGrid.h"
+#include "RMMarchStats.h"
+
+namespace rm {
+
+    /*
+    Renders image sequences without a window, for batch previews and performance checks
+    Frames are split into tiles and every tile of every frame is shared between the worker threads.
+    The CPU path follows the lighting in Marcher.frag (one deterministic reflection instead of the noisy bounces).
+    With gpu set, frames go through Marcher.frag in an offscreen render texture instead, falling back
+    to the CPU when no OpenGL context can be made.
+    Both count the march work of every pixel (see RMMarchStats, the GPU only counts the heatmap's counter)
+    and with --heatmap the frames show one of the counts instead of the scene.
+
+    Command line (run.cpp forwards "RayMarchingCpp render ..."):
+        render <scene.rms|scene.rmsc> [--camera path.txt] [--frames n] [--fps f] [--start seconds]
+               [--size WxH] [--out frames/frame_####.png|.exr] [--threads n] [--tile n]
+               [--sky image.hdr] [--steps n] [--gpu] [--trace trace.json]
+               [--heatmap steps|shadow|bounces|sdf] [--heat-scale n]
+
+    Camera paths have one keyframe per line, "time px py pz rx ry rz", and are interpolated linearly.
+    The #s in the output name are replaced by the zero padded frame number.
+    */
+    class RMOfflineRenderer {
+    public:
+        struct Keyframe {
+            float time;
+            Vec3 position;
+            Vec3 rotation;
+        };
+
+        struct Settings {
+            std::string scene;
+            std::string camera;
+            std::string sky;
+            std::string output = "frame_####.png";
+
+            unsigned int width = 640;
+            unsigned int height = 480;
+            unsigned int frames = 1;
+            float fps = 24.f;
+            float startTime = 0.f;
+
+            // 0 uses every core
+            unsigned int threads = 0;
+            unsigned int tileSize = 32;
+            int maxSteps = 500;
+
+            bool gpu = false;
+
+            // Chrome trace of the tiles on every thread, empty for none
+            std::string trace;
+
+            // RMMarchStats::Counter written instead of the shaded frames, -1 for none
+            int heatmap = -1;
+            // Count drawn red, 0 picks one from the counter (maxSteps for primary steps)
+            unsigned int heatmapScale = 0;
+        };
+
+        struct Stats {
+            unsigned int frames = 0;
+            double seconds = 0;
+            double raysPerSecond = 0;
+            // Primary steps per ray, negative when they weren't counted (GPU renders other than --heatmap steps)
+            double averageSteps = -1;
+            // Per pixel march work over every frame
+            RMMarchStats march;
+        };
+
+        explicit RMOfflineRenderer(const Settings& settings);
+        ~RMOfflineRenderer();
+
+        // Loads the scene, camera path and sky, error receives the reason it failed
+        bool load(std::string* error = nullptr);
+        bool render(Stats* stats = nullptr, std::string* error = nullptr);
+
+        /*
+        Renders the pixels from (x0, y0) up to (x1, y1) of a frame on the calling thread
+        out receives RGB floats for pixel (x0, y0) onwards, rows are stride floats apart
+        Returns the number of march steps taken, march (if given) gets the counts of every pixel
+        */
+        long long renderTile(unsigned int frame, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, float* out, size_t stride, RMMarchStats* march = nullptr);
+
+        // Writes a whole frame of RGB floats to the file for that frame number
+        bool saveFrame(unsigned int frame, const std::vector<float>& rgb, std::string* error);
+
+        const Settings& getSettings();
+        const std::vector<Keyframe>& getPath();
+        // Replaces the camera path from load
+        void setPath(const std::vector<Keyframe>& keyframes);
+
+        static bool loadPath(const std::string& filename, std::vector<Keyframe>& path, std::string* error);
+
+        /*
+        Reads the render option at argv[i] into settings
+        Returns how many arguments it used, 0 when it isn't a render option and -1 when its value is bad
+        */
+        static int parseOption(int argc, char** argv, int i, Settings& settings);
+
+        // Parses the arguments after "render", renders and reports the timings, returns the exit code
+        static int runCommandLine(int argc, char** argv);
+
+    private:
+        Settings settings;
+        std::vector<Keyframe> path;
+        RMSkybox skybox;
+        bool hasSky;
+        // Shapes that matter around each part of the scene, the scene doesn't move while rendering
+        RMRegionGrid regions;
+
+        Keyframe getCamera(float time);
+        std::string getFrameName(unsigned int frame);
+
+        // Colour (0 - 1, same space as the shader output) seen along a primary ray
+        Vec3 trace(Vec3 origin, Vec3 direction, float time, float pixelCone, int& steps, int& bounces);
+        Vec3 shadeHit(RMShape* shape, Vec3 p, Vec3 normal, float time);
+        Vec3 sampleSky(Vec3 direction, float roughness);
+        // Heatmap colour of count for settings.heatmap
+        Vec3 heatColor(unsigned int count);
+
+        bool renderCPU(Stats* stats, std::string* error);
+        bool renderGPU(Stats* stats, std::string* error);
+
+        // Uncompressed 32 bit float RGB OpenEXR
+        static bool writeExr(const std::string& filename, const std::vector<float>& rgb, unsigned int width, unsigned int height);
+    };
+}
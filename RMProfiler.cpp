@@ -0,0 +1,587 @@
+#include "RMProfiler.h"
+
+#include <SFML/Window/Context.hpp>
+#include <SFML/OpenGL.hpp>
+#include <imgui.h>
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <cstring>
+#include <cstdio>
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+#pragma region Init
+const unsigned int rm::RMProfiler::HISTORY;
+std::atomic<bool> rm::RMProfiler::enabled(true);
+thread_local bool rm::RMProfiler::frameThread = false;
+thread_local const char* rm::RMProfiler::threadName = nullptr;
+thread_local const char* rm::RMProfiler::recordedThread = nullptr;
+thread_local std::vector<std::pair<const char*, rm::RMProfiler::Clock::time_point>> rm::RMProfiler::sideOpen;
+
+const size_t rm::RMProfiler::SIDE_EVENTS;
+std::mutex rm::RMProfiler::sideMutex;
+std::vector<rm::RMProfiler::SideEvent> rm::RMProfiler::sideEvents;
+
+rm::RMProfiler::Clock::time_point rm::RMProfiler::frameStart = rm::RMProfiler::Clock::now();
+unsigned int rm::RMProfiler::frame = 0;
+float rm::RMProfiler::frameTimes[HISTORY];
+
+std::vector<rm::RMProfiler::Event> rm::RMProfiler::events;
+std::vector<rm::RMProfiler::Event> rm::RMProfiler::lastFrame;
+std::vector<size_t> rm::RMProfiler::open;
+std::vector<rm::RMProfiler::Phase> rm::RMProfiler::phases;
+
+std::vector<rm::RMProfiler::GpuQuery> rm::RMProfiler::pendingQueries;
+std::vector<unsigned int> rm::RMProfiler::freeQueries;
+size_t rm::RMProfiler::gpuScope = 0;
+
+std::atomic<bool> rm::RMProfiler::tracing(false);
+const rm::RMProfiler::Clock::time_point rm::RMProfiler::traceEpoch = rm::RMProfiler::Clock::now();
+std::mutex rm::RMProfiler::ringsMutex;
+std::vector<std::unique_ptr<rm::RMProfiler::TraceRing>> rm::RMProfiler::rings;
+#pragma endregion
+
+#pragma region Timer queries
+// Core since OpenGL 3.3, SFML only exposes 1.1 so they are loaded by hand
+static const GLenum TIME_ELAPSED = 0x88BF;
+static const GLenum QUERY_RESULT = 0x8866;
+static const GLenum QUERY_RESULT_AVAILABLE = 0x8867;
+
+static struct {
+    void (APIENTRY* genQueries)(GLsizei n, GLuint* ids);
+    void (APIENTRY* beginQuery)(GLenum target, GLuint id);
+    void (APIENTRY* endQuery)(GLenum target);
+    void (APIENTRY* getQueryObjectuiv)(GLuint id, GLenum name, GLuint* value);
+    void (APIENTRY* getQueryObjectui64v)(GLuint id, GLenum name, sf::Uint64* value);
+
+    bool loaded = false;
+    bool available = false;
+} gl;
+
+// Needs the window's context to be active on this thread
+static bool loadTimerQueries() {
+    if (gl.loaded) {
+        return gl.available;
+    }
+    gl.loaded = true;
+
+    const char* version = (const char*)glGetString(GL_VERSION);
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    int major = 0, minor = 0;
+    if (version == nullptr || sscanf(version, "%d.%d", &major, &minor) != 2) {
+        return false;
+    }
+
+    bool supported = major > 3 || (major == 3 && minor >= 3) ||
+        (extensions != nullptr && strstr(extensions, "GL_ARB_timer_query") != nullptr);
+    if (!supported) {
+        return false;
+    }
+
+    gl.genQueries = (decltype(gl.genQueries))sf::Context::getFunction("glGenQueries");
+    gl.beginQuery = (decltype(gl.beginQuery))sf::Context::getFunction("glBeginQuery");
+    gl.endQuery = (decltype(gl.endQuery))sf::Context::getFunction("glEndQuery");
+    gl.getQueryObjectuiv = (decltype(gl.getQueryObjectuiv))sf::Context::getFunction("glGetQueryObjectuiv");
+    gl.getQueryObjectui64v = (decltype(gl.getQueryObjectui64v))sf::Context::getFunction("glGetQueryObjectui64v");
+
+    gl.available = gl.genQueries && gl.beginQuery && gl.endQuery && gl.getQueryObjectuiv && gl.getQueryObjectui64v;
+    return gl.available;
+}
+
+void rm::RMProfiler::collectQueries() {
+    for (size_t i = 0; i < pendingQueries.size();) {
+        GpuQuery& q = pendingQueries[i];
+
+        GLuint ready = 0;
+        gl.getQueryObjectuiv(q.query, QUERY_RESULT_AVAILABLE, &ready);
+        if (!ready) {
+            i++;
+            continue;
+        }
+
+        sf::Uint64 nanoseconds = 0;
+        gl.getQueryObjectui64v(q.query, QUERY_RESULT, &nanoseconds);
+
+        // Too late once the frame has left the history
+        if (frame - q.frame < HISTORY) {
+            float& gpu = phases[q.phase].gpu[q.frame % HISTORY];
+            gpu = std::max(gpu, 0.f) + nanoseconds / 1e6f;
+        }
+
+        freeQueries.push_back(q.query);
+        pendingQueries[i] = pendingQueries.back();
+        pendingQueries.pop_back();
+    }
+}
+#pragma endregion
+
+#pragma region Recording
+float rm::RMProfiler::now() {
+    return std::chrono::duration<float, std::milli>(Clock::now() - frameStart).count();
+}
+
+unsigned int rm::RMProfiler::findPhase(const char* name, unsigned int depth) {
+    for (unsigned int i = 0; i < phases.size(); i++) {
+        if (phases[i].name == name || strcmp(phases[i].name, name) == 0) {
+            return i;
+        }
+    }
+
+    Phase phase;
+    phase.name = name;
+    phase.depth = depth;
+    std::fill(phase.cpu, phase.cpu + HISTORY, 0.f);
+    std::fill(phase.gpu, phase.gpu + HISTORY, -1.f);
+    phase.timedOnGpu = false;
+    phases.push_back(phase);
+    return (unsigned int)phases.size() - 1;
+}
+
+void rm::RMProfiler::beginFrame() {
+    // There is nothing to end on the first call
+    bool first = !frameThread;
+    frameThread = true;
+
+    if (tracing && !first) {
+        trace("Frame", frameStart, Clock::now());
+    }
+
+    // Scopes other recorded threads finished since the last frame, dropped while the profiler is off
+    std::vector<SideEvent> side;
+    {
+        std::lock_guard<std::mutex> lock(sideMutex);
+        side.swap(sideEvents);
+    }
+
+    if (enabled && !first) {
+        float length = now();
+        unsigned int slot = frame % HISTORY;
+
+        // Scopes left open run to the end of the frame
+        while (!open.empty()) {
+            end();
+        }
+
+        frameTimes[slot] = length;
+        for (Phase& phase : phases) {
+            phase.cpu[slot] = 0.f;
+        }
+        for (const Event& e : events) {
+            phases[findPhase(e.name, e.depth)].cpu[slot] += e.end - e.start;
+        }
+
+        // Other recorded threads, in the order the scopes started so parents come before their children
+        std::sort(side.begin(), side.end(), [](const SideEvent& a, const SideEvent& b) {
+            return a.start != b.start ? a.start < b.start : a.depth < b.depth;
+        });
+        for (const SideEvent& e : side) {
+            if (e.depth == 0) {
+                phases[findPhase(e.thread, 0)].cpu[slot] += e.duration;
+            }
+            phases[findPhase(e.name, e.depth + 1)].cpu[slot] += e.duration;
+        }
+
+        lastFrame.swap(events);
+        frame++;
+
+        // The next frame's GPU times start out unknown
+        for (Phase& phase : phases) {
+            phase.gpu[frame % HISTORY] = -1.f;
+        }
+    }
+
+    events.clear();
+    open.clear();
+    gpuScope = 0;
+
+    if (!pendingQueries.empty()) {
+        collectQueries();
+    }
+
+    frameStart = Clock::now();
+}
+
+void rm::RMProfiler::recordThread(const char* name) {
+    recordedThread = name;
+}
+
+void rm::RMProfiler::beginSide(const char* name) {
+    sideOpen.emplace_back(name, Clock::now());
+}
+
+void rm::RMProfiler::endSide() {
+    if (sideOpen.empty()) {
+        return;
+    }
+
+    std::pair<const char*, Clock::time_point> scope = sideOpen.back();
+    sideOpen.pop_back();
+
+    SideEvent e;
+    e.thread = recordedThread;
+    e.name = scope.first;
+    e.depth = (unsigned int)sideOpen.size();
+    e.start = scope.second;
+    e.duration = std::chrono::duration<float, std::milli>(Clock::now() - scope.second).count();
+
+    std::lock_guard<std::mutex> lock(sideMutex);
+    if (sideEvents.size() < SIDE_EVENTS) {
+        sideEvents.push_back(e);
+    }
+}
+
+void rm::RMProfiler::begin(const char* name) {
+    events.push_back({ name, (unsigned int)open.size(), now(), 0.f });
+    open.push_back(events.size() - 1);
+}
+
+void rm::RMProfiler::end() {
+    if (open.empty()) {
+        return;
+    }
+
+    events[open.back()].end = now();
+    open.pop_back();
+}
+
+void rm::RMProfiler::beginGpu(const char* name) {
+    if (gpuScope != 0 || !loadTimerQueries()) {
+        return;
+    }
+
+    GLuint query;
+    if (freeQueries.empty()) {
+        gl.genQueries(1, &query);
+    }
+    else {
+        query = freeQueries.back();
+        freeQueries.pop_back();
+    }
+
+    unsigned int phase = findPhase(name, (unsigned int)open.size() - 1);
+    phases[phase].timedOnGpu = true;
+
+    gl.beginQuery(TIME_ELAPSED, query);
+    pendingQueries.push_back({ query, phase, frame });
+    gpuScope = open.size();
+}
+
+void rm::RMProfiler::endGpu() {
+    if (gpuScope == 0 || gpuScope != open.size()) {
+        return;
+    }
+
+    gl.endQuery(TIME_ELAPSED);
+    gpuScope = 0;
+}
+#pragma endregion
+
+#pragma region Tracing
+void rm::RMProfiler::setTracing(bool on) {
+    tracing = on;
+}
+
+bool rm::RMProfiler::isTracing() {
+    return tracing;
+}
+
+void rm::RMProfiler::setThreadName(const char* name) {
+    // Threads only get a ring once they record something
+    threadName = name;
+
+    TraceRing* ring = threadRing(false);
+    if (ring != nullptr) {
+        ring->threadName = name;
+    }
+}
+
+const char* rm::RMProfiler::intern(const std::string& name) {
+    static std::mutex mutex;
+    static std::set<std::string> names;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return names.insert(name).first->c_str();
+}
+
+rm::RMProfiler::TraceRing* rm::RMProfiler::threadRing(bool create) {
+    // Retires the ring when its thread exits
+    struct Owner {
+        TraceRing* ring = nullptr;
+        ~Owner() {
+            if (ring != nullptr) ring->retired = true;
+        }
+    };
+    static thread_local Owner owner;
+
+    if (owner.ring != nullptr || !create) {
+        return owner.ring;
+    }
+
+    std::lock_guard<std::mutex> lock(ringsMutex);
+
+    // Short lived workers reuse the rings of finished ones instead of piling up new ones,
+    // what the old thread recorded stays in the ring until it is overwritten
+    for (const std::unique_ptr<TraceRing>& ring : rings) {
+        if (ring->retired) {
+            ring->retired = false;
+            ring->threadName = threadName;
+            owner.ring = ring.get();
+            return owner.ring;
+        }
+    }
+
+    TraceRing* ring = new TraceRing();
+    ring->written = 0;
+    ring->threadName = threadName;
+    ring->thread = (unsigned int)rings.size() + 1;
+    ring->retired = false;
+    rings.emplace_back(ring);
+
+    owner.ring = ring;
+    return ring;
+}
+
+void rm::RMProfiler::trace(const char* name, Clock::time_point start, Clock::time_point end) {
+    TraceRing* ring = threadRing();
+
+    // Fill the slot first, then publish it
+    unsigned long long n = ring->written.load(std::memory_order_relaxed);
+    TraceEvent& e = ring->events[n % TRACE_EVENTS];
+    e.name = name;
+    e.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - traceEpoch).count();
+    e.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    ring->written.store(n + 1, std::memory_order_release);
+}
+
+// Names are literals but could still hold quotes or backslashes
+static void writeJsonString(std::ostream& out, const char* s) {
+    out << '"';
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') out << '\\';
+        if ((unsigned char)*s >= 0x20) out << *s;
+    }
+    out << '"';
+}
+
+bool rm::RMProfiler::saveTrace(const std::string& filename, std::string* error) {
+    std::vector<TraceRing*> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for (const std::unique_ptr<TraceRing>& ring : rings) {
+            snapshot.push_back(ring.get());
+        }
+    }
+
+    std::ofstream file(filename);
+    if (!file) {
+        if (error != nullptr) *error = "Couldn't write " + filename;
+        return false;
+    }
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool firstEvent = true;
+    char number[64];
+
+    std::vector<TraceEvent> events;
+    for (TraceRing* ring : snapshot) {
+        // The owning thread keeps writing while this copies, so check afterwards which slots it reached
+        unsigned long long end = ring->written.load(std::memory_order_acquire);
+        unsigned long long begin = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+
+        events.clear();
+        for (unsigned long long i = begin; i < end; i++) {
+            events.push_back(ring->events[i % TRACE_EVENTS]);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        unsigned long long after = ring->written.load(std::memory_order_relaxed);
+        // Slots of events up to after - TRACE_EVENTS were (or are being) overwritten
+        unsigned long long valid = after >= TRACE_EVENTS ? after - TRACE_EVENTS + 1 : 0;
+        if (valid > begin) {
+            events.erase(events.begin(), events.begin() + (size_t)std::min(valid - begin, end - begin));
+        }
+
+        // Outer scopes end after their children, viewers want them first
+        std::sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b) {
+            return a.start != b.start ? a.start < b.start : a.duration > b.duration;
+        });
+
+        const char* name = ring->threadName;
+        if (name != nullptr) {
+            file << (firstEvent ? "" : ",\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->thread << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+            writeJsonString(file, name);
+            file << "}}";
+            firstEvent = false;
+        }
+
+        for (const TraceEvent& e : events) {
+            snprintf(number, sizeof(number), ",\"ts\":%.3f,\"dur\":%.3f", e.start / 1e3, e.duration / 1e3);
+            file << (firstEvent ? "" : ",\n") << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->thread << number << ",\"name\":";
+            writeJsonString(file, e.name);
+            file << "}";
+            firstEvent = false;
+        }
+    }
+
+    file << "\n]}\n";
+    if (!file) {
+        if (error != nullptr) *error = "Couldn't write " + filename;
+        return false;
+    }
+    return true;
+}
+#pragma endregion
+
+#pragma region Overlay
+// Average, 95th percentile and maximum of the last count values before slot next, negative values are skipped
+static void summarize(const float* values, unsigned int next, unsigned int count, float* average, float* p95, float* maximum) {
+    std::vector<float> sorted;
+    sorted.reserve(count);
+    for (unsigned int i = 0; i < count; i++) {
+        float v = values[(next + rm::RMProfiler::HISTORY - 1 - i) % rm::RMProfiler::HISTORY];
+        if (v >= 0.f) sorted.push_back(v);
+    }
+
+    *average = *p95 = *maximum = 0.f;
+    if (sorted.empty()) {
+        return;
+    }
+
+    std::sort(sorted.begin(), sorted.end());
+    float sum = 0.f;
+    for (float v : sorted) sum += v;
+
+    *average = sum / sorted.size();
+    *p95 = sorted[std::min(sorted.size() - 1, (size_t)(sorted.size() * 0.95f))];
+    *maximum = sorted.back();
+}
+
+void rm::RMProfiler::drawOverlay(bool* isOpen) {
+    if (!ImGui::Begin("Profiler", isOpen)) {
+        ImGui::End();
+        return;
+    }
+
+    bool on = enabled;
+    if (ImGui::Checkbox("Enabled", &on)) {
+        enabled = on;
+    }
+
+    // Chrome trace of every thread
+    static std::string traceStatus;
+    bool traceOn = tracing;
+    ImGui::SameLine();
+    if (ImGui::Checkbox("Record trace", &traceOn)) {
+        setTracing(traceOn);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Save trace")) {
+        std::string error;
+        traceStatus = saveTrace("trace.json", &error) ? "Saved trace.json" : error;
+    }
+    if (!traceStatus.empty()) {
+        ImGui::SameLine();
+        ImGui::TextDisabled("%s", traceStatus.c_str());
+    }
+
+    unsigned int next = frame % HISTORY;
+    unsigned int count = std::min(frame, HISTORY);
+    if (count == 0) {
+        ImGui::Text("No frames yet");
+        ImGui::End();
+        return;
+    }
+
+    // Rolling frame times
+    float average, p95, maximum;
+    summarize(frameTimes, next, count, &average, &p95, &maximum);
+    ImGui::Text("Frame %.2f ms (%.0f fps), 95%% %.2f ms, max %.2f ms", average, average > 0.f ? 1000.f / average : 0.f, p95, maximum);
+    ImGui::PlotHistogram("##frames", frameTimes, HISTORY, next, nullptr, 0.f, maximum * 1.1f, ImVec2(-1, 60));
+
+    // Flame graph of the last frame, one row per depth
+    float length = frameTimes[(frame - 1) % HISTORY];
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    float width = ImGui::GetContentRegionAvail().x;
+    float row = ImGui::GetTextLineHeightWithSpacing();
+    unsigned int depth = 0;
+
+    for (const Event& e : lastFrame) {
+        float x0 = origin.x + e.start / length * width;
+        float x1 = std::max(origin.x + e.end / length * width, x0 + 1.f);
+        float y0 = origin.y + e.depth * row;
+        ImVec2 low(x0, y0), high(x1, y0 + row - 1.f);
+
+        // Stable colour per name (FNV-1a)
+        unsigned int hash = 2166136261u;
+        for (const char* ch = e.name; *ch; ch++) hash = (hash ^ (unsigned char)*ch) * 16777619u;
+        drawList->AddRectFilled(low, high, ImColor::HSV((hash % 360) / 360.f, 0.5f, 0.85f));
+        drawList->PushClipRect(low, high, true);
+        drawList->AddText(ImVec2(x0 + 2.f, y0), IM_COL32_BLACK, e.name);
+        drawList->PopClipRect();
+
+        if (ImGui::IsMouseHoveringRect(low, high)) {
+            ImGui::SetTooltip("%s\n%.3f ms", e.name, e.end - e.start);
+        }
+        depth = std::max(depth, e.depth + 1);
+    }
+    ImGui::Dummy(ImVec2(width, depth * row));
+
+    // Every phase over the history, the selected one gets plotted
+    static int selected = -1;
+    if (ImGui::BeginTable("phases", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV)) {
+        ImGui::TableSetupColumn("Phase");
+        ImGui::TableSetupColumn("CPU avg");
+        ImGui::TableSetupColumn("CPU 95%");
+        ImGui::TableSetupColumn("CPU max");
+        ImGui::TableSetupColumn("GPU avg");
+        ImGui::TableHeadersRow();
+
+        for (int i = 0; i < (int)phases.size(); i++) {
+            const Phase& phase = phases[i];
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            ImGui::Indent(phase.depth * 10.f + 1.f);
+            if (ImGui::Selectable(phase.name, selected == i, ImGuiSelectableFlags_SpanAllColumns)) {
+                selected = selected == i ? -1 : i;
+            }
+            ImGui::Unindent(phase.depth * 10.f + 1.f);
+
+            summarize(phase.cpu, next, count, &average, &p95, &maximum);
+            ImGui::TableSetColumnIndex(1);
+            ImGui::Text("%.3f", average);
+            ImGui::TableSetColumnIndex(2);
+            ImGui::Text("%.3f", p95);
+            ImGui::TableSetColumnIndex(3);
+            ImGui::Text("%.3f", maximum);
+
+            ImGui::TableSetColumnIndex(4);
+            if (phase.timedOnGpu) {
+                summarize(phase.gpu, next, count, &average, &p95, &maximum);
+                ImGui::Text("%.3f", average);
+            }
+            else {
+                ImGui::TextDisabled("-");
+            }
+        }
+        ImGui::EndTable();
+    }
+
+    if (selected >= 0 && selected < (int)phases.size()) {
+        const Phase& phase = phases[selected];
+        summarize(phase.cpu, next, count, &average, &p95, &maximum);
+        ImGui::PlotHistogram("CPU ms", phase.cpu, HISTORY, next, nullptr, 0.f, maximum * 1.1f, ImVec2(-60, 50));
+
+        if (phase.timedOnGpu) {
+            summarize(phase.gpu, next, count, &average, &p95, &maximum);
+            ImGui::PlotHistogram("GPU ms", phase.gpu, HISTORY, next, nullptr, 0.f, maximum * 1.1f, ImVec2(-60, 50));
+        }
+    }
+
+    ImGui::End();
+}
+#pragma endregion
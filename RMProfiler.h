@@ -0,0 +1,205 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+/*
+Scoped timers around the phases of a frame
+RM_PROFILE_SCOPE("name") times the rest of the block it is in, RM_PROFILE_GPU_SCOPE also times the
+draw calls issued in the block on the GPU (with timer queries, when the driver has them).
+Scopes nest, so the overlay shows them as a flame graph of the last frame above a rolling
+history of every phase. The thread calling beginFrame is recorded, plus any thread that called
+recordThread: the time its scopes finished during a frame is added to that frame's history under a
+phase named after the thread (so a frame can be checked against the simulation running next to it).
+
+While tracing, scopes on every thread also go into a ring buffer of their own thread, which
+saveTrace writes out as Chrome trace JSON (chrome://tracing or ui.perfetto.dev) to look at how
+threads were scheduled and where they stalled. Rings only keep the newest TRACE_EVENTS scopes.
+
+Building with RM_NO_PROFILING removes the scopes entirely, otherwise a scope costs a few
+branches while the profiler and tracing are switched off.
+*/
+#ifndef RM_NO_PROFILING
+#define RM_PROFILE_CONCAT_(a, b) a##b
+#define RM_PROFILE_CONCAT(a, b) RM_PROFILE_CONCAT_(a, b)
+#define RM_PROFILE_SCOPE(name) rm::RMProfiler::Scope RM_PROFILE_CONCAT(rmProfileScope, __LINE__)(name)
+#define RM_PROFILE_GPU_SCOPE(name) rm::RMProfiler::GpuScope RM_PROFILE_CONCAT(rmProfileScope, __LINE__)(name)
+#else
+#define RM_PROFILE_SCOPE(name)
+#define RM_PROFILE_GPU_SCOPE(name)
+#endif
+
+namespace rm {
+
+    class RMProfiler {
+    public:
+        // Frames kept in the rolling history
+        static const unsigned int HISTORY = 240;
+
+        // Scopes kept per thread while tracing
+        static const unsigned int TRACE_EVENTS = 1 << 15;
+
+        // name has to outlive the profiler (a string literal or from intern)
+        class Scope {
+        public:
+            Scope(const char* name) : name(name), active(frameThread && isEnabled()), side(recordedThread != nullptr && isEnabled()),
+                traced(tracing.load(std::memory_order_relaxed)) {
+                if (active) begin(name);
+                if (side) beginSide(name);
+                if (traced) start = Clock::now();
+            }
+            ~Scope() {
+                if (active) end();
+                if (side) endSide();
+                if (traced) trace(name, start, Clock::now());
+            }
+
+        protected:
+            const char* name;
+            // Recorded by the frame thread, or by a thread from recordThread
+            bool active;
+            bool side;
+            bool traced;
+            std::chrono::steady_clock::time_point start;
+        };
+
+        class GpuScope : public Scope {
+        public:
+            GpuScope(const char* name) : Scope(name) {
+                if (active) beginGpu(name);
+            }
+            ~GpuScope() {
+                if (active) endGpu();
+            }
+        };
+
+        // Ends the previous frame and starts timing the next one, the calling thread becomes the recorded one
+        static void beginFrame();
+
+        // ImGui window with the flame graph and the history, open is cleared when it gets closed
+        static void drawOverlay(bool* open = nullptr);
+
+        // Read by scopes on every thread
+        static std::atomic<bool> enabled;
+        static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+        /*
+        Records the calling thread's scopes too, for threads running a loop of their own (the simulation)
+        They are summed per frame under a phase called name, in the table and history but not the flame graph
+        */
+        static void recordThread(const char* name);
+
+        static void setTracing(bool on);
+        static bool isTracing();
+        // Shown instead of the thread's number in traces
+        static void setThreadName(const char* name);
+        // A copy of name that lives as long as the program, for scope names made at runtime
+        static const char* intern(const std::string& name);
+        // Writes every thread's ring as Chrome trace JSON, can be called while other threads are recording
+        static bool saveTrace(const std::string& filename, std::string* error = nullptr);
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        // A scope of the frame being recorded, times in ms from the start of the frame
+        struct Event {
+            const char* name;
+            unsigned int depth;
+            float start;
+            float end;
+        };
+
+        // Totals of one scope name over the history, in ms (gpu is negative until its query returns)
+        struct Phase {
+            const char* name;
+            unsigned int depth;
+            float cpu[HISTORY];
+            float gpu[HISTORY];
+            bool timedOnGpu;
+        };
+
+        // Timer query waiting for the GPU
+        struct GpuQuery {
+            unsigned int query;
+            unsigned int phase;
+            unsigned int frame;
+        };
+
+        // A finished scope in a trace, in ns since the program started
+        struct TraceEvent {
+            const char* name;
+            long long start;
+            long long duration;
+        };
+
+        // Written only by its own thread, written counts every event ever pushed so saveTrace
+        // can tell which slots were overwritten while it was copying them
+        struct TraceRing {
+            TraceEvent events[TRACE_EVENTS];
+            std::atomic<unsigned long long> written;
+            std::atomic<const char*> threadName;
+            unsigned int thread;
+            // Set once its thread has exited so the next new thread can take it over
+            std::atomic<bool> retired;
+        };
+
+        // A scope a recorded thread finished, waiting for the next beginFrame
+        struct SideEvent {
+            const char* thread;
+            const char* name;
+            unsigned int depth;
+            Clock::time_point start;
+            float duration;
+        };
+
+        static thread_local bool frameThread;
+        static thread_local const char* threadName;
+        // Name from recordThread, scopes still open on that thread
+        static thread_local const char* recordedThread;
+        static thread_local std::vector<std::pair<const char*, Clock::time_point>> sideOpen;
+
+        // Cap on sideEvents so nothing piles up while no frames are being recorded
+        static const size_t SIDE_EVENTS = 4096;
+        static std::mutex sideMutex;
+        static std::vector<SideEvent> sideEvents;
+
+        static Clock::time_point frameStart;
+        static unsigned int frame;
+        static float frameTimes[HISTORY];
+
+        static std::vector<Event> events;
+        static std::vector<Event> lastFrame;
+        // Events of the scopes still open
+        static std::vector<size_t> open;
+        static std::vector<Phase> phases;
+
+        static std::vector<GpuQuery> pendingQueries;
+        static std::vector<unsigned int> freeQueries;
+        // Timer queries can't nest so only the outermost GPU scope is timed, this is its depth + 1 (0 for none)
+        static size_t gpuScope;
+
+        static std::atomic<bool> tracing;
+        static const Clock::time_point traceEpoch;
+        // Rings are only added or handed over under the mutex, never freed
+        static std::mutex ringsMutex;
+        static std::vector<std::unique_ptr<TraceRing>> rings;
+
+        static void begin(const char* name);
+        static void end();
+        static void beginGpu(const char* name);
+        static void endGpu();
+        static void beginSide(const char* name);
+        static void endSide();
+        static void trace(const char* name, Clock::time_point start, Clock::time_point end);
+        // The calling thread's ring, made on first use unless create is false
+        static TraceRing* threadRing(bool create = true);
+
+        static float now();
+        static unsigned int findPhase(const char* name, unsigned int depth);
+        // Reads back whichever queries the GPU has finished
+        static void collectQueries();
+    };
+}
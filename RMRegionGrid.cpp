@@ -0,0 +1,86 @@
+#include "RMRegionGrid.h"
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+rm::RMRegionGrid* rm::RMRegionGrid::active = nullptr;
+
+void rm::RMRegionGrid::build(Vec3 min, Vec3 max, unsigned int resolution, unsigned int threads, Stats* stats) {
+    auto start = std::chrono::steady_clock::now();
+
+    this->min = min;
+    this->resolution = std::max(resolution, 1u);
+    cellSize = (max - min) / (float)this->resolution;
+
+    const unsigned int n = this->resolution;
+    cells.assign((size_t)n * n * n, std::vector<RMShape*>());
+
+    std::atomic<size_t> nextCell(0);
+    auto work = [&]() {
+        size_t i;
+        while ((i = nextCell++) < cells.size()) {
+            unsigned int x = (unsigned int)(i % n);
+            unsigned int y = (unsigned int)(i / n % n);
+            unsigned int z = (unsigned int)(i / n / n);
+
+            Vec3 low = min + Vec3(cellSize.x * x, cellSize.y * y, cellSize.z * z);
+            RMShape::pruneShapes(RMShape::shapes, low, low + cellSize, cells[i]);
+        }
+    };
+
+    unsigned int threadCount = threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<std::thread> pool;
+    for (unsigned int i = 1; i < threadCount; i++) {
+        pool.emplace_back(work);
+    }
+    work();
+    for (std::thread& t : pool) {
+        t.join();
+    }
+
+    if (stats != nullptr) {
+        size_t total = 0;
+        for (auto const& cell : cells) {
+            total += cell.size();
+        }
+
+        stats->cells = cells.size();
+        stats->averageShapes = (double)total / cells.size();
+        stats->sceneShapes = RMShape::shapes.size();
+        stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+bool rm::RMRegionGrid::build(unsigned int resolution, unsigned int threads, Stats* stats) {
+    Vec3 low(FLT_MAX, FLT_MAX, FLT_MAX);
+    Vec3 high(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    for (RMShape* s : RMShape::shapes) {
+        Vec4 b = s->getBounds();
+        if (b.w < 0.f || !s->isVisible()) continue;
+
+        low = VectorHelper::vectorMin(low, Vec3(b.x - b.w, b.y - b.w, b.z - b.w));
+        high = VectorHelper::vectorMax(high, Vec3(b.x + b.w, b.y + b.w, b.z + b.w));
+    }
+
+    if (high.x < low.x) {
+        return false;
+    }
+
+    build(low, high, resolution, threads, stats);
+    return true;
+}
+
+const std::vector<rm::RMShape*>* rm::RMRegionGrid::getShapes(Vec3 p) {
+    Vec3 g = p - min;
+    g = Vec3(g.x / cellSize.x, g.y / cellSize.y, g.z / cellSize.z);
+
+    const float n = (float)resolution;
+    if (!(g.x >= 0.f && g.y >= 0.f && g.z >= 0.f && g.x < n && g.y < n && g.z < n)) {
+        return nullptr;
+    }
+
+    return &cells[((size_t)g.z * resolution + (size_t)g.y) * resolution + (size_t)g.x];
+}
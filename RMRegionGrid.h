@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include <SFML/Graphics.hpp>
+
+#include "RMShape.h"
+
+namespace rm {
+
+    /*
+    Coarse grid over the scene with the shapes that can matter in each cell
+    Built from RMShape::pruneShapes, so a point in a cell only has to be checked against that cell's list.
+    While a grid is active RMShape::getSceneDistance uses it for points inside it, it's only valid as long
+    as no shape moves or is shown or hidden, so it suits offline renders and exports rather than the live scene.
+    */
+    class RMRegionGrid {
+    public:
+        struct Stats {
+            size_t cells = 0;
+            // Shapes per cell against the whole scene
+            double averageShapes = 0;
+            size_t sceneShapes = 0;
+            double seconds = 0;
+        };
+
+        // Splits the box from min to max into resolution^3 cells, threads 0 uses every core
+        void build(Vec3 min, Vec3 max, unsigned int resolution = 16, unsigned int threads = 0, Stats* stats = nullptr);
+        // Same over the bounds of every visible bounded shape, false when there are none
+        bool build(unsigned int resolution = 16, unsigned int threads = 0, Stats* stats = nullptr);
+
+        // Shapes for the cell p is in, nullptr outside the grid
+        const std::vector<RMShape*>* getShapes(Vec3 p);
+
+        // Grid read by RMShape::getSceneDistance, nullptr for none
+        static RMRegionGrid* active;
+
+    private:
+        Vec3 min;
+        Vec3 cellSize;
+        unsigned int resolution = 0;
+        std::vector<std::vector<RMShape*>> cells;
+    };
+}
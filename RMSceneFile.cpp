@@ -0,0 +1,430 @@
+#include "RMSceneFile.h"
+
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <iterator>
+#include <functional>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "RMShape.h"
+#include "RMEnums.h"
+#include "VerletObject.h"
+
+const uint32_t rm::RMSceneFile::VERSION = 1;
+
+static_assert(sizeof(rm::RMSceneFile::Header) == 32, "Scene file header must stay 32 bytes");
+static_assert(sizeof(rm::RMSceneFile::ShapeRecord) == 80, "Shape records must stay 80 bytes");
+static_assert(sizeof(rm::RMSceneFile::MaterialRecord) == 32, "Material records must stay 32 bytes");
+static_assert(sizeof(rm::RMSceneFile::BodyRecord) == 32, "Body records must stay 32 bytes");
+
+// Materials created by loading a scene (RMShape::materials doesn't own them)
+static std::vector<std::unique_ptr<rm::RMMaterial>> loadedMaterials;
+
+#pragma region Memory Mapping
+// Read only view of a whole file
+class MappedFile {
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#endif
+    const char* data = nullptr;
+    size_t size = 0;
+
+public:
+    bool open(const std::string& filename) {
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return false;
+        size = (size_t)fileSize.QuadPart;
+
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) return false;
+
+        data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        size = (size_t)info.st_size;
+
+        void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        data = view == MAP_FAILED ? nullptr : (const char*)view;
+#endif
+        return data != nullptr;
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data != nullptr) UnmapViewOfFile(data);
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (data != nullptr) munmap((void*)data, size);
+#endif
+    }
+
+    const char* getData() { return data; }
+    size_t getSize() { return size; }
+};
+#pragma endregion
+
+// Offset of the next array, keeps every array 16 byte aligned
+static uint32_t alignOffset(uint32_t offset) {
+    return (offset + 15u) & ~15u;
+}
+
+bool rm::RMSceneFile::saveToFile(const std::string& filename) {
+    std::vector<RMShape*>& shapes = RMShape::shapes;
+    std::vector<RMMaterial*>& materials = RMShape::materials;
+    std::vector<VerletObject*>& bodies = VerletObject::verletObjects;
+
+    Header header = {};
+    header.magic[0] = 'R'; header.magic[1] = 'M'; header.magic[2] = 'S'; header.magic[3] = 'C';
+    header.version = VERSION;
+    header.shapeCount = (uint32_t)shapes.size();
+    header.materialCount = (uint32_t)materials.size();
+    header.bodyCount = (uint32_t)bodies.size();
+    header.shapeOffset = alignOffset(sizeof(Header));
+    header.materialOffset = alignOffset(header.shapeOffset + header.shapeCount * sizeof(ShapeRecord));
+    header.bodyOffset = alignOffset(header.materialOffset + header.materialCount * sizeof(MaterialRecord));
+
+    uint32_t fileSize = header.bodyOffset + header.bodyCount * sizeof(BodyRecord);
+    std::vector<char> buffer(fileSize, 0);
+    memcpy(buffer.data(), &header, sizeof(Header));
+
+    ShapeRecord* shapeRecords = (ShapeRecord*)(buffer.data() + header.shapeOffset);
+    for (uint32_t i = 0; i < header.shapeCount; i++) {
+        RMShape* s = shapes[i];
+        ShapeRecord& r = shapeRecords[i];
+
+        const Vec3* vectors[5] = { &s->position, &s->rotation, &s->param1, &s->param2, &s->origin };
+        float* fields[5] = { r.position, r.rotation, r.param1, r.param2, r.origin };
+        for (int v = 0; v < 5; v++) {
+            fields[v][0] = vectors[v]->x;
+            fields[v][1] = vectors[v]->y;
+            fields[v][2] = vectors[v]->z;
+        }
+
+        r.type = s->type;
+        r.operation = s->operation;
+        r.operandIndex = s->operandIndex;
+        r.materialIndex = s->materialIndex;
+        r.visible = s->checkShape ? 1 : 0;
+    }
+
+    MaterialRecord* materialRecords = (MaterialRecord*)(buffer.data() + header.materialOffset);
+    for (uint32_t i = 0; i < header.materialCount; i++) {
+        RMMaterial* m = materials[i];
+        MaterialRecord& r = materialRecords[i];
+
+        r.albedo[0] = m->albedo.x;
+        r.albedo[1] = m->albedo.y;
+        r.albedo[2] = m->albedo.z;
+        r.albedo[3] = m->albedo.w;
+        r.roughness = m->roughness;
+        r.metallic = m->metallic;
+        r.emissive = m->emissive ? 1 : 0;
+    }
+
+    BodyRecord* bodyRecords = (BodyRecord*)(buffer.data() + header.bodyOffset);
+    for (uint32_t i = 0; i < header.bodyCount; i++) {
+        VerletObject* b = bodies[i];
+        BodyRecord& r = bodyRecords[i];
+
+        r.positionCurrent[0] = b->positionCurrent.x;
+        r.positionCurrent[1] = b->positionCurrent.y;
+        r.positionCurrent[2] = b->positionCurrent.z;
+        r.positionOld[0] = b->positionOld.x;
+        r.positionOld[1] = b->positionOld.y;
+        r.positionOld[2] = b->positionOld.z;
+        r.shapeIndex = b->collider->getIndex();
+        r.isStatic = b->isStatic ? 1 : 0;
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    file.write(buffer.data(), buffer.size());
+    return (bool)file;
+}
+
+bool rm::RMSceneFile::loadFromFile(const std::string& filename) {
+    MappedFile file;
+    if (!file.open(filename) || file.getSize() < sizeof(Header)) {
+        return false;
+    }
+
+    const char* data = file.getData();
+    const Header* header = (const Header*)data;
+
+    if (memcmp(header->magic, "RMSC", 4) != 0 || header->version != VERSION) {
+        return false;
+    }
+
+    // The records are read in place, so the arrays have to start where saveToFile puts them
+    if (header->shapeOffset != alignOffset(header->shapeOffset) ||
+        header->materialOffset != alignOffset(header->materialOffset) ||
+        header->bodyOffset != alignOffset(header->bodyOffset) ||
+        header->shapeOffset < sizeof(Header)) {
+        return false;
+    }
+
+    // Make sure every array fits in the file before touching it
+    size_t size = file.getSize();
+    if ((size_t)header->shapeOffset + (size_t)header->shapeCount * sizeof(ShapeRecord) > size ||
+        (size_t)header->materialOffset + (size_t)header->materialCount * sizeof(MaterialRecord) > size ||
+        (size_t)header->bodyOffset + (size_t)header->bodyCount * sizeof(BodyRecord) > size ||
+        header->materialCount == 0) {
+        return false;
+    }
+
+    const ShapeRecord* shapeRecords = (const ShapeRecord*)(data + header->shapeOffset);
+    const MaterialRecord* materialRecords = (const MaterialRecord*)(data + header->materialOffset);
+    const BodyRecord* bodyRecords = (const BodyRecord*)(data + header->bodyOffset);
+
+    for (uint32_t i = 0; i < header->shapeCount; i++) {
+        const ShapeRecord& r = shapeRecords[i];
+        if (r.operandIndex >= (int32_t)header->shapeCount || r.materialIndex < 0 ||
+            r.materialIndex >= (int32_t)header->materialCount ||
+            r.type < rm::Invalid || r.type > rm::Plane ||
+            r.operation < rm::NoOp || r.operation > rm::SmoothSubtract) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < header->bodyCount; i++) {
+        if (bodyRecords[i].shapeIndex < 0 || bodyRecords[i].shapeIndex >= (int32_t)header->shapeCount) {
+            return false;
+        }
+    }
+
+    // Indices in the file are relative to these
+    int shapeBase = (int)RMShape::shapes.size();
+    int materialBase = (int)RMShape::materials.size() - 1;
+
+    RMShape::shapes.reserve(RMShape::shapes.size() + header->shapeCount);
+    RMShape::materials.reserve(RMShape::materials.size() + header->materialCount - 1);
+
+    // Material 0 is always defaultMat
+    for (uint32_t i = 1; i < header->materialCount; i++) {
+        const MaterialRecord& r = materialRecords[i];
+        RMMaterial* m = new RMMaterial();
+
+        m->albedo = Vec4(r.albedo[0], r.albedo[1], r.albedo[2], r.albedo[3]);
+        m->roughness = r.roughness;
+        m->metallic = r.metallic;
+        m->emissive = r.emissive != 0;
+
+        loadedMaterials.emplace_back(m);
+        RMShape::materials.push_back(m);
+    }
+
+    for (uint32_t i = 0; i < header->shapeCount; i++) {
+        const ShapeRecord& r = shapeRecords[i];
+        RMShape* s = new RMShape();
+
+        s->position = Vec3(r.position[0], r.position[1], r.position[2]);
+        s->setRotation(Vec3(r.rotation[0], r.rotation[1], r.rotation[2]));
+        s->param1 = Vec3(r.param1[0], r.param1[1], r.param1[2]);
+        s->param2 = Vec3(r.param2[0], r.param2[1], r.param2[2]);
+        s->origin = Vec3(r.origin[0], r.origin[1], r.origin[2]);
+        s->type = r.type;
+        s->operation = r.operation;
+        s->operandIndex = r.operandIndex < 0 ? -1 : r.operandIndex + shapeBase;
+        s->materialIndex = r.materialIndex == 0 ? 0 : r.materialIndex + materialBase;
+        s->checkShape = r.visible != 0;
+    }
+
+    for (uint32_t i = 0; i < header->bodyCount; i++) {
+        const BodyRecord& r = bodyRecords[i];
+        VerletObject* b = new VerletObject(RMShape::shapes[r.shapeIndex + shapeBase], r.isStatic != 0);
+
+        b->positionCurrent = Vector3f(r.positionCurrent[0], r.positionCurrent[1], r.positionCurrent[2]);
+        b->positionOld = Vector3f(r.positionOld[0], r.positionOld[1], r.positionOld[2]);
+    }
+
+    return true;
+}
+
+#pragma region Self Test
+static bool sameVector(const Vec3& a, const Vec3& b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+// RMMaterial's == compares addresses
+static bool sameMaterial(const rm::RMMaterial& a, const rm::RMMaterial& b) {
+    return a.albedo.x == b.albedo.x && a.albedo.y == b.albedo.y && a.albedo.z == b.albedo.z && a.albedo.w == b.albedo.w &&
+        a.roughness == b.roughness && a.metallic == b.metallic && a.emissive == b.emissive;
+}
+
+static bool fail(std::string* error, const std::string& message) {
+    if (error != nullptr) *error = message;
+    return false;
+}
+
+bool rm::RMSceneFile::testRoundTrip(const std::string& filename, std::string* error) {
+    // setMaterial keeps a pointer, so these have to outlive the shapes
+    static RMMaterial red, glass, light;
+    red.albedo = Vec4(1, 0.1f, 0.1f, 1);
+    red.roughness = 0.3f;
+    glass.albedo = Vec4(0.9f, 0.9f, 1, 0.2f);
+    glass.metallic = 0.75f;
+    light.albedo = Vec4(1, 1, 0.8f, 1);
+    light.emissive = true;
+
+    // One of each operation, an operand with an operand and a hidden shape
+    RMShape* ground = RMShape::createPlane(Vec3(0, 0, 0), Vec3(0, 0, 0), Vec3(0, 1, 0), 0);
+    RMShape* box = RMShape::createBox(Vec3(1, 2, 3), Vec3(0.1f, 0.2f, 0.3f), Vec3(1, 0.5f, 2));
+    RMShape* sphere = RMShape::createSphere(Vec3(1.5f, 2, 3), Vec3(0, 0, 0), 0.75f);
+    RMShape* capsule = RMShape::createCapsule(Vec3(-1, 0, 0), Vec3(1, 1, 0), 0.2f);
+    RMShape* cut = RMShape::createSphere(Vec3(0, 0.5f, 0), Vec3(0, 0, 0), 0.3f);
+    RMShape* lamp = RMShape::createSphere(Vec3(0, 5, 0), Vec3(0, 0, 0), 0.1f);
+    RMShape* hidden = RMShape::createBox(Vec3(4, 1, 4), Vec3(0, 1, 0), Vec3(1, 1, 1));
+
+    box->smoothCombine(sphere);
+    sphere->subtract(cut);
+    capsule->intersection(hidden);
+    box->setOrigin(Vec3(0.5f, 0, 0));
+    box->setMaterial(red);
+    sphere->setMaterial(glass);
+    lamp->setMaterial(light);
+    lamp->setVisible(false);
+
+    VerletObject* floor = new VerletObject(ground, true);
+    VerletObject* ball = new VerletObject(lamp);
+    ball->positionOld = ball->positionCurrent + Vector3f(0, 0.01f, 0);
+    (void)floor;
+
+    uint32_t shapeCount = (uint32_t)RMShape::shapes.size();
+    uint32_t materialCount = (uint32_t)RMShape::materials.size();
+    uint32_t bodyCount = (uint32_t)VerletObject::verletObjects.size();
+
+    if (!saveToFile(filename)) {
+        return fail(error, "Couldn't write " + filename);
+    }
+    if (!loadFromFile(filename)) {
+        return fail(error, "Couldn't load " + filename + " back");
+    }
+
+    // Loading appends, so everything saved is now there twice
+    if (RMShape::shapes.size() != shapeCount * 2 ||
+        RMShape::materials.size() != materialCount * 2 - 1 ||
+        VerletObject::verletObjects.size() != bodyCount * 2) {
+        return fail(error, "Loaded the wrong number of shapes, materials or bodies");
+    }
+
+    for (uint32_t i = 0; i < shapeCount; i++) {
+        RMShape* a = RMShape::shapes[i];
+        RMShape* b = RMShape::shapes[i + shapeCount];
+        std::string shape = "Shape " + std::to_string(i) + ": ";
+
+        if (!sameVector(a->position, b->position)) return fail(error, shape + "position");
+        if (!sameVector(a->rotation, b->rotation)) return fail(error, shape + "rotation");
+        if (!sameVector(a->param1, b->param1)) return fail(error, shape + "param1");
+        if (!sameVector(a->param2, b->param2)) return fail(error, shape + "param2");
+        if (!sameVector(a->origin, b->origin)) return fail(error, shape + "origin");
+        if (a->type != b->type) return fail(error, shape + "type");
+        if (a->operation != b->operation) return fail(error, shape + "operation");
+        if (a->checkShape != b->checkShape) return fail(error, shape + "visible");
+
+        int operand = a->operandIndex < 0 ? -1 : a->operandIndex + (int)shapeCount;
+        if (b->operandIndex != operand) return fail(error, shape + "operandIndex");
+
+        // Material 0 is shared, the rest were added again after the saved ones
+        int material = a->materialIndex == 0 ? 0 : a->materialIndex + (int)materialCount - 1;
+        if (b->materialIndex != material) return fail(error, shape + "materialIndex");
+
+        if (!sameMaterial(*RMShape::materials[a->materialIndex], *RMShape::materials[b->materialIndex])) {
+            return fail(error, shape + "material");
+        }
+    }
+
+    for (uint32_t i = 0; i < bodyCount; i++) {
+        VerletObject* a = VerletObject::verletObjects[i];
+        VerletObject* b = VerletObject::verletObjects[i + bodyCount];
+        std::string body = "Body " + std::to_string(i) + ": ";
+
+        if (a->positionCurrent != b->positionCurrent) return fail(error, body + "positionCurrent");
+        if (a->positionOld != b->positionOld) return fail(error, body + "positionOld");
+        if (a->isStatic != b->isStatic) return fail(error, body + "isStatic");
+        if (b->collider->getIndex() != a->collider->getIndex() + (int)shapeCount) return fail(error, body + "collider");
+    }
+
+    return true;
+}
+
+bool rm::RMSceneFile::testRejectsCorrupt(const std::string& filename, std::string* error) {
+    RMShape::createSphere(Vec3(0, 1, 0), Vec3(0, 0, 0), 0.5f);
+    if (!saveToFile(filename)) {
+        return fail(error, "Couldn't write " + filename);
+    }
+
+    std::vector<char> original;
+    {
+        std::ifstream in(filename, std::ios::binary);
+        original.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    // Each of these has to be refused before anything is added to the scene
+    struct Corruption {
+        const char* name;
+        std::function<void(char*)> apply;
+    };
+    Corruption corruptions[] = {
+        { "shape type out of range", [](char* data) {
+            Header* header = (Header*)data;
+            ((ShapeRecord*)(data + header->shapeOffset))[0].type = 99;
+        } },
+        { "operation out of range", [](char* data) {
+            Header* header = (Header*)data;
+            ((ShapeRecord*)(data + header->shapeOffset))[0].operation = -5;
+        } },
+        { "misaligned shape offset", [](char* data) {
+            ((Header*)data)->shapeOffset += 4;
+        } },
+        { "misaligned body offset", [](char* data) {
+            ((Header*)data)->bodyOffset += 1;
+        } },
+    };
+
+    for (const Corruption& c : corruptions) {
+        std::vector<char> data = original;
+        c.apply(data.data());
+        {
+            std::ofstream out(filename, std::ios::binary);
+            out.write(data.data(), data.size());
+        }
+
+        size_t shapes = RMShape::shapes.size();
+        if (loadFromFile(filename) || RMShape::shapes.size() != shapes) {
+            return fail(error, std::string("Loaded a file with a ") + c.name);
+        }
+    }
+
+    return true;
+}
+#pragma endregion
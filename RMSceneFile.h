@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace rm {
+
+    /*
+    Versioned binary scene format
+    A header followed by flat, 16 byte aligned arrays of fixed size records
+    (shapes, materials, physics bodies). Loading memory maps the file and reads
+    the records in place, there is no parsing step.
+    */
+    class RMSceneFile {
+    public:
+        struct Header {
+            char magic[4];
+            uint32_t version;
+            uint32_t shapeCount;
+            uint32_t materialCount;
+            uint32_t bodyCount;
+            // Byte offsets from the start of the file
+            uint32_t shapeOffset;
+            uint32_t materialOffset;
+            uint32_t bodyOffset;
+        };
+
+        struct ShapeRecord {
+            float position[3];
+            float rotation[3];
+            float param1[3];
+            float param2[3];
+            float origin[3];
+            int32_t type;
+            int32_t operation;
+            // Indices are relative to the file
+            int32_t operandIndex;
+            int32_t materialIndex;
+            uint32_t visible;
+        };
+
+        struct MaterialRecord {
+            float albedo[4];
+            float roughness;
+            float metallic;
+            uint32_t emissive;
+            uint32_t padding;
+        };
+
+        struct BodyRecord {
+            float positionCurrent[3];
+            float positionOld[3];
+            int32_t shapeIndex;
+            uint32_t isStatic;
+        };
+
+        // Writes every RMShape, material and VerletObject
+        static bool saveToFile(const std::string& filename);
+
+        /*
+        Adds the scene in the file to the current one
+        Material 0 in the file is the default material and isn't added again
+        */
+        static bool loadFromFile(const std::string& filename);
+
+        /*
+        Saves a small scene (CSG links, materials and bodies) to filename, loads it back and compares
+        every field, error receives the first one that differs. Adds to the current scene like loadFromFile.
+        */
+        static bool testRoundTrip(const std::string& filename, std::string* error = nullptr);
+        // Writes damaged copies of a small scene to filename and checks loadFromFile refuses every one
+        static bool testRejectsCorrupt(const std::string& filename, std::string* error = nullptr);
+
+        static const uint32_t VERSION;
+    };
+}
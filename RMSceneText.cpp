@@ -0,0 +1,631 @@
+#include "RMSceneText.h"
+
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "RMShape.h"
+#include "VerletObject.h"
+
+// Scenes added with loadFromFile/loadFromMemory, they own their materials
+static std::vector<std::unique_ptr<rm::RMSceneText>> loadedScenes;
+
+#pragma region Parser
+// Walks the text once, one statement per line
+class SceneParser {
+private:
+    const char* p;
+    const char* end;
+    int line;
+
+    rm::RMSceneText::Description& scene;
+
+    // Names seen so far, shapes map to their place in scene.shapes
+    std::unordered_map<std::string, size_t> shapes;
+    std::unordered_set<std::string> materials;
+
+public:
+    std::string error;
+    unsigned int statements;
+
+    SceneParser(const char* data, size_t size, rm::RMSceneText::Description& scene) : scene(scene) {
+        p = data;
+        end = data + size;
+        line = 1;
+        statements = 0;
+    }
+
+    bool fail(const std::string& message) {
+        error = "Line " + std::to_string(line) + ": " + message;
+        return false;
+    }
+
+    // Skips spaces and comments but not the end of the line
+    void skipBlanks() {
+        while (p < end) {
+            if (*p == ' ' || *p == '\t' || *p == '\r') {
+                p++;
+            }
+            else if (*p == '#') {
+                while (p < end && *p != '\n') p++;
+            }
+            else {
+                break;
+            }
+        }
+    }
+
+    bool atLineEnd() {
+        skipBlanks();
+        return p >= end || *p == '\n';
+    }
+
+    bool word(const char*& start, size_t& length) {
+        if (atLineEnd()) {
+            return false;
+        }
+
+        start = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '#') p++;
+        length = p - start;
+        return true;
+    }
+
+    static bool is(const char* start, size_t length, const char* keyword) {
+        return strlen(keyword) == length && memcmp(start, keyword, length) == 0;
+    }
+
+    // Plain decimal parsing, much faster than going through the locale aware strtof
+    bool number(float& value) {
+        skipBlanks();
+        const char* start = p;
+
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            p++;
+        }
+
+        double result = 0;
+        int digits = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            result = result * 10 + (*p - '0');
+            p++;
+            digits++;
+        }
+
+        if (p < end && *p == '.') {
+            p++;
+            double scale = 0.1;
+            while (p < end && *p >= '0' && *p <= '9') {
+                result += (*p - '0') * scale;
+                scale *= 0.1;
+                p++;
+                digits++;
+            }
+        }
+
+        if (digits == 0) {
+            p = start;
+            return fail("Expected a number");
+        }
+
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            bool negativeExp = false;
+            if (p < end && (*p == '-' || *p == '+')) {
+                negativeExp = *p == '-';
+                p++;
+            }
+
+            int exponent = 0;
+            while (p < end && *p >= '0' && *p <= '9') {
+                exponent = exponent * 10 + (*p - '0');
+                p++;
+            }
+            result *= pow(10.0, negativeExp ? -exponent : exponent);
+        }
+
+        value = (float)(negative ? -result : result);
+        return true;
+    }
+
+    bool vec3(Vec3& v) {
+        return number(v.x) && number(v.y) && number(v.z);
+    }
+
+    bool name(std::string& out) {
+        const char* start;
+        size_t length;
+        if (!word(start, length)) {
+            return fail("Expected a name");
+        }
+
+        out.assign(start, length);
+        return true;
+    }
+
+    bool findShape(rm::RMSceneText::ShapeDesc*& shape) {
+        std::string shapeName;
+        if (!name(shapeName)) return false;
+
+        auto it = shapes.find(shapeName);
+        if (it == shapes.end()) {
+            return fail("Unknown shape " + shapeName);
+        }
+
+        shape = &scene.shapes[it->second];
+        return true;
+    }
+
+    bool findMaterial(std::string& material) {
+        if (!name(material)) return false;
+
+        if (materials.count(material) == 0) {
+            return fail("Unknown material " + material);
+        }
+
+        return true;
+    }
+
+    bool parseMaterial() {
+        std::string materialName;
+        if (!name(materialName)) return false;
+
+        if (!materials.insert(materialName).second) {
+            return fail("Material " + materialName + " is already defined");
+        }
+
+        scene.materials.push_back({ materialName, rm::RMMaterial() });
+        rm::RMMaterial* material = &scene.materials.back().material;
+
+        const char* key;
+        size_t length;
+        while (word(key, length)) {
+            float emissive;
+
+            if (is(key, length, "albedo")) {
+                if (!number(material->albedo.x) || !number(material->albedo.y) ||
+                    !number(material->albedo.z) || !number(material->albedo.w)) return false;
+            }
+            else if (is(key, length, "roughness")) {
+                if (!number(material->roughness)) return false;
+            }
+            else if (is(key, length, "metallic")) {
+                if (!number(material->metallic)) return false;
+            }
+            else if (is(key, length, "emissive")) {
+                if (!number(emissive)) return false;
+                material->emissive = emissive != 0.f;
+            }
+            else {
+                return fail("Unknown material property " + std::string(key, length));
+            }
+        }
+
+        return true;
+    }
+
+    // Properties each shape type has, the create functions would ignore any other
+    static bool hasProperty(rm::ShapeType type, const char* key, size_t length) {
+        if (is(key, length, "material")) return true;
+
+        switch (type) {
+        case rm::Sphere: return is(key, length, "pos") || is(key, length, "rot") || is(key, length, "radius");
+        case rm::Box: return is(key, length, "pos") || is(key, length, "rot") || is(key, length, "size");
+        case rm::Capsule: return is(key, length, "a") || is(key, length, "b") || is(key, length, "radius");
+        case rm::Plane: return is(key, length, "pos") || is(key, length, "rot") || is(key, length, "normal") || is(key, length, "offset");
+        default: return false;
+        }
+    }
+
+    bool parseShape(rm::ShapeType type, const char* typeName) {
+        std::string shapeName;
+        if (!name(shapeName)) return false;
+
+        if (scene.shapes.size() >= (size_t)rm::RMShape::MAX_SHAPES) {
+            return fail("Too many shapes, Marcher.frag only draws " + std::to_string(rm::RMShape::MAX_SHAPES));
+        }
+
+        // Defaults match the create functions
+        Vec3 pos(0, 0, 0);
+        Vec3 rot(0, 0, 0);
+        Vec3 size(1, 1, 1);
+        Vec3 b(0, 1, 0);
+        Vec3 normal(0, 1, 0);
+        float radius = 1.f;
+        float offset = 0.f;
+        std::string material;
+
+        const char* key;
+        size_t length;
+        while (word(key, length)) {
+            bool ok;
+
+            if (!hasProperty(type, key, length)) {
+                bool known = hasProperty(rm::Sphere, key, length) || hasProperty(rm::Box, key, length) ||
+                    hasProperty(rm::Capsule, key, length) || hasProperty(rm::Plane, key, length);
+                if (known) return fail(std::string(key, length) + " doesn't apply to a " + typeName);
+                return fail("Unknown shape property " + std::string(key, length));
+            }
+
+            if (is(key, length, "pos") || is(key, length, "a")) ok = vec3(pos);
+            else if (is(key, length, "rot")) ok = vec3(rot);
+            else if (is(key, length, "size")) ok = vec3(size);
+            else if (is(key, length, "b")) ok = vec3(b);
+            else if (is(key, length, "normal")) ok = vec3(normal);
+            else if (is(key, length, "radius")) ok = number(radius);
+            else if (is(key, length, "offset")) ok = number(offset);
+            else ok = findMaterial(material);
+
+            if (!ok) return false;
+        }
+
+        if (shapes.count(shapeName) != 0) {
+            return fail("Shape " + shapeName + " is already defined");
+        }
+
+        rm::RMSceneText::ShapeDesc shape;
+        shape.name = shapeName;
+        shape.type = type;
+        shape.position = pos;
+        shape.rotation = rot;
+        shape.material = material;
+
+        // Same parameters the create functions would set
+        switch (type) {
+        case rm::Sphere:
+            shape.param1 = Vec3(radius, 0, 0);
+            break;
+        case rm::Box:
+            shape.param1 = size;
+            break;
+        case rm::Capsule:
+            shape.param1 = b;
+            shape.param2 = Vec3(radius, 0, 0);
+            break;
+        case rm::Plane:
+            shape.param1 = normal;
+            shape.param2 = Vec3(offset, 0, 0);
+            break;
+        default:
+            return fail("Unsupported shape");
+        }
+
+        shapes[shapeName] = scene.shapes.size();
+        scene.shapes.push_back(shape);
+        return true;
+    }
+
+    bool parseOperation() {
+        rm::RMSceneText::ShapeDesc* shape;
+        rm::RMSceneText::ShapeDesc* operand;
+        const char* op;
+        size_t length;
+
+        if (!findShape(shape)) return false;
+        if (!word(op, length)) return fail("Expected an operation");
+        if (!findShape(operand)) return false;
+
+        if (shape == operand) return fail("A shape can't operate on itself");
+
+        if (is(op, length, "union")) shape->operation = rm::Union;
+        else if (is(op, length, "intersection")) shape->operation = rm::Intersection;
+        else if (is(op, length, "subtract")) shape->operation = rm::Subtract;
+        else if (is(op, length, "smoothUnion")) shape->operation = rm::SmoothUnion;
+        else if (is(op, length, "smoothIntersection")) shape->operation = rm::SmoothIntersection;
+        else if (is(op, length, "smoothSubtract")) shape->operation = rm::SmoothSubtract;
+        else return fail("Unknown operation " + std::string(op, length));
+
+        shape->operand = operand->name;
+        return true;
+    }
+
+    bool parseBody() {
+        rm::RMSceneText::ShapeDesc* shape;
+        if (!findShape(shape)) return false;
+
+        const char* key;
+        size_t length;
+        if (word(key, length)) {
+            if (!is(key, length, "static")) {
+                return fail("Unknown body property " + std::string(key, length));
+            }
+            shape->isStatic = true;
+        }
+
+        shape->body = true;
+        return true;
+    }
+
+    bool parse() {
+        while (p < end) {
+            const char* keyword;
+            size_t length;
+
+            if (word(keyword, length)) {
+                bool ok;
+
+                if (is(keyword, length, "material")) ok = parseMaterial();
+                else if (is(keyword, length, "sphere")) ok = parseShape(rm::Sphere, "sphere");
+                else if (is(keyword, length, "box")) ok = parseShape(rm::Box, "box");
+                else if (is(keyword, length, "capsule")) ok = parseShape(rm::Capsule, "capsule");
+                else if (is(keyword, length, "plane")) ok = parseShape(rm::Plane, "plane");
+                else if (is(keyword, length, "op")) ok = parseOperation();
+                else if (is(keyword, length, "body")) ok = parseBody();
+                else return fail("Unknown statement " + std::string(keyword, length));
+
+                if (!ok) return false;
+                if (!atLineEnd()) return fail("Unexpected text at the end of the line");
+                statements++;
+            }
+
+            // Move on to the next line
+            if (p < end) {
+                p++;
+                line++;
+            }
+        }
+
+        return true;
+    }
+};
+#pragma endregion
+
+static bool readFile(const std::string& filename, std::vector<char>& data, std::string* error) {
+    // One read of the whole file, the parser then works in place
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) {
+        if (error != nullptr) *error = "Could not open " + filename;
+        return false;
+    }
+
+    data.resize((size_t)file.tellg());
+    file.seekg(0);
+    file.read(data.data(), data.size());
+    return true;
+}
+
+static bool sameVector(Vec3 a, Vec3 b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static bool sameMaterial(const rm::RMMaterial& a, const rm::RMMaterial& b) {
+    return a.albedo.x == b.albedo.x && a.albedo.y == b.albedo.y && a.albedo.z == b.albedo.z && a.albedo.w == b.albedo.w &&
+        a.roughness == b.roughness && a.metallic == b.metallic && a.emissive == b.emissive;
+}
+
+bool rm::RMSceneText::parse(const char* data, size_t size, Description& scene, std::string* error, Stats* stats) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    SceneParser parser(data, size, scene);
+    bool ok = parser.parse();
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    if (error != nullptr) {
+        *error = parser.error;
+    }
+
+    if (stats != nullptr) {
+        stats->bytes = size;
+        stats->statements = parser.statements;
+        stats->seconds = elapsed.count();
+        stats->megabytesPerSecond = elapsed.count() > 0 ? size / (1024.0 * 1024.0) / elapsed.count() : 0;
+    }
+
+    return ok;
+}
+
+#pragma region Live Scene
+bool rm::RMSceneText::apply(const char* data, size_t size, std::string* error, Stats* stats) {
+    Description scene;
+    if (!parse(data, size, scene, error, stats)) {
+        return false;
+    }
+
+    unsigned int changes = update(scene);
+    if (stats != nullptr) {
+        stats->changes = changes;
+    }
+
+    return true;
+}
+
+bool rm::RMSceneText::applyFile(const std::string& filename, std::string* error, Stats* stats) {
+    std::vector<char> data;
+    if (!readFile(filename, data, error)) {
+        return false;
+    }
+
+    return apply(data.data(), data.size(), error, stats);
+}
+
+void rm::RMSceneText::removeBody(LiveShape& live) {
+    if (live.body == nullptr) {
+        return;
+    }
+
+    std::vector<VerletObject*>& bodies = VerletObject::verletObjects;
+    bodies.erase(std::remove(bodies.begin(), bodies.end(), live.body), bodies.end());
+    delete live.body;
+    live.body = nullptr;
+}
+
+unsigned int rm::RMSceneText::update(const Description& scene) {
+    unsigned int changes = 0;
+
+    // Materials are edited in place so every shape using one sees the change
+    for (const MaterialDesc& m : scene.materials) {
+        std::unique_ptr<RMMaterial>& material = materials[m.name];
+
+        if (material == nullptr) {
+            material.reset(new RMMaterial(m.material));
+            changes++;
+        }
+        else if (!sameMaterial(*material, m.material)) {
+            *material = m.material;
+            changes++;
+        }
+    }
+
+    // Shapes that are no longer in the file stop drawing and wait to be reused
+    std::unordered_set<std::string> names;
+    for (const ShapeDesc& desc : scene.shapes) {
+        names.insert(desc.name);
+    }
+
+    for (auto it = shapes.begin(); it != shapes.end();) {
+        if (names.count(it->first) != 0) {
+            it++;
+            continue;
+        }
+
+        RMShape* shape = it->second.shape;
+        shape->checkShape = false;
+        shape->operation = NoOp;
+        shape->operandIndex = -1;
+
+        removeBody(it->second);
+        unused.push_back(shape);
+        it = shapes.erase(it);
+        changes++;
+    }
+
+    // Geometry and materials
+    for (const ShapeDesc& desc : scene.shapes) {
+        LiveShape& live = shapes[desc.name];
+        bool added = live.shape == nullptr;
+
+        if (added) {
+            if (unused.empty()) {
+                live.shape = new RMShape();
+                created.push_back(live.shape);
+            }
+            else {
+                live.shape = unused.back();
+                unused.pop_back();
+            }
+        }
+
+        RMShape* shape = live.shape;
+        const ShapeDesc& old = live.desc;
+        bool changed = added;
+
+        if (added || desc.type != old.type) {
+            shape->type = desc.type;
+            changed = true;
+        }
+
+        // Bodies own their position, only an edit in the file moves them
+        if (added || !sameVector(desc.position, old.position)) {
+            shape->position = desc.position;
+            changed = true;
+
+            if (live.body != nullptr) {
+                live.body->positionCurrent = desc.position;
+                live.body->positionOld = desc.position;
+            }
+        }
+
+        if (added || !sameVector(desc.rotation, old.rotation) ||
+            !sameVector(desc.param1, old.param1) || !sameVector(desc.param2, old.param2)) {
+            shape->setRotation(desc.rotation);
+            shape->param1 = desc.param1;
+            shape->param2 = desc.param2;
+            changed = true;
+        }
+
+        if (added || desc.material != old.material) {
+            if (desc.material.empty()) {
+                shape->materialIndex = 0;
+            }
+            else {
+                shape->setMaterial(*materials[desc.material]);
+            }
+            changed = true;
+        }
+
+        if (changed) {
+            changes++;
+        }
+    }
+
+    // Operations and bodies once every shape exists
+    std::unordered_set<std::string> operands;
+    for (const ShapeDesc& desc : scene.shapes) {
+        LiveShape& live = shapes[desc.name];
+        RMShape* shape = live.shape;
+
+        int operandIndex = -1;
+        if (desc.operation != NoOp) {
+            operandIndex = shapes[desc.operand].shape->getIndex();
+            operands.insert(desc.operand);
+        }
+
+        if (shape->operation != desc.operation || shape->operandIndex != operandIndex) {
+            shape->operation = desc.operation;
+            shape->operandIndex = operandIndex;
+            changes++;
+        }
+
+        if (desc.body && live.body == nullptr) {
+            live.body = new VerletObject(shape, desc.isStatic);
+            changes++;
+        }
+        else if (!desc.body && live.body != nullptr) {
+            removeBody(live);
+            changes++;
+        }
+        else if (live.body != nullptr && live.body->isStatic != desc.isStatic) {
+            live.body->isStatic = desc.isStatic;
+            changes++;
+        }
+
+        live.desc = desc;
+    }
+
+    // Operands are only drawn through the shape using them
+    for (const ShapeDesc& desc : scene.shapes) {
+        shapes[desc.name].shape->checkShape = operands.count(desc.name) == 0;
+    }
+
+    return changes;
+}
+
+void rm::RMSceneText::draw(sf::Shader* shader) {
+    for (RMShape* shape : created) {
+        shape->draw(shader);
+    }
+}
+
+void rm::RMSceneText::getState(std::vector<RMShape::State>& out) {
+    for (RMShape* shape : created) {
+        shape->getState(out);
+    }
+}
+#pragma endregion
+
+bool rm::RMSceneText::loadFromMemory(const char* data, size_t size, std::string* error, Stats* stats) {
+    std::unique_ptr<RMSceneText> scene(new RMSceneText());
+    if (!scene->apply(data, size, error, stats)) {
+        return false;
+    }
+
+    loadedScenes.push_back(std::move(scene));
+    return true;
+}
+
+bool rm::RMSceneText::loadFromFile(const std::string& filename, std::string* error, Stats* stats) {
+    std::vector<char> data;
+    if (!readFile(filename, data, error)) {
+        return false;
+    }
+
+    return loadFromMemory(data.data(), data.size(), error, stats);
+}
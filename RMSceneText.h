@@ -0,0 +1,108 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "RMShape.h"
+
+class VerletObject;
+
+namespace rm {
+
+    /*
+    Human readable scene description
+    One statement per line, # starts a comment. Names must be defined before they are used
+    so the file is parsed in a single pass. Everything in [] is optional.
+
+        material <name> [albedo r g b a] [roughness f] [metallic f] [emissive 0|1]
+        sphere   <name> [pos x y z] [rot x y z] [radius r] [material <name>]
+        box      <name> [pos x y z] [rot x y z] [size x y z] [material <name>]
+        capsule  <name> [a x y z] [b x y z] [radius r] [material <name>]
+        plane    <name> [pos x y z] [rot x y z] [normal x y z] [offset h] [material <name>]
+        op       <shape> <union|intersection|subtract|smoothUnion|smoothIntersection|smoothSubtract> <operand>
+        body     <shape> [static]
+
+    A property a shape doesn't have (rot on a capsule) is an error, and so is a file with more shapes
+    than Marcher.frag draws (RMShape::MAX_SHAPES).
+    */
+    class RMSceneText {
+    public:
+        struct Stats {
+            size_t bytes = 0;
+            unsigned int statements = 0;
+            double seconds = 0;
+            double megabytesPerSecond = 0;
+            // Shapes, materials and bodies that were added, removed or modified
+            unsigned int changes = 0;
+        };
+
+        // What a file describes, before any RMShape exists
+        struct MaterialDesc {
+            std::string name;
+            RMMaterial material;
+        };
+
+        struct ShapeDesc {
+            std::string name;
+            int type = Invalid;
+            // Same meaning as the RMShape fields the create functions fill in
+            Vec3 position;
+            Vec3 rotation;
+            Vec3 param1;
+            Vec3 param2;
+            std::string material;
+
+            int operation = NoOp;
+            std::string operand;
+
+            bool body = false;
+            bool isStatic = false;
+        };
+
+        struct Description {
+            std::vector<MaterialDesc> materials;
+            std::vector<ShapeDesc> shapes;
+        };
+
+        static bool parse(const char* data, size_t size, Description& scene, std::string* error = nullptr, Stats* stats = nullptr);
+
+        /*
+        Makes this scene match the text, the first call creates everything and later calls only
+        touch what changed. Shapes are matched by name and keep their index, materials are edited in place
+        and bodies keep their physics state unless the file moved them.
+        Nothing changes when the text doesn't parse.
+        */
+        bool apply(const char* data, size_t size, std::string* error = nullptr, Stats* stats = nullptr);
+        bool applyFile(const std::string& filename, std::string* error = nullptr, Stats* stats = nullptr);
+
+        // Sends every shape this scene made, removed ones too so the shader stops drawing them
+        void draw(sf::Shader* shader);
+        // Same shapes as draw, for uploading from another thread (see RMSimulation)
+        void getState(std::vector<RMShape::State>& out);
+
+        // Adds the scene in the file to the current one, error receives the reason it failed
+        static bool loadFromFile(const std::string& filename, std::string* error = nullptr, Stats* stats = nullptr);
+        static bool loadFromMemory(const char* data, size_t size, std::string* error = nullptr, Stats* stats = nullptr);
+
+    private:
+        struct LiveShape {
+            RMShape* shape = nullptr;
+            VerletObject* body = nullptr;
+            // What the shape was last made from, edits are found by comparing against it
+            ShapeDesc desc;
+        };
+
+        std::unordered_map<std::string, LiveShape> shapes;
+        // Shapes keep pointers to these so they live as long as the scene
+        std::unordered_map<std::string, std::unique_ptr<RMMaterial>> materials;
+
+        // Every shape this scene made, in the order they were made
+        std::vector<RMShape*> created;
+        // Removed shapes waiting to be reused, RMShape::shapes can't have holes
+        std::vector<RMShape*> unused;
+
+        unsigned int update(const Description& scene);
+        void removeBody(LiveShape& live);
+    };
+}
@@ -0,0 +1,337 @@
+#include "RMSdfVolume.h"
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+const unsigned int rm::RMSdfVolume::BRICK = 8;
+const sf::Uint32 rm::RMSdfVolume::EMPTY = 0xFFFFFFFF;
+const sf::Uint32 rm::RMSdfVolume::SOLID = 0xFFFFFFFE;
+std::vector<rm::RMSdfVolume*> rm::RMSdfVolume::volumes;
+
+rm::RMSdfVolume::RMSdfVolume() {
+    min = Vec3(0, 0, 0);
+    max = Vec3(0, 0, 0);
+    resolution = 0;
+    band = 0;
+    blockCount = 0;
+    constantIndex = 0;
+    brickColumns = 1;
+}
+
+rm::RMSdfVolume::~RMSdfVolume() {
+    release();
+}
+
+// Distances in [-band, band] map to 0 - 255
+static sf::Uint8 encodeDistance(float d, float band) {
+    float t = std::min(std::max(d / band, -1.f), 1.f) * 0.5f + 0.5f;
+    return (sf::Uint8)(t * 255.f + 0.5f);
+}
+
+static float decodeDistance(float value, float band) {
+    return (value / 255.f * 2.f - 1.f) * band;
+}
+
+#pragma region Baking
+bool rm::RMSdfVolume::bake(const std::vector<RMShape*>& shapes, unsigned int resolution, float bandVoxels, unsigned int threads) {
+    if (shapes.empty()) {
+        return false;
+    }
+
+    Vec3 low(FLT_MAX, FLT_MAX, FLT_MAX);
+    Vec3 high(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    for (RMShape* s : shapes) {
+        Vec4 b = s->getBounds();
+        if (b.w < 0.f) {
+            return false;
+        }
+
+        low = VectorHelper::vectorMin(low, Vec3(b.x - b.w, b.y - b.w, b.z - b.w));
+        high = VectorHelper::vectorMax(high, Vec3(b.x + b.w, b.y + b.w, b.z + b.w));
+    }
+
+    // Room for the band outside the surfaces
+    float size = std::max(high.x - low.x, std::max(high.y - low.y, high.z - low.z));
+    float usable = std::max((float)resolution - 1.f - 2.f * bandVoxels, 1.f);
+    float padding = size / usable * bandVoxels;
+
+    return bake(shapes, low - Vec3(padding, padding, padding), high + Vec3(padding, padding, padding), resolution, bandVoxels, threads);
+}
+
+bool rm::RMSdfVolume::bake(const std::vector<RMShape*>& shapes, Vec3 min, Vec3 max, unsigned int resolution, float bandVoxels, unsigned int threads) {
+    if (shapes.empty() || max.x <= min.x || max.y <= min.y || max.z <= min.z) {
+        return false;
+    }
+
+    // Marcher.frag has one set of volume uniforms
+    for (RMSdfVolume* volume : volumes) {
+        if (volume != this) {
+            return false;
+        }
+    }
+
+    for (RMShape* s : shapes) {
+        // Marcher.frag reads the index from one byte
+        if (s->getBounds().w < 0.f || s->getIndex() > 255) {
+            return false;
+        }
+    }
+
+    release();
+
+    this->shapes = shapes;
+    this->min = min;
+    this->max = max;
+    this->resolution = std::max(resolution, 2u);
+
+    const unsigned int n = this->resolution;
+    Vec3 voxel = (max - min) / (float)(n - 1);
+    band = bandVoxels * std::max(voxel.x, std::max(voxel.y, voxel.z));
+
+    // The last block can reach past the grid, those samples are never read
+    blockCount = (n - 1 + BRICK - 1) / BRICK;
+    blocks.assign((size_t)blockCount * blockCount * blockCount, EMPTY);
+    constantIndex = (sf::Uint8)shapes.front()->getIndex();
+    distances.clear();
+    shapeIndices.clear();
+
+    const size_t samples = BRICK + 1;
+    const size_t brickSize = samples * samples * samples;
+    const sf::Uint8 outside = encodeDistance(band, band);
+    const sf::Uint8 inside = encodeDistance(-band, band);
+
+    // Blocks are shared between the threads, each only checks the shapes that can matter in it
+    std::mutex bricksMutex;
+    std::atomic<size_t> nextBlock(0);
+    auto work = [&]() {
+        std::vector<RMShape*> region;
+        std::vector<float> xs(brickSize), ys(brickSize), zs(brickSize), d(brickSize);
+        std::vector<int> index(brickSize);
+        std::vector<sf::Uint8> brickDistances(brickSize), brickIndices(brickSize);
+        size_t b;
+        while ((b = nextBlock++) < blocks.size()) {
+            unsigned int x0 = b % blockCount * BRICK, y0 = b / blockCount % blockCount * BRICK, z0 = b / blockCount / blockCount * BRICK;
+
+            Vec3 low = min + Vec3(voxel.x * x0, voxel.y * y0, voxel.z * z0);
+            Vec3 high = low + voxel * (float)BRICK;
+            RMShape::pruneShapes(shapes, low, high, region, band);
+
+            // Nothing reaches the band anywhere in the block
+            if (region.empty()) {
+                continue;
+            }
+
+            // The whole brick is one batch, nothing within the band gives band
+            size_t i = 0;
+            for (unsigned int z = z0; z < z0 + samples; z++) {
+                for (unsigned int y = y0; y < y0 + samples; y++) {
+                    for (unsigned int x = x0; x < x0 + samples; x++, i++) {
+                        xs[i] = min.x + voxel.x * x;
+                        ys[i] = min.y + voxel.y * y;
+                        zs[i] = min.z + voxel.z * z;
+                    }
+                }
+            }
+            RMShape::getDistances(region, xs.data(), ys.data(), zs.data(), brickSize, d.data(), index.data(), band);
+
+            bool constant = true;
+            for (i = 0; i < brickSize; i++) {
+                brickDistances[i] = encodeDistance(d[i], band);
+                brickIndices[i] = (sf::Uint8)(index[i] < 0 ? constantIndex : index[i]);
+                constant = constant && brickDistances[i] == brickDistances[0];
+            }
+
+            // All outside or all inside the band samples the same without a brick
+            if (constant && (brickDistances[0] == outside || brickDistances[0] == inside)) {
+                blocks[b] = brickDistances[0] == outside ? EMPTY : SOLID;
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(bricksMutex);
+            blocks[b] = (sf::Uint32)(distances.size() / brickSize);
+            distances.insert(distances.end(), brickDistances.begin(), brickDistances.end());
+            shapeIndices.insert(shapeIndices.end(), brickIndices.begin(), brickIndices.end());
+        }
+    };
+
+    unsigned int threadCount = threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<std::thread> pool;
+    for (unsigned int i = 1; i < threadCount; i++) {
+        pool.emplace_back(work);
+    }
+    work();
+    for (std::thread& t : pool) {
+        t.join();
+    }
+
+    // The grid takes over from the shapes and whatever they operate on
+    for (RMShape* s : shapes) {
+        for (RMShape* part = s; part != nullptr; part = part->operandIndex < 0 ? nullptr : RMShape::shapes[part->operandIndex]) {
+            part->baked = true;
+            part->inVolume = true;
+        }
+    }
+
+    volumes.push_back(this);
+    return true;
+}
+
+void rm::RMSdfVolume::release() {
+    for (RMShape* s : shapes) {
+        for (RMShape* part = s; part != nullptr; part = part->operandIndex < 0 ? nullptr : RMShape::shapes[part->operandIndex]) {
+            part->baked = false;
+            part->inVolume = false;
+        }
+    }
+
+    shapes.clear();
+    volumes.erase(std::remove(volumes.begin(), volumes.end(), this), volumes.end());
+}
+
+size_t rm::RMSdfVolume::getMemoryUsage() {
+    return blocks.size() * sizeof(sf::Uint32) + distances.size() + shapeIndices.size();
+}
+#pragma endregion
+
+#pragma region Sampling
+float rm::RMSdfVolume::sampleGrid(Vec3 g, int* shapeIndex) {
+    const unsigned int n = resolution;
+    const unsigned int samples = BRICK + 1;
+
+    // Lower corner of the cell, the last cell ends on the last sample
+    unsigned int x = std::min((unsigned int)g.x, n - 2);
+    unsigned int y = std::min((unsigned int)g.y, n - 2);
+    unsigned int z = std::min((unsigned int)g.z, n - 2);
+    float fx = g.x - x;
+    float fy = g.y - y;
+    float fz = g.z - z;
+
+    // From here on everything is relative to the block holding the cell
+    unsigned int bx = x / BRICK, by = y / BRICK, bz = z / BRICK;
+    sf::Uint32 block = blocks[((size_t)bz * blockCount + by) * blockCount + bx];
+    x -= bx * BRICK;
+    y -= by * BRICK;
+    z -= bz * BRICK;
+
+    if (block == EMPTY || block == SOLID) {
+        if (shapeIndex != nullptr) *shapeIndex = constantIndex;
+        return decodeDistance(block == EMPTY ? 255.f : 0.f, band);
+    }
+
+    const size_t first = (size_t)block * samples * samples * samples;
+    if (shapeIndex != nullptr) {
+        *shapeIndex = shapeIndices[first + ((z + (fz >= 0.5f)) * samples + (y + (fy >= 0.5f))) * samples + (x + (fx >= 0.5f))];
+    }
+
+    auto at = [&](unsigned int dx, unsigned int dy, unsigned int dz) {
+        return (float)distances[first + ((z + dz) * samples + (y + dy)) * samples + (x + dx)];
+    };
+
+    float c00 = at(0, 0, 0) + (at(1, 0, 0) - at(0, 0, 0)) * fx;
+    float c10 = at(0, 1, 0) + (at(1, 1, 0) - at(0, 1, 0)) * fx;
+    float c01 = at(0, 0, 1) + (at(1, 0, 1) - at(0, 0, 1)) * fx;
+    float c11 = at(0, 1, 1) + (at(1, 1, 1) - at(0, 1, 1)) * fx;
+
+    float c0 = c00 + (c10 - c00) * fy;
+    float c1 = c01 + (c11 - c01) * fy;
+
+    return decodeDistance(c0 + (c1 - c0) * fz, band);
+}
+
+// Same as sampleVolume in Marcher.frag
+float rm::RMSdfVolume::getDistance(Vec3 p, int* shapeIndex) {
+    if (resolution == 0) {
+        return FLT_MAX;
+    }
+
+    Vec3 q = VectorHelper::vectorMin(VectorHelper::vectorMax(p, min), max);
+    float outside = VectorHelper::length(p - q);
+
+    Vec3 size = max - min;
+    float n = (float)(resolution - 1);
+    Vec3 g((q.x - min.x) / size.x * n, (q.y - min.y) / size.y * n, (q.z - min.z) / size.z * n);
+
+    float d = sampleGrid(g, shapeIndex);
+
+    // Nothing baked is outside the grid so the distance to it is a lower bound
+    return outside > 0.f ? std::max(outside, d - outside) : d;
+}
+#pragma endregion
+
+#pragma region Shader
+bool rm::RMSdfVolume::upload() {
+    if (resolution == 0) {
+        return false;
+    }
+
+    const unsigned int samples = BRICK + 1;
+    const size_t brickCount = distances.size() / (samples * samples * samples);
+
+    // One texel per block at (x + z * blockCount, y), a = 255 for a brick with its index in rgb,
+    // otherwise r is the distance of the whole block and g its shape
+    sf::Image table;
+    table.create(blockCount * blockCount, blockCount);
+
+    for (unsigned int z = 0; z < blockCount; z++) {
+        for (unsigned int y = 0; y < blockCount; y++) {
+            for (unsigned int x = 0; x < blockCount; x++) {
+                sf::Uint32 block = blocks[((size_t)z * blockCount + y) * blockCount + x];
+                sf::Color texel(block & 255, (block >> 8) & 255, (block >> 16) & 255, 255);
+                if (block == EMPTY || block == SOLID) {
+                    texel = sf::Color(block == EMPTY ? 255 : 0, constantIndex, 0, 0);
+                }
+                table.setPixel(x + z * blockCount, y, texel);
+            }
+        }
+    }
+
+    // Each brick is its z slices side by side, with about as many rows of bricks as there are columns
+    brickColumns = std::max((unsigned int)ceilf(sqrtf((float)brickCount / samples)), 1u);
+    unsigned int rows = std::max((unsigned int)((brickCount + brickColumns - 1) / brickColumns), 1u);
+
+    sf::Image atlas;
+    atlas.create(brickColumns * samples * samples, rows * samples, sf::Color::Black);
+
+    size_t i = 0;
+    for (size_t b = 0; b < brickCount; b++) {
+        unsigned int ox = (unsigned int)(b % brickColumns) * samples * samples;
+        unsigned int oy = (unsigned int)(b / brickColumns) * samples;
+
+        for (unsigned int z = 0; z < samples; z++) {
+            for (unsigned int y = 0; y < samples; y++) {
+                for (unsigned int x = 0; x < samples; x++, i++) {
+                    atlas.setPixel(ox + z * samples + x, oy + y, sf::Color(distances[i], shapeIndices[i], 0, 255));
+                }
+            }
+        }
+    }
+
+    if (!blockTexture.loadFromImage(table) || !brickTexture.loadFromImage(atlas)) {
+        return false;
+    }
+
+    // Hardware bilinear within a slice, the shader blends between slices. The table is only fetched
+    blockTexture.setSmooth(false);
+    brickTexture.setSmooth(true);
+    return true;
+}
+
+void rm::RMSdfVolume::bind(sf::Shader* shader) {
+    shader->setUniform("volumeBlocks", blockTexture);
+    shader->setUniform("volumeBricks", brickTexture);
+    shader->setUniform("volumeMin", min);
+    shader->setUniform("volumeMax", max);
+    shader->setUniform("volumeResolution", (int)resolution);
+    shader->setUniform("volumeBrickColumns", (int)brickColumns);
+    shader->setUniform("volumeBand", band);
+}
+
+void rm::RMSdfVolume::unbind(sf::Shader* shader) {
+    shader->setUniform("volumeResolution", 0);
+}
+#pragma endregion
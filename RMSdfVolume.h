@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include <SFML/Graphics.hpp>
+
+#include "RMShape.h"
+
+namespace rm {
+
+    /*
+    Static shapes baked into a grid of distances
+    A baked shape stops being evaluated on its own, RMShape::getSceneDistance and Marcher.frag
+    read the grid with trilinear interpolation instead, however complex the shape's operations are.
+
+    Only a narrow band around the surfaces is stored: distances are clamped to +-band and kept as
+    one byte per voxel, next to the index of the closest shape (for its material).
+    The grid is split into blocks of BRICK cells and only blocks the band passes through get a brick,
+    the rest hold the band (outside) or minus the band (inside) for the whole block.
+    SFML has no 3D textures so the shader gets the block table and the bricks as 2D textures,
+    a sample is two bilinear fetches from neighbouring slices of one brick.
+    Marcher.frag has room for one volume, so only one can hold baked shapes at a time.
+    */
+    class RMSdfVolume {
+    private:
+        std::vector<RMShape*> shapes;
+
+        Vec3 min;
+        Vec3 max;
+        unsigned int resolution;
+        float band;
+
+        // Blocks per side and one entry per block, a brick index, EMPTY or SOLID
+        unsigned int blockCount;
+        std::vector<sf::Uint32> blocks;
+        // Shape index read from blocks without a brick
+        sf::Uint8 constantIndex;
+
+        // (BRICK + 1)^3 samples per brick so cells don't need their neighbours
+        std::vector<sf::Uint8> distances;
+        std::vector<sf::Uint8> shapeIndices;
+
+        sf::Texture blockTexture;
+        sf::Texture brickTexture;
+        // Bricks per row of brickTexture
+        unsigned int brickColumns;
+
+        static const sf::Uint32 EMPTY;
+        static const sf::Uint32 SOLID;
+
+        float sampleGrid(Vec3 g, int* shapeIndex);
+
+    public:
+        RMSdfVolume();
+        ~RMSdfVolume();
+
+        /*
+        Samples the shapes (with their operands) in a resolution^3 grid covering their bounds
+        bandVoxels is the width of the stored band in voxels, threads 0 uses every core
+        Fails for unbounded shapes (planes), those are already cheap,
+        and while another volume is baked (its shapes would vanish from Marcher.frag once this one is bound)
+        */
+        bool bake(const std::vector<RMShape*>& shapes, unsigned int resolution = 64, float bandVoxels = 8.f, unsigned int threads = 0);
+        bool bake(const std::vector<RMShape*>& shapes, Vec3 min, Vec3 max, unsigned int resolution = 64, float bandVoxels = 8.f, unsigned int threads = 0);
+
+        // Gives the shapes back to the analytic path
+        void release();
+
+        // Creates the block and brick textures, needs OpenGL
+        bool upload();
+        // Sends the textures and grid layout to Marcher.frag
+        void bind(sf::Shader* shader);
+        // Turns the volume off in Marcher.frag
+        static void unbind(sf::Shader* shader);
+
+        // Interpolated distance, shapeIndex receives the closest baked shape
+        float getDistance(Vec3 p, int* shapeIndex = nullptr);
+
+        size_t getMemoryUsage();
+
+        // Cells per block side
+        static const unsigned int BRICK;
+
+        // Every volume with baked shapes, read by RMShape::getSceneDistance
+        static std::vector<RMSdfVolume*> volumes;
+    };
+}
@@ -1,43 +1,23 @@
 #include "RMShape.h"
 
 #include "Rotations.h"
+#include "RMSdfVolume.h"
+#include "RMBrickMap.h"
+#include "RMRegionGrid.h"
+#include "RMShapeKernels.h"
 
+#include <algorithm>
 
-#pragma region Vector Math
-float rm::VectorHelper::length(Vec3 p) {
-    return sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
-}
-
-Vec3 rm::VectorHelper::vectorAbs(Vec3 p) {
-    return Vec3(abs(p.x), abs(p.y), abs(p.z));
-}
-
-Vec3 rm::VectorHelper::vectorMax(Vec3 p, Vec3 q) {
-    return Vec3(fmax(p.x, q.x), fmax(p.y, q.y), fmax(p.z, q.z));
-}
-
-Vec3 rm::VectorHelper::vectorMin(Vec3 p, Vec3 q) {
-    return Vec3(fmin(p.x, q.x), fmin(p.y, q.y), fmin(p.z, q.z));
-}
 
-float rm::VectorHelper::dot(Vec3 p, Vec3 q) {
-    return p.x * q.x + p.y * q.y + p.z * q.z;
-}
-
-float rm::VectorHelper::clamp(float val, float low, float high) {
-    return fmax(fmin(val, high), low);
-}
-
-Vec3 rm::VectorHelper::normalize(Vec3 p) {
-    p /= length(p);
-    return p;
-}
-
-#pragma endregion
 
 #pragma region Init
 const float rm::RMShape::EPSILON = 0.01f;
+const float rm::RMShape::RELAXATION = 1.6f;
+const float rm::RMShape::SMOOTHNESS = 0.2f;
+const float rm::RMShape::SMOOTH_MARGIN = 0.2f * 0.25f;
+const int rm::RMShape::MAX_SHAPES = 20;
 std::vector<rm::RMShape*> rm::RMShape::shapes;
+thread_local rm::RMShape::Counters rm::RMShape::counters;
 std::vector<rm::RMMaterial*> rm::RMShape::materials({ &defaultMat });
 
 rm::RMShape::RMShape() {
@@ -51,6 +31,8 @@ rm::RMShape::RMShape() {
     operation = rm::NoOp;
     operandIndex = -1;
     checkShape = true;
+    baked = false;
+    inVolume = false;
 
     // Keeping track of the shape
     index = rm::RMShape::shapes.size();
@@ -64,29 +46,57 @@ rm::RMShape::RMShape() {
 
 // Drawing - Sending values to shader //
 void rm::RMShape::draw(sf::Shader* shader) {
-    shader->setUniform("shapes[" + std::to_string(index) + "].position", position);
-    shader->setUniform("shapes[" + std::to_string(index) + "].rotation", rotation);
-    shader->setUniform("shapes[" + std::to_string(index) + "].param1",   param1  );
-    shader->setUniform("shapes[" + std::to_string(index) + "].param2",   param2  );
-
-    shader->setUniform("shapes[" + std::to_string(index) + "].operation",    (int)operation );
-    shader->setUniform("shapes[" + std::to_string(index) + "].operandIndex", operandIndex   );
-    shader->setUniform("shapes[" + std::to_string(index) + "].checkShape",   checkShape     );
+    std::vector<State> states;
+    getState(states);
 
-    shader->setUniform("shapes[" + std::to_string(index) + "].type", type);
-
-    // Material properties
-    shader->setUniform("shapes[" + std::to_string(index) + "].color",     materials[materialIndex]->albedo   );
-    shader->setUniform("shapes[" + std::to_string(index) + "].roughness", materials[materialIndex]->roughness);
-    shader->setUniform("shapes[" + std::to_string(index) + "].metallic",  materials[materialIndex]->metallic );
-    shader->setUniform("shapes[" + std::to_string(index) + "].emissive",  materials[materialIndex]->emissive );
+    for (const State& state : states) {
+        draw(shader, state);
+    }
+}
 
-    // Send any shapes that are now part of this shape to the shader
+void rm::RMShape::getState(std::vector<State>& out) {
+    State state;
+    state.index = index;
+    state.position = position;
+    state.rotation = rotation;
+    state.param1 = param1;
+    state.param2 = param2;
+    state.operation = operation;
+    state.operandIndex = operandIndex;
+    state.visible = checkShape && !inVolume;
+    state.type = type;
+    state.bounds = getBounds();
+    state.material = *materials[materialIndex];
+    out.push_back(state);
+
+    // Any shapes that are now part of this shape go with it
     if (operandIndex > -1) {
-        shapes.at(operandIndex)->draw(shader);
+        shapes.at(operandIndex)->getState(out);
     }
 }
 
+void rm::RMShape::draw(sf::Shader* shader, const State& state) {
+    std::string name = "shapes[" + std::to_string(state.index) + "].";
+
+    shader->setUniform(name + "position", state.position);
+    shader->setUniform(name + "rotation", state.rotation);
+    shader->setUniform(name + "param1",   state.param1  );
+    shader->setUniform(name + "param2",   state.param2  );
+
+    shader->setUniform(name + "operation",    state.operation   );
+    shader->setUniform(name + "operandIndex", state.operandIndex);
+    shader->setUniform(name + "checkShape",   state.visible     );
+
+    shader->setUniform(name + "type", state.type);
+    shader->setUniform(name + "bounds", state.bounds);
+
+    // Material properties
+    shader->setUniform(name + "color",     state.material.albedo   );
+    shader->setUniform(name + "roughness", state.material.roughness);
+    shader->setUniform(name + "metallic",  state.material.metallic );
+    shader->setUniform(name + "emissive",  state.material.emissive );
+}
+
 // Different Shapes
 #pragma region Shape Creation
 rm::RMShape* rm::RMShape::createSphere(Vec3 pos, Vec3 rot, float r) {
@@ -170,6 +180,7 @@ void rm::RMShape::setPosition(Vec3 pos) {
 // Rotates the shape about the origin (defaults to position)
 void rm::RMShape::setRotation(Vec3 rot) {
     rotation = rot;
+    orientation = Rotation::fromEulerXYZ(rot);
 
     /*Vec3 offset = position - origin;
     position = rotateXYZ(offset, rot) + origin;*/
@@ -249,64 +260,290 @@ int rm::RMShape::getIndex() {
     return index;
 }
 
-float rm::RMShape::getSignedDistance(Vec3 p)
-{
-    float signedDistance;
-    p = inverseRotateXYZ(p - position, rotation);
+bool rm::RMShape::isVisible() {
+    return checkShape;
+}
 
-    switch (type) {
-    case rm::Invalid:
-        signedDistance = 0.f;
-        break;
+inline Vec4 rm::RMShape::getPrimitiveBounds() {
+    Vec4 bounds(position.x, position.y, position.z, -1.f);
 
+    switch (type) {
     case rm::Sphere:
-        signedDistance = VectorHelper::length(p) - param1.x;
+        bounds.w = param1.x;
         break;
 
     case rm::Box:
+        // Rotation doesn't matter since the sphere reaches the corners
+        bounds.w = VectorHelper::length(param1);
+        break;
+
+    case rm::Capsule:
     {
-        Vec3 q = Vec3(abs(p.x), abs(p.y), abs(p.z)) - param1;
-        signedDistance = VectorHelper::length(VectorHelper::vectorMax(q, Vec3(0, 0, 0))) + fmin(fmax(q.x, fmax(q.y, q.z)), 0.);
+        Vec3 center = (position + param1) / 2.f;
+        bounds = Vec4(center.x, center.y, center.z, VectorHelper::length(param1 - position) / 2.f + param2.x);
     }
         break;
 
-    case rm::Capsule:
+    default:
+        // Planes and anything unknown are unbounded
+        break;
+    }
+
+    return bounds;
+}
+
+Vec4 rm::RMShape::getBounds() {
+    Vec4 bounds = getPrimitiveBounds();
+    if (bounds.w < 0 || operandIndex < 0 || operation == rm::NoOp) {
+        return bounds;
+    }
+
+    // Operands are evaluated on their own, without their own operation
+    Vec4 opdBounds = shapes.at(operandIndex)->getPrimitiveBounds();
+
+    switch (operation) {
+    case rm::Subtract:
+    case rm::SmoothSubtract:
+        // The result never leaves this shape
+        break;
+
+    case rm::Intersection:
+    case rm::SmoothIntersection:
+        // The result never leaves either shape so keep the smaller one
+        if (opdBounds.w >= 0 && opdBounds.w < bounds.w) {
+            bounds = opdBounds;
+        }
+        break;
+
+    case rm::Union:
+    case rm::SmoothUnion:
     {
-        Vec3 pa = p - position;
-        Vec3 ba = param1 - position;
-        float h = VectorHelper::clamp(VectorHelper::dot(pa, ba) / VectorHelper::dot(ba, ba), 0.0, 1.0);
-        signedDistance = VectorHelper::length(pa - ba * h) - param2.x;
+        if (opdBounds.w < 0) {
+            return opdBounds;
+        }
+
+        // Smallest sphere enclosing both
+        Vec3 c1(bounds.x, bounds.y, bounds.z);
+        Vec3 c2(opdBounds.x, opdBounds.y, opdBounds.z);
+        float d = VectorHelper::length(c2 - c1);
+
+        if (d + opdBounds.w <= bounds.w) {
+            break;
+        }
+
+        if (d + bounds.w <= opdBounds.w) {
+            bounds = opdBounds;
+            break;
+        }
+
+        float r = (d + bounds.w + opdBounds.w) / 2.f;
+        Vec3 c = c1 + (c2 - c1) * ((r - bounds.w) / d);
+        bounds = Vec4(c.x, c.y, c.z, r);
     }
         break;
+    }
+
+    if (operation == rm::SmoothUnion) {
+        bounds.w += SMOOTH_MARGIN;
+    }
+
+    return bounds;
+}
+
+float rm::RMShape::getBoundDistance(Vec3 p) {
+    Vec4 bounds = getBounds();
+
+    if (bounds.w < 0) {
+        return -FLT_MAX;
+    }
+
+    return VectorHelper::length(p - Vec3(bounds.x, bounds.y, bounds.z)) - bounds.w;
+}
+
+float rm::RMShape::getSignedDistance(Vec3 p)
+{
+    return sdf::Dispatch::shapeKernel<Vec3>(*this)(*this, p);
+}
+
+rm::Interval rm::RMShape::getDistanceBounds(Vec3 low, Vec3 high)
+{
+    using namespace IntervalHelper;
+
+    Interval d = getPrimitiveDistanceBounds(low, high);
+    if (operandIndex < 0 || operation == rm::NoOp) {
+        return d;
+    }
+
+    // Same operations as the kernels, the smooth ones stay within SMOOTH_MARGIN of the sharp ones
+    Interval opd = shapes.at(operandIndex)->getPrimitiveDistanceBounds(low, high);
+    switch (operation) {
+    case rm::Union:
+        return min(d, opd);
+    case rm::Intersection:
+        return max(d, opd);
+    case rm::Subtract:
+        return max(-opd, d);
+    case rm::SmoothUnion:
+        d = min(d, opd);
+        return Interval(d.lo - SMOOTH_MARGIN, d.hi);
+    case rm::SmoothIntersection:
+        d = max(d, opd);
+        return Interval(d.lo, d.hi + SMOOTH_MARGIN);
+    case rm::SmoothSubtract:
+        d = max(-opd, d);
+        return Interval(d.lo, d.hi + SMOOTH_MARGIN);
+    default:
+        return d;
+    }
+}
+
+rm::Interval rm::RMShape::getPrimitiveDistanceBounds(Vec3 low, Vec3 high)
+{
+    using namespace IntervalHelper;
+
+    // Box relative to the shape
+    Interval rel[3] = {
+        Interval(low.x - position.x, high.x - position.x),
+        Interval(low.y - position.y, high.y - position.y),
+        Interval(low.z - position.z, high.z - position.z)
+    };
+
+    switch (type) {
+    case rm::Invalid:
+        return Interval(0.f);
+
+    case rm::Sphere:
+        return sqrt(square(rel[0]) + square(rel[1]) + square(rel[2])) - param1.x;
+
+    case rm::Box:
+    {
+        // The inverse rotation is linear so each local axis is a weighted sum of the world ones
+        Vec3 columns[3] = {
+            orientation.inverseRotate(Vec3(1, 0, 0)),
+            orientation.inverseRotate(Vec3(0, 1, 0)),
+            orientation.inverseRotate(Vec3(0, 0, 1))
+        };
+        Interval local[3] = {
+            rel[0] * columns[0].x + rel[1] * columns[1].x + rel[2] * columns[2].x,
+            rel[0] * columns[0].y + rel[1] * columns[1].y + rel[2] * columns[2].y,
+            rel[0] * columns[0].z + rel[1] * columns[1].z + rel[2] * columns[2].z
+        };
+
+        Interval q[3] = { abs(local[0]) - param1.x, abs(local[1]) - param1.y, abs(local[2]) - param1.z };
+        Interval outside = sqrt(square(max(q[0], 0.f)) + square(max(q[1], 0.f)) + square(max(q[2], 0.f)));
+        Interval inside = min(max(q[0], max(q[1], q[2])), 0.f);
+        return outside + inside;
+    }
 
     case rm::Plane:
     {
-        Vec3 n = VectorHelper::normalize(param1);
-        signedDistance = VectorHelper::dot(p, n) + param2.x;
+        // dot(R^-1 (p - position), n) is dot(p - position, R n), exact for any box
+        Vec3 n = orientation.rotate(VectorHelper::normalize(param1));
+        return rel[0] * n.x + rel[1] * n.y + rel[2] * n.z + param2.x;
     }
-        break;
 
     default:
-        signedDistance = FLT_MAX;
-        break;
+    {
+        // Every other shape is 1-Lipschitz, nothing in the box is further than its half diagonal from the center
+        Vec3 center = (low + high) * 0.5f;
+        float radius = VectorHelper::length(high - low) * 0.5f;
+        float d = sdf::Dispatch::primitiveKernel<Vec3>(*this)(*this, center);
+        return Interval(d - radius, d + radius);
     }
+    }
+}
 
-    return signedDistance;
+// Same kernel as the scalar version so both give the same distances
+rm::simd::float8 rm::RMShape::getSignedDistance(const simd::vec3x8& p)
+{
+    return sdf::Dispatch::shapeKernel<simd::vec3x8>(*this)(*this, p);
 }
 
-Vec3 rm::RMShape::getNormal(Vec3 p)
+// Tetrahedral central differences - 4 taps and no center sample
+Vec3 rm::RMShape::estimateNormal(Vec3 p)
 {
-    float dist = getSignedDistance(p);
+    const float h = 0.01f * 0.5773f;
+    const Vec3 k1 = Vec3( 1, -1, -1);
+    const Vec3 k2 = Vec3(-1, -1,  1);
+    const Vec3 k3 = Vec3(-1,  1, -1);
+    const Vec3 k4 = Vec3( 1,  1,  1);
 
-    Vec3 n = Vec3(dist, dist, dist) - Vec3(
-        getSignedDistance({ p.x - 0.01f, p.y, p.z }),
-        getSignedDistance({ p.x, p.y - 0.01f, p.z }),
-        getSignedDistance({ p.x, p.y, p.z - 0.01f })
-    );
+    Vec3 n = k1 * getSignedDistance(p + k1 * h) +
+             k2 * getSignedDistance(p + k2 * h) +
+             k3 * getSignedDistance(p + k3 * h) +
+             k4 * getSignedDistance(p + k4 * h);
 
     return VectorHelper::normalize(n);
 }
 
+// Analytic gradient of the primitive SDFs, matches getNormal in Marcher.frag
+Vec3 rm::RMShape::getNormal(Vec3 p)
+{
+    if (operandIndex < 0 || operation == rm::NoOp) {
+        return getPrimitiveNormal(p);
+    }
+
+    // The surface of a union or intersection belongs to one of the two, like the Shape operateSDF returns
+    if (operation == rm::Union || operation == rm::Intersection) {
+        RMShape* opd = shapes.at(operandIndex);
+        float d = sdf::Dispatch::primitiveKernel<Vec3>(*this)(*this, p);
+        float o = sdf::Dispatch::primitiveKernel<Vec3>(*opd)(*opd, p);
+        bool own = operation == rm::Union ? d < o : d > o;
+        return own ? getPrimitiveNormal(p) : opd->getPrimitiveNormal(p);
+    }
+
+    return estimateNormal(p);
+}
+
+Vec3 rm::RMShape::getPrimitiveNormal(Vec3 p)
+{
+    Vec3 local = orientation.inverseRotate(p - position);
+
+    switch (type) {
+    case rm::Sphere:
+        return orientation.rotate(VectorHelper::normalize(local));
+
+    case rm::Box:
+    {
+        Vec3 w = VectorHelper::vectorAbs(local) - param1;
+        float g = fmax(w.x, fmax(w.y, w.z));
+        Vec3 n;
+
+        if (g > 0.f) {
+            n = VectorHelper::normalize(VectorHelper::vectorMax(w, Vec3(0, 0, 0)));
+        }
+        else {
+            // Inside the box the closest face is along the largest axis
+            n = Vec3(
+                (w.x >= w.y && w.x >= w.z) ? 1.f : 0.f,
+                (w.y >  w.x && w.y >= w.z) ? 1.f : 0.f,
+                (w.z >  w.x && w.z >  w.y) ? 1.f : 0.f
+            );
+        }
+
+        n.x = local.x < 0 ? -n.x : n.x;
+        n.y = local.y < 0 ? -n.y : n.y;
+        n.z = local.z < 0 ? -n.z : n.z;
+
+        return orientation.rotate(n);
+    }
+
+    case rm::Capsule:
+    {
+        Vec3 pa = p - position;
+        Vec3 ba = param1 - position;
+        float h = VectorHelper::clamp(VectorHelper::dot(pa, ba) / VectorHelper::dot(ba, ba), 0.0, 1.0);
+        return VectorHelper::normalize(pa - ba * h);
+    }
+
+    case rm::Plane:
+        return orientation.rotate(VectorHelper::normalize(param1));
+
+    default:
+        return estimateNormal(p);
+    }
+}
+
 rm::RMMaterial& rm::RMShape::getMaterial() {
     return *materials[materialIndex];
 }
@@ -320,30 +557,310 @@ bool rm::RMMaterial::operator!=(RMMaterial const& mat) {
     return this != &mat;
 }
 
-rm::RMShape* rm::RMShape::raymarch(Vec3 origin, Vec3 direction, float maxDistance, float maxSteps) {
+float rm::RMShape::getSceneDistance(Vec3 p, float maxDistance, RMShape** closest) {
+    counters.sceneCalls++;
+
+    if (RMRegionGrid::active != nullptr) {
+        const std::vector<RMShape*>* region = RMRegionGrid::active->getShapes(p);
+        if (region != nullptr) {
+            return getShapesDistance(*region, p, maxDistance, closest);
+        }
+    }
+
+    return getShapesDistance(shapes, p, maxDistance, closest);
+}
+
+float rm::RMShape::getShapesDistance(const std::vector<RMShape*>& list, Vec3 p, float maxDistance, RMShape** closest) {
+    float distance = maxDistance;
+    for (auto const& rmShape : list) {
+        // Hidden shapes only count through their operation, the rest can't be closer than what was already found
+        if (!rmShape->isEvaluated() || rmShape->getBoundDistance(p) > distance) {
+            continue;
+        }
+
+        float check = rmShape->getSignedDistance(p);
+        if (check < distance) {
+            distance = check;
+            if (closest != nullptr) {
+                *closest = rmShape;
+            }
+        }
+    }
+
+    for (RMSdfVolume* volume : RMSdfVolume::volumes) {
+        int index;
+        float check = volume->getDistance(p, &index);
+        if (check < distance) {
+            distance = check;
+            if (closest != nullptr) {
+                *closest = shapes[index];
+            }
+        }
+    }
+
+    for (RMBrickMap* map : RMBrickMap::maps) {
+        int index;
+        float check = map->getDistance(p, &index);
+        if (check < distance) {
+            distance = check;
+            if (closest != nullptr && index >= 0) {
+                *closest = shapes[index];
+            }
+        }
+    }
+
+    return distance;
+}
+
+// 8 points from i on, the last batch repeats its last point to fill the lanes
+static rm::simd::vec3x8 loadPoints(const float* xs, const float* ys, const float* zs, size_t i, size_t count) {
+    using rm::simd::float8;
+
+    if (i + 8 <= count) {
+        return rm::simd::vec3x8(float8::load(xs + i), float8::load(ys + i), float8::load(zs + i));
+    }
+
+    float x[8], y[8], z[8];
+    for (size_t k = 0; k < 8; k++) {
+        size_t j = std::min(i + k, count - 1);
+        x[k] = xs[j];
+        y[k] = ys[j];
+        z[k] = zs[j];
+    }
+    return rm::simd::vec3x8(float8::load(x), float8::load(y), float8::load(z));
+}
+
+// Writes the lanes that hold real points
+template <class T>
+static void storeLanes(const float* lanes, T* out, size_t i, size_t count) {
+    for (size_t k = 0; k < 8 && i + k < count; k++) {
+        out[i + k] = (T)lanes[k];
+    }
+}
+
+void rm::RMShape::getSignedDistances(const float* xs, const float* ys, const float* zs, size_t count, float* distances) {
+    float lanes[8];
+    for (size_t i = 0; i < count; i += 8) {
+        getSignedDistance(loadPoints(xs, ys, zs, i, count)).store(lanes);
+        storeLanes(lanes, distances, i, count);
+    }
+}
+
+void rm::RMShape::getSceneDistances(const float* xs, const float* ys, const float* zs, size_t count, float* distances, int* closest, float maxDistance) {
+    counters.sceneCalls += (unsigned int)count;
+
+    for (size_t i = 0; i < count; i += 8) {
+        size_t n = std::min(count - i, (size_t)8);
+
+        // The region's list when every point is in the same one, pruning is exact so all shapes give the same result otherwise
+        const std::vector<RMShape*>* list = &shapes;
+        if (RMRegionGrid::active != nullptr) {
+            const std::vector<RMShape*>* region = RMRegionGrid::active->getShapes(Vec3(xs[i], ys[i], zs[i]));
+            for (size_t k = 1; k < n && region != nullptr; k++) {
+                if (RMRegionGrid::active->getShapes(Vec3(xs[i + k], ys[i + k], zs[i + k])) != region) {
+                    region = nullptr;
+                }
+            }
+            if (region != nullptr) {
+                list = region;
+            }
+        }
+
+        getDistances(*list, xs + i, ys + i, zs + i, n, distances + i, closest == nullptr ? nullptr : closest + i, maxDistance);
+
+        if (RMSdfVolume::volumes.empty() && RMBrickMap::maps.empty()) {
+            continue;
+        }
+
+        // Grids are read one point at a time, as in getShapesDistance
+        for (size_t k = i; k < i + n; k++) {
+            Vec3 p(xs[k], ys[k], zs[k]);
+
+            for (RMSdfVolume* volume : RMSdfVolume::volumes) {
+                int index;
+                float check = volume->getDistance(p, &index);
+                if (check < distances[k]) {
+                    distances[k] = check;
+                    if (closest != nullptr) {
+                        closest[k] = index;
+                    }
+                }
+            }
+
+            for (RMBrickMap* map : RMBrickMap::maps) {
+                int index;
+                float check = map->getDistance(p, &index);
+                if (check < distances[k]) {
+                    distances[k] = check;
+                    if (closest != nullptr && index >= 0) {
+                        closest[k] = index;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void rm::RMShape::getDistances(const std::vector<RMShape*>& list, const float* xs, const float* ys, const float* zs, size_t count, float* distances, int* closest, float maxDistance) {
+    using namespace simd;
+
+    float lanes[8];
+    for (size_t i = 0; i < count; i += 8) {
+        vec3x8 p = loadPoints(xs, ys, zs, i, count);
+        float8 best(maxDistance);
+        float8 index(-1.f);
+
+        for (RMShape* rmShape : list) {
+            if (!rmShape->isEvaluated()) {
+                continue;
+            }
+
+            // Skipped when it can't be closer for any of the points
+            Vec4 bounds = rmShape->getBounds();
+            if (bounds.w >= 0.f) {
+                float8 bound = length(p - vec3x8::broadcast(bounds)) - float8(bounds.w);
+                if (all(lessThan(best, bound))) {
+                    continue;
+                }
+            }
+
+            float8 check = rmShape->getSignedDistance(p);
+            float8 closer = lessThan(check, best);
+            best = select(closer, check, best);
+            index = select(closer, float8((float)rmShape->index), index);
+        }
+
+        best.store(lanes);
+        storeLanes(lanes, distances, i, count);
+        if (closest != nullptr) {
+            index.store(lanes);
+            storeLanes(lanes, closest, i, count);
+        }
+    }
+}
+
+void rm::RMShape::pruneShapes(const std::vector<RMShape*>& from, Vec3 min, Vec3 max, std::vector<RMShape*>& out, float maxDistance) {
+    std::vector<Interval> bounds(from.size());
+
+    // No shape can matter once it is further than the furthest the closest one can be
+    float cutoff = maxDistance;
+    for (size_t i = 0; i < from.size(); i++) {
+        if (!from[i]->isEvaluated()) continue;
+
+        bounds[i] = from[i]->getDistanceBounds(min, max);
+        cutoff = fmin(cutoff, bounds[i].hi);
+    }
+
+    out.clear();
+    for (size_t i = 0; i < from.size(); i++) {
+        if (from[i]->isEvaluated() && bounds[i].lo <= cutoff) {
+            out.push_back(from[i]);
+        }
+    }
+}
+
+// Over-relaxed sphere tracing (Keinert et al. 2014), same as RayMarch in Marcher.frag
+rm::RMShape* rm::RMShape::raymarch(Vec3 origin, Vec3 direction, float maxDistance, float maxSteps, int* stepCount, float pixelCone, float* hitDistance) {
     float totalDistance = 0.f;
     RMShape* closest = nullptr;
-    for (int i = 0; i < maxSteps; i++) {
+
+    float omega = RELAXATION;
+    float prevRadius = 0.f;
+    float stepLength = 0.f;
+
+    int i;
+    for (i = 0; i < maxSteps; i++) {
         Vec3 pos = origin + direction * totalDistance;
-        float distance = maxDistance;
-        for (auto const& rmShape : shapes) {
-            float check = rmShape->getSignedDistance(pos);
-            if (check < distance) {
-                distance = check;
-                closest = rmShape;
-            }
+        float distance = getSceneDistance(pos, maxDistance, &closest);
+
+        // The last two unbounding spheres don't overlap so a surface may have been skipped
+        // Go back to the last safe point and continue with plain sphere tracing
+        float radius = abs(distance);
+        if (omega > 1.f && radius + prevRadius < stepLength) {
+            totalDistance += prevRadius - stepLength;
+            stepLength = prevRadius;
+            omega = 1.f;
+            continue;
         }
 
-        if (distance < EPSILON) {
-            return closest;
+        // A hit is close to the surface from either side, a relaxed step can land inside it
+        if (radius < std::fmax(EPSILON, totalDistance * pixelCone)) {
+            break;
         }
 
-        totalDistance += distance;
+        stepLength = distance * omega;
+        prevRadius = distance;
+        totalDistance += stepLength;
 
         if (totalDistance > maxDistance) {
-            return nullptr;
+            closest = nullptr;
+            break;
         }
     }
 
-    return nullptr;
+    if (stepCount != nullptr) {
+        *stepCount = i;
+    }
+
+    if (hitDistance != nullptr) {
+        *hitDistance = totalDistance;
+    }
+
+    if (i == maxSteps) {
+        return nullptr;
+    }
+
+    return closest;
+}
+
+// Penumbra estimation soft shadows (improved technique by Inigo Quilez), same as lightMarch in Marcher.frag
+float rm::RMShape::softShadow(Vec3 origin, Vec3 direction, float maxDistance, float k, int maxSteps) {
+    float totalDistance = 0.f;
+    float res = 1.f;
+
+    float omega = RELAXATION;
+    float prevRadius = 0.f;
+    float stepLength = 0.f;
+
+    for (int i = 0; i < maxSteps && totalDistance < maxDistance; i++) {
+        counters.shadowSteps++;
+        float distance = getSceneDistance(origin + direction * totalDistance, maxDistance);
+
+        // Overshot, see raymarch
+        if (omega > 1.f && abs(distance) + prevRadius < stepLength) {
+            totalDistance += prevRadius - stepLength;
+            stepLength = prevRadius;
+            omega = 1.f;
+            continue;
+        }
+
+        if (distance < EPSILON) {
+            return 0.f;
+        }
+
+        // The closest point to the occluder is where the last two spheres intersect
+        // When they don't (one contains the other) fall back to the plain estimate
+        float y = 0.f;
+        if (stepLength > 0.f) {
+            y = (stepLength * stepLength + distance * distance - prevRadius * prevRadius) / (2.f * stepLength);
+        }
+
+        if (y > 0.f && y < distance && totalDistance - y > EPSILON) {
+            res = fmin(res, k * sqrtf(distance * distance - y * y) / (totalDistance - y));
+        }
+        else {
+            res = fmin(res, k * distance / fmax(EPSILON, totalDistance));
+        }
+
+        // Fully in the penumbra, nothing further along can make it darker
+        if (res < EPSILON) {
+            return 0.f;
+        }
+
+        stepLength = distance * omega;
+        prevRadius = distance;
+        totalDistance += stepLength;
+    }
+
+    return res;
 }
@@ -1,27 +1,47 @@
 #pragma once
 #include <vector>
+#include <cfloat>
+#include <cmath>
 #include <SFML/Graphics.hpp>
 
 using namespace sf::Glsl;
 
 #include "RMEnums.h"
+#include "RMInterval.h"
+#include "Rotations.h"
 
 namespace rm {
 
+    // Inline so the SDFs can be optimised through them, RMSimd.h has the same for many points at once
     namespace VectorHelper {
-        float length(Vec3 p);
-
-        Vec3 vectorAbs(Vec3 p);
-
-        Vec3 vectorMax(Vec3 p, Vec3 q);
-
-        Vec3 vectorMin(Vec3 p, Vec3 q);
-
-        float dot(Vec3 p, Vec3 q);
-
-        float clamp(float val, float low, float high);
-
-        Vec3 normalize(Vec3 p);
+        inline float length(Vec3 p) {
+            return sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+        }
+
+        inline Vec3 vectorAbs(Vec3 p) {
+            return Vec3(fabs(p.x), fabs(p.y), fabs(p.z));
+        }
+
+        inline Vec3 vectorMax(Vec3 p, Vec3 q) {
+            return Vec3(fmax(p.x, q.x), fmax(p.y, q.y), fmax(p.z, q.z));
+        }
+
+        inline Vec3 vectorMin(Vec3 p, Vec3 q) {
+            return Vec3(fmin(p.x, q.x), fmin(p.y, q.y), fmin(p.z, q.z));
+        }
+
+        inline float dot(Vec3 p, Vec3 q) {
+            return p.x * q.x + p.y * q.y + p.z * q.z;
+        }
+
+        inline float clamp(float val, float low, float high) {
+            return fmax(fmin(val, high), low);
+        }
+
+        inline Vec3 normalize(Vec3 p) {
+            p /= length(p);
+            return p;
+        }
     }
 
     struct RMMaterial {
@@ -36,10 +56,29 @@ namespace rm {
 
     static RMMaterial defaultMat;
 
+    class RMSceneFile;
+    class RMSceneText;
+    class RMSdfVolume;
+    class RMBrickMap;
+
+    namespace sdf {
+        template <int Type> struct Primitive;
+        struct Dispatch;
+    }
+
     class RMShape {
     private:
+        friend class RMSceneFile;
+        friend class RMSceneText;
+        friend class RMSdfVolume;
+        friend class RMBrickMap;
+        template <int Type> friend struct sdf::Primitive;
+        friend struct sdf::Dispatch;
+
         Vec3 position;
         Vec3 rotation;
+        // rotation as a matrix for the CPU SDFs, setRotation keeps it in sync
+        Rotation orientation;
         Vec3 param1;
         Vec3 param2;
         Vec3 origin;
@@ -48,6 +87,10 @@ namespace rm {
         int operation;
         int operandIndex;
         bool checkShape;
+        // Evaluated through an RMSdfVolume or RMBrickMap instead
+        bool baked;
+        // Drawn from the RMSdfVolume in Marcher.frag instead, brick maps are CPU only so the shader still needs their shapes
+        bool inVolume;
 
         // Shape type and index
         int index;
@@ -57,10 +100,37 @@ namespace rm {
         void setType(ShapeType t);
         void setOperation(Operation t, RMShape* opd);
 
+        // getBounds, getDistanceBounds and getNormal of the shape without its operation
+        Vec4 getPrimitiveBounds();
+        Interval getPrimitiveDistanceBounds(Vec3 min, Vec3 max);
+        Vec3 getPrimitiveNormal(Vec3 p);
+
+        // Whether the scene evaluation sees this shape, like the checks at the top of SceneSDF in Marcher.frag
+        // Operands are hidden and only count through the shape operating on them
+        bool isEvaluated() const { return checkShape && !baked && type != rm::Invalid; }
+
     public:
+        // What draw sends to Marcher.frag for one shape, a copy that can be uploaded while the shape changes
+        struct State {
+            int index;
+            Vec3 position;
+            Vec3 rotation;
+            Vec3 param1;
+            Vec3 param2;
+            int operation;
+            int operandIndex;
+            bool visible;
+            int type;
+            Vec4 bounds;
+            RMMaterial material;
+        };
+
         RMShape();
 
         void draw(sf::Shader* shader);
+        // Appends this shape's state and then its operand's, the same shapes draw sends
+        void getState(std::vector<State>& out);
+        static void draw(sf::Shader* shader, const State& state);
 
         void setPosition(Vec3 pos);
         void setRotation(Vec3 pos);
@@ -85,10 +155,27 @@ namespace rm {
         Vec3 getParam2();
         rm::ShapeType getType();
         int getIndex();
+        bool isVisible();
         RMMaterial& getMaterial();
 
+        // Conservative bounding sphere including any operand
+        // xyz is the center and w the radius (negative when unbounded)
+        Vec4 getBounds();
+        // Cheap lower bound of getSignedDistance
+        float getBoundDistance(Vec3 p);
+
+        // Distance with the operation applied like operateSDF in Marcher.frag (see RMShapeKernels.h)
         float getSignedDistance(Vec3 p);
+        // Same for 8 points at once, the kernel is picked once for all of them
+        simd::float8 getSignedDistance(const simd::vec3x8& p);
+        // Same for count points given one array per axis
+        void getSignedDistances(const float* xs, const float* ys, const float* zs, size_t count, float* distances);
+        // Range getSignedDistance can return for points in the box from min to max
+        Interval getDistanceBounds(Vec3 min, Vec3 max);
+        // Analytic gradient for primitives, unions and intersections, estimateNormal otherwise
         Vec3 getNormal(Vec3 p);
+        // Samples the SDF around p to approximate the normal
+        Vec3 estimateNormal(Vec3 p);
 
         static std::vector<RMShape*> shapes;
         static std::vector<RMMaterial*> materials;
@@ -99,12 +186,64 @@ namespace rm {
         // Infinite plane defined by its normal vector, n and offset from the origin, h
         static RMShape* createPlane(Vec3 pos, Vec3 rot, Vec3 n, float h);
 
+        /*
+        Distance from p to the closest shape (up to maxDistance), closest receives that shape
+        Matches SceneSDF in Marcher.frag: hidden shapes (operands) are skipped and every other shape
+        is evaluated with its operation, closest is the shape operating rather than its operand
+        Reads the pruned lists of RMRegionGrid::active when p is inside it
+        */
+        static float getSceneDistance(Vec3 p, float maxDistance, RMShape** closest = nullptr);
+        // Same for a list of shapes, baked volumes and brick maps are always included
+        static float getShapesDistance(const std::vector<RMShape*>& list, Vec3 p, float maxDistance, RMShape** closest = nullptr);
+
+        /*
+        Batched getSceneDistance for count points given one array per axis, 8 points go through each shape at once
+        closest receives the index of the closest shape for each point (-1 when nothing is within maxDistance)
+        Gives the same results as calling getSceneDistance for every point
+        */
+        static void getSceneDistances(const float* xs, const float* ys, const float* zs, size_t count, float* distances, int* closest = nullptr, float maxDistance = FLT_MAX);
+        // Only the shapes in list, without volumes and brick maps (for the bakers)
+        static void getDistances(const std::vector<RMShape*>& list, const float* xs, const float* ys, const float* zs, size_t count, float* distances, int* closest = nullptr, float maxDistance = FLT_MAX);
+
+        /*
+        Keeps the shapes that can be the closest somewhere in the box from min to max (and within maxDistance)
+        For any point in the box getShapesDistance over out gives the same result as over from
+        */
+        static void pruneShapes(const std::vector<RMShape*>& from, Vec3 min, Vec3 max, std::vector<RMShape*>& out, float maxDistance = FLT_MAX);
+
         /*
         Emulates a raycast from typical renderers.
         If EPSILON isn't low enough then it may not work
+        Uses over-relaxed sphere tracing, stepCount receives the number of steps taken
+        pixelCone is the radius of a pixel's cone at a distance of 1 which
+        grows the hit threshold with distance (0 to always use EPSILON)
+        hitDistance receives how far along direction the ray stopped
+        */
+        static RMShape* raymarch(Vec3 origin, Vec3 direction, float maxDistance = 100, float maxSteps = 50, int* stepCount = nullptr, float pixelCone = 0.f, float* hitDistance = nullptr);
+
+        /*
+        CPU version of lightMarch in Marcher.frag
+        Returns 0 when something blocks the ray before maxDistance and 1 when nothing is near it,
+        k controls the softness of the penumbra
         */
-        static RMShape* raymarch(Vec3 origin, Vec3 direction, float maxDistance = 100, float maxSteps = 50);
+        static float softShadow(Vec3 origin, Vec3 direction, float maxDistance, float k, int maxSteps = 64);
+
+        // Work done on the calling thread so far, the offline renderer takes the difference over a pixel for RMMarchStats
+        struct Counters {
+            // Points getSceneDistance and getSceneDistances were asked for (SceneSDF calls in Marcher.frag)
+            unsigned int sceneCalls = 0;
+            unsigned int shadowSteps = 0;
+        };
+        static thread_local Counters counters;
 
         static const float EPSILON;
+        // Over-relaxation factor for raymarch (1 = plain sphere tracing)
+        static const float RELAXATION;
+        // Blend distance of the smooth operations (k in Marcher.frag)
+        static const float SMOOTHNESS;
+        // Largest amount the smooth operations pull the surface outward (k / 4 in Marcher.frag)
+        static const float SMOOTH_MARGIN;
+        // Size of the shapes array in Marcher.frag, shapes past it aren't drawn
+        static const int MAX_SHAPES;
     };
 }
\ No newline at end of file
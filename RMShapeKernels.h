@@ -0,0 +1,200 @@
+#pragma once
+#include <cmath>
+
+#include "RMShape.h"
+#include "RMSimd.h"
+
+namespace rm {
+
+    /*
+    Distance kernels instantiated for every ShapeType and Operation
+    Each kernel is a template over the point type, Vec3 for one point and simd::vec3x8 for 8 at once,
+    so the scalar and batched SDFs are the same code. The type and operation are template arguments so
+    every case is inlined into straight line code and the switch happens once when the kernel is picked
+    (once per batch for vec3x8) instead of once per point.
+    Operations follow operateSDF in Marcher.frag: the operand is evaluated as a primitive
+    and combined with the shape's own distance, smooth variants blend over RMShape::SMOOTHNESS.
+    */
+    namespace sdf {
+
+#pragma region Scalar helpers
+        // Scalar twins of the RMSimd.h functions so one kernel serves both point types
+        inline float length(Vec3 p) { return VectorHelper::length(p); }
+        inline float dot(Vec3 a, Vec3 b) { return VectorHelper::dot(a, b); }
+        inline Vec3 abs(Vec3 p) { return VectorHelper::vectorAbs(p); }
+        inline float min(float a, float b) { return std::fmin(a, b); }
+        inline float max(float a, float b) { return std::fmax(a, b); }
+        inline Vec3 max(Vec3 p, float b) { return VectorHelper::vectorMax(p, Vec3(b, b, b)); }
+        inline float clamp(float v, float low, float high) { return VectorHelper::clamp(v, low, high); }
+
+        using simd::length;
+        using simd::dot;
+        using simd::abs;
+        using simd::min;
+        using simd::max;
+        using simd::clamp;
+
+        // Distances for V: float for a Vec3, float8 for a vec3x8
+        template <class V> struct Lanes { typedef float type; };
+        template <> struct Lanes<simd::vec3x8> { typedef simd::float8 type; };
+
+        // The same vector for every point of V
+        template <class V> inline V splat(Vec3 v) { return v; }
+        template <> inline simd::vec3x8 splat<simd::vec3x8>(Vec3 v) { return simd::vec3x8::broadcast(v); }
+#pragma endregion
+
+#pragma region Primitives
+        // Anything unknown is never hit
+        template <int Type>
+        struct Primitive {
+            template <class V> static typename Lanes<V>::type distance(const RMShape&, const V&) {
+                return typename Lanes<V>::type(FLT_MAX);
+            }
+        };
+
+        template <>
+        struct Primitive<Invalid> {
+            template <class V> static typename Lanes<V>::type distance(const RMShape&, const V&) {
+                return typename Lanes<V>::type(0.f);
+            }
+        };
+
+        template <>
+        struct Primitive<Sphere> {
+            template <class V> static typename Lanes<V>::type distance(const RMShape& s, const V& p) {
+                typedef typename Lanes<V>::type F;
+                return length(s.orientation.inverseRotate(p - splat<V>(s.position))) - F(s.param1.x);
+            }
+        };
+
+        template <>
+        struct Primitive<Box> {
+            template <class V> static typename Lanes<V>::type distance(const RMShape& s, const V& p) {
+                typedef typename Lanes<V>::type F;
+                V q = abs(s.orientation.inverseRotate(p - splat<V>(s.position))) - splat<V>(s.param1);
+                return length(max(q, F(0.f))) + min(max(q.x, max(q.y, q.z)), F(0.f));
+            }
+        };
+
+        // Capsules are defined by two world space points
+        template <>
+        struct Primitive<Capsule> {
+            template <class V> static typename Lanes<V>::type distance(const RMShape& s, const V& p) {
+                typedef typename Lanes<V>::type F;
+                V pa = p - splat<V>(s.position);
+                Vec3 ba = s.param1 - s.position;
+                F h = clamp(dot(pa, splat<V>(ba)) / F(VectorHelper::dot(ba, ba)), F(0.f), F(1.f));
+                return length(pa - splat<V>(ba) * h) - F(s.param2.x);
+            }
+        };
+
+        template <>
+        struct Primitive<Plane> {
+            template <class V> static typename Lanes<V>::type distance(const RMShape& s, const V& p) {
+                typedef typename Lanes<V>::type F;
+                V local = s.orientation.inverseRotate(p - splat<V>(s.position));
+                return dot(local, splat<V>(VectorHelper::normalize(s.param1))) + F(s.param2.x);
+            }
+        };
+#pragma endregion
+
+#pragma region Operations
+        // smoothMin and smoothMax in Marcher.frag
+        template <class F> inline F smoothMin(F a, F b) {
+            F k(RMShape::SMOOTHNESS);
+            F h = clamp(F(0.5f) + F(0.5f) * (b - a) / k, F(0.f), F(1.f));
+            return b * (F(1.f) - h) + a * h - k * h * (F(1.f) - h);
+        }
+
+        template <class F> inline F smoothMax(F a, F b) {
+            F k(RMShape::SMOOTHNESS);
+            F h = clamp(F(0.5f) - F(0.5f) * (b - a) / k, F(0.f), F(1.f));
+            return b * (F(1.f) - h) + a * h + k * h * (F(1.f) - h);
+        }
+
+        // d is the shape's own distance and operand its operand's
+        template <int Op> struct Operator {
+            template <class F> static F apply(F d, F) { return d; }
+        };
+
+        template <> struct Operator<Union> {
+            template <class F> static F apply(F d, F operand) { return min(d, operand); }
+        };
+
+        template <> struct Operator<Intersection> {
+            template <class F> static F apply(F d, F operand) { return max(d, operand); }
+        };
+
+        // The operand is cut out of the shape
+        template <> struct Operator<Subtract> {
+            template <class F> static F apply(F d, F operand) { return max(-operand, d); }
+        };
+
+        template <> struct Operator<SmoothUnion> {
+            template <class F> static F apply(F d, F operand) { return smoothMin(d, operand); }
+        };
+
+        template <> struct Operator<SmoothIntersection> {
+            template <class F> static F apply(F d, F operand) { return smoothMax(d, operand); }
+        };
+
+        template <> struct Operator<SmoothSubtract> {
+            template <class F> static F apply(F d, F operand) { return smoothMax(-operand, d); }
+        };
+#pragma endregion
+
+#pragma region Dispatch
+        struct Dispatch {
+            template <class V> using Kernel = typename Lanes<V>::type(*)(const RMShape&, const V&);
+
+            template <int Type, class V>
+            static typename Lanes<V>::type primitive(const RMShape& s, const V& p) {
+                return Primitive<Type>::distance(s, p);
+            }
+
+            template <int Type, int Op, class V>
+            static typename Lanes<V>::type shape(const RMShape& s, const V& p) {
+                typename Lanes<V>::type d = Primitive<Type>::distance(s, p);
+                if (Op == NoOp) {
+                    return d;
+                }
+
+                const RMShape& operand = *RMShape::shapes[s.operandIndex];
+                return Operator<Op>::apply(d, primitiveKernel<V>(operand)(operand, p));
+            }
+
+            // The shape on its own, ignoring its operation
+            template <class V>
+            static Kernel<V> primitiveKernel(const RMShape& s) {
+                static const Kernel<V> kernels[] = {
+                    &primitive<Invalid, V>, &primitive<Sphere, V>, &primitive<Box, V>, &primitive<Capsule, V>, &primitive<Plane, V>
+                };
+
+                if (s.type < Invalid || s.type > Plane) {
+                    return &primitive<-1, V>;
+                }
+                return kernels[s.type];
+            }
+
+            // The shape with its operation applied
+            template <class V>
+            static Kernel<V> shapeKernel(const RMShape& s) {
+#define RM_SDF_KERNELS(T) { &shape<T, NoOp, V>, &shape<T, Union, V>, &shape<T, Intersection, V>, &shape<T, Subtract, V>, \
+                            &shape<T, SmoothUnion, V>, &shape<T, SmoothIntersection, V>, &shape<T, SmoothSubtract, V> }
+                static const Kernel<V> kernels[][SmoothSubtract + 1] = {
+                    RM_SDF_KERNELS(Invalid), RM_SDF_KERNELS(Sphere), RM_SDF_KERNELS(Box), RM_SDF_KERNELS(Capsule), RM_SDF_KERNELS(Plane)
+                };
+#undef RM_SDF_KERNELS
+
+                if (s.operandIndex < 0 || s.operation <= NoOp || s.operation > SmoothSubtract) {
+                    return primitiveKernel<V>(s);
+                }
+                if (s.type < Invalid || s.type > Plane) {
+                    return &primitive<-1, V>;
+                }
+                return kernels[s.type][s.operation];
+            }
+        };
+#pragma endregion
+    }
+}
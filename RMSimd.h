@@ -0,0 +1,189 @@
+#pragma once
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RM_SIMD_AVX
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RM_SIMD_SSE
+#endif
+
+namespace rm {
+
+    /*
+    Vector math for many points at once
+    A float4 or float8 holds the same value for 4 or 8 points and a vec3x4/vec3x8 is 3 of those,
+    one per axis, so every operation works on all the points with one instruction.
+    SSE2 is the baseline, float8 uses AVX registers when the compiler targets AVX (/arch:AVX2, -mavx2)
+    and two SSE halves otherwise. Without SSE everything falls back to plain loops.
+
+    The operations match the scalar ones in VectorHelper (min and max are fmin and fmax for anything
+    but NaNs) so a batch gives the same results as evaluating the points one by one.
+    */
+    namespace simd {
+
+#pragma region float4
+        struct float4 {
+#ifdef RM_SIMD_SSE
+            __m128 v;
+
+            float4() : v(_mm_setzero_ps()) {}
+            float4(__m128 v) : v(v) {}
+            float4(float s) : v(_mm_set1_ps(s)) {}
+
+            static float4 load(const float* p) { return _mm_loadu_ps(p); }
+            void store(float* p) const { _mm_storeu_ps(p, v); }
+#else
+            float v[4];
+
+            float4() : v{ 0, 0, 0, 0 } {}
+            float4(float s) : v{ s, s, s, s } {}
+
+            static float4 load(const float* p) { float4 r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+            void store(float* p) const { for (int i = 0; i < 4; i++) p[i] = v[i]; }
+#endif
+        };
+
+#ifdef RM_SIMD_SSE
+        inline float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+        inline float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+        inline float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+        inline float4 operator/(float4 a, float4 b) { return _mm_div_ps(a.v, b.v); }
+        inline float4 operator-(float4 a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.f)); }
+        inline float4 min(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+        inline float4 max(float4 a, float4 b) { return _mm_max_ps(a.v, b.v); }
+        inline float4 abs(float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+        inline float4 sqrt(float4 a) { return _mm_sqrt_ps(a.v); }
+
+        // Masks have every bit of a lane set where the comparison holds
+        inline float4 lessThan(float4 a, float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+        inline float4 select(float4 mask, float4 a, float4 b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+        inline bool any(float4 mask) { return _mm_movemask_ps(mask.v) != 0; }
+        inline bool all(float4 mask) { return _mm_movemask_ps(mask.v) == 0xF; }
+#else
+#define RM_SIMD_LANES(expr) float4 r; for (int i = 0; i < 4; i++) r.v[i] = expr; return r;
+        inline float4 operator+(float4 a, float4 b) { RM_SIMD_LANES(a.v[i] + b.v[i]) }
+        inline float4 operator-(float4 a, float4 b) { RM_SIMD_LANES(a.v[i] - b.v[i]) }
+        inline float4 operator*(float4 a, float4 b) { RM_SIMD_LANES(a.v[i] * b.v[i]) }
+        inline float4 operator/(float4 a, float4 b) { RM_SIMD_LANES(a.v[i] / b.v[i]) }
+        inline float4 operator-(float4 a) { RM_SIMD_LANES(-a.v[i]) }
+        inline float4 min(float4 a, float4 b) { RM_SIMD_LANES(std::fmin(a.v[i], b.v[i])) }
+        inline float4 max(float4 a, float4 b) { RM_SIMD_LANES(std::fmax(a.v[i], b.v[i])) }
+        inline float4 abs(float4 a) { RM_SIMD_LANES(std::fabs(a.v[i])) }
+        inline float4 sqrt(float4 a) { RM_SIMD_LANES(std::sqrt(a.v[i])) }
+
+        // Masks are 1 where the comparison holds and 0 elsewhere
+        inline float4 lessThan(float4 a, float4 b) { RM_SIMD_LANES(a.v[i] < b.v[i] ? 1.f : 0.f) }
+        inline float4 select(float4 mask, float4 a, float4 b) { RM_SIMD_LANES(mask.v[i] != 0.f ? a.v[i] : b.v[i]) }
+        inline bool any(float4 mask) { return mask.v[0] != 0.f || mask.v[1] != 0.f || mask.v[2] != 0.f || mask.v[3] != 0.f; }
+        inline bool all(float4 mask) { return mask.v[0] != 0.f && mask.v[1] != 0.f && mask.v[2] != 0.f && mask.v[3] != 0.f; }
+#undef RM_SIMD_LANES
+#endif
+#pragma endregion
+
+#pragma region float8
+        struct float8 {
+#ifdef RM_SIMD_AVX
+            __m256 v;
+
+            float8() : v(_mm256_setzero_ps()) {}
+            float8(__m256 v) : v(v) {}
+            float8(float s) : v(_mm256_set1_ps(s)) {}
+
+            static float8 load(const float* p) { return _mm256_loadu_ps(p); }
+            void store(float* p) const { _mm256_storeu_ps(p, v); }
+#else
+            float4 lo, hi;
+
+            float8() {}
+            float8(float4 lo, float4 hi) : lo(lo), hi(hi) {}
+            float8(float s) : lo(s), hi(s) {}
+
+            static float8 load(const float* p) { return float8(float4::load(p), float4::load(p + 4)); }
+            void store(float* p) const { lo.store(p); hi.store(p + 4); }
+#endif
+        };
+
+#ifdef RM_SIMD_AVX
+        inline float8 operator+(float8 a, float8 b) { return _mm256_add_ps(a.v, b.v); }
+        inline float8 operator-(float8 a, float8 b) { return _mm256_sub_ps(a.v, b.v); }
+        inline float8 operator*(float8 a, float8 b) { return _mm256_mul_ps(a.v, b.v); }
+        inline float8 operator/(float8 a, float8 b) { return _mm256_div_ps(a.v, b.v); }
+        inline float8 operator-(float8 a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.f)); }
+        inline float8 min(float8 a, float8 b) { return _mm256_min_ps(a.v, b.v); }
+        inline float8 max(float8 a, float8 b) { return _mm256_max_ps(a.v, b.v); }
+        inline float8 abs(float8 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v); }
+        inline float8 sqrt(float8 a) { return _mm256_sqrt_ps(a.v); }
+        inline float8 lessThan(float8 a, float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+        inline float8 select(float8 mask, float8 a, float8 b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+        inline bool any(float8 mask) { return _mm256_movemask_ps(mask.v) != 0; }
+        inline bool all(float8 mask) { return _mm256_movemask_ps(mask.v) == 0xFF; }
+#else
+        inline float8 operator+(float8 a, float8 b) { return float8(a.lo + b.lo, a.hi + b.hi); }
+        inline float8 operator-(float8 a, float8 b) { return float8(a.lo - b.lo, a.hi - b.hi); }
+        inline float8 operator*(float8 a, float8 b) { return float8(a.lo * b.lo, a.hi * b.hi); }
+        inline float8 operator/(float8 a, float8 b) { return float8(a.lo / b.lo, a.hi / b.hi); }
+        inline float8 operator-(float8 a) { return float8(-a.lo, -a.hi); }
+        inline float8 min(float8 a, float8 b) { return float8(min(a.lo, b.lo), min(a.hi, b.hi)); }
+        inline float8 max(float8 a, float8 b) { return float8(max(a.lo, b.lo), max(a.hi, b.hi)); }
+        inline float8 abs(float8 a) { return float8(abs(a.lo), abs(a.hi)); }
+        inline float8 sqrt(float8 a) { return float8(sqrt(a.lo), sqrt(a.hi)); }
+        inline float8 lessThan(float8 a, float8 b) { return float8(lessThan(a.lo, b.lo), lessThan(a.hi, b.hi)); }
+        inline float8 select(float8 mask, float8 a, float8 b) { return float8(select(mask.lo, a.lo, b.lo), select(mask.hi, a.hi, b.hi)); }
+        inline bool any(float8 mask) { return any(mask.lo) || any(mask.hi); }
+        inline bool all(float8 mask) { return all(mask.lo) && all(mask.hi); }
+#endif
+#pragma endregion
+
+#pragma region Vectors
+        // Three axes of several points, F is float4 or float8
+        template <class F>
+        struct vec3w {
+            F x, y, z;
+
+            vec3w() {}
+            vec3w(F x, F y, F z) : x(x), y(y), z(z) {}
+
+            // The same vector in every lane
+            template <class V>
+            static vec3w broadcast(V v) { return vec3w(F(v.x), F(v.y), F(v.z)); }
+        };
+
+        typedef vec3w<float4> vec3x4;
+        typedef vec3w<float8> vec3x8;
+
+        template <class F> inline vec3w<F> operator+(const vec3w<F>& a, const vec3w<F>& b) { return vec3w<F>(a.x + b.x, a.y + b.y, a.z + b.z); }
+        template <class F> inline vec3w<F> operator-(const vec3w<F>& a, const vec3w<F>& b) { return vec3w<F>(a.x - b.x, a.y - b.y, a.z - b.z); }
+        template <class F> inline vec3w<F> operator*(const vec3w<F>& a, F s) { return vec3w<F>(a.x * s, a.y * s, a.z * s); }
+        template <class F> inline vec3w<F> operator-(const vec3w<F>& a) { return vec3w<F>(-a.x, -a.y, -a.z); }
+
+        template <class F> inline F dot(const vec3w<F>& a, const vec3w<F>& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+        template <class F> inline F length(const vec3w<F>& a) { return sqrt(a.x * a.x + a.y * a.y + a.z * a.z); }
+        template <class F> inline vec3w<F> abs(const vec3w<F>& a) { return vec3w<F>(abs(a.x), abs(a.y), abs(a.z)); }
+        template <class F> inline vec3w<F> max(const vec3w<F>& a, F b) { return vec3w<F>(max(a.x, b), max(a.y, b), max(a.z, b)); }
+        template <class F> inline vec3w<F> min(const vec3w<F>& a, F b) { return vec3w<F>(min(a.x, b), min(a.y, b), min(a.z, b)); }
+        template <class F> inline F clamp(F v, F low, F high) { return max(min(v, high), low); }
+
+        // Column major 3x3 matrix (like Rotation::m) times each point
+        template <class F> inline vec3w<F> multiply(const float* m, const vec3w<F>& p) {
+            return vec3w<F>(
+                p.x * F(m[0]) + p.y * F(m[3]) + p.z * F(m[6]),
+                p.x * F(m[1]) + p.y * F(m[4]) + p.z * F(m[7]),
+                p.x * F(m[2]) + p.y * F(m[5]) + p.z * F(m[8])
+            );
+        }
+
+        // Same with the transpose
+        template <class F> inline vec3w<F> multiplyTransposed(const float* m, const vec3w<F>& p) {
+            return vec3w<F>(
+                p.x * F(m[0]) + p.y * F(m[1]) + p.z * F(m[2]),
+                p.x * F(m[3]) + p.y * F(m[4]) + p.z * F(m[5]),
+                p.x * F(m[6]) + p.y * F(m[7]) + p.z * F(m[8])
+            );
+        }
+#pragma endregion
+    }
+}
@@ -0,0 +1,101 @@
+#include "RMSimulation.h"
+
+#include <chrono>
+
+#include "RMProfiler.h"
+
+void rm::RMSnapshot::draw(sf::Shader* shader) const {
+    shader->setUniform("camPosition", cameraPosition);
+    shader->setUniform("camRotation", cameraRotation);
+
+    for (const RMShape::State& state : shapes) {
+        RMShape::draw(shader, state);
+    }
+}
+
+rm::RMSimulation::RMSimulation(std::function<void(const Input&)> handle, std::function<void(float)> step, std::function<void(RMSnapshot&)> capture, float tickRate)
+    : handle(handle), step(step), capture(capture), tickRate(tickRate), running(false), ticks(0) {
+}
+
+rm::RMSimulation::~RMSimulation() {
+    stop();
+}
+
+void rm::RMSimulation::start() {
+    if (running) {
+        return;
+    }
+
+    // The first frame has something to draw before the thread gets going
+    publish();
+
+    running = true;
+    thread = std::thread(&RMSimulation::run, this);
+}
+
+void rm::RMSimulation::stop() {
+    running = false;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+bool rm::RMSimulation::send(const Input& input) {
+    return inputs.push(input);
+}
+
+bool rm::RMSimulation::send(const sf::Event& event) {
+    Input input;
+    input.event = event;
+    return send(input);
+}
+
+const rm::RMSnapshot& rm::RMSimulation::getSnapshot() {
+    snapshots.update();
+    return snapshots.front();
+}
+
+void rm::RMSimulation::publish() {
+    RMSnapshot& snapshot = snapshots.back();
+    snapshot.shapes.clear();
+    capture(snapshot);
+    snapshot.tick = ticks;
+    snapshots.publish();
+}
+
+void rm::RMSimulation::run() {
+    typedef std::chrono::steady_clock Clock;
+    RMProfiler::setThreadName("Simulation");
+    // Ticks show up in the profiler overlay next to the frame that was running at the time
+    RMProfiler::recordThread("Simulation");
+
+    const float deltaTime = 1.f / tickRate;
+    const Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(deltaTime));
+    Clock::time_point next = Clock::now();
+
+    while (running) {
+        {
+            RM_PROFILE_SCOPE("Tick");
+
+            Input input;
+            while (inputs.pop(input)) {
+                handle(input);
+            }
+
+            // Fixed steps keep physics the same however fast either thread runs
+            step(deltaTime);
+
+            ticks++;
+            RM_PROFILE_SCOPE("Snapshot");
+            publish();
+        }
+
+        // Too far behind to catch up, carry on from now instead of running ticks back to back
+        next += period;
+        Clock::time_point now = Clock::now();
+        if (now - next > period * 4) {
+            next = now;
+        }
+        std::this_thread::sleep_until(next);
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <SFML/Graphics.hpp>
+
+#include "RMShape.h"
+#include "RMTripleBuffer.h"
+#include "RMSpscQueue.h"
+
+namespace rm {
+
+    // Everything the render thread needs from one simulation tick, never changed once published
+    struct RMSnapshot {
+        Vec3 cameraPosition;
+        Vec3 cameraRotation;
+        std::vector<RMShape::State> shapes;
+        // Ticks simulated before this one was taken
+        unsigned long long tick = 0;
+
+        // Sends the camera and shapes to Marcher.frag
+        void draw(sf::Shader* shader) const;
+    };
+
+    /*
+    Runs the simulation (input, update and physics) on its own thread at a fixed tick rate
+    The shapes belong to the simulation thread while it runs. After every tick it copies what the shader
+    needs into an RMSnapshot and hands it over through a triple buffer, so the render thread draws the
+    newest finished tick without waiting and a slow physics step or a slow frame doesn't hold up the other.
+    Input goes the other way through a lock free queue and is handled at the start of the next tick.
+    */
+    class RMSimulation {
+    public:
+        struct Input {
+            enum Type {
+                Event,
+                ReloadScene
+            };
+
+            Type type = Event;
+            sf::Event event;
+        };
+
+        /*
+        All three are called on the simulation thread (capture also once from start)
+        handle gets each Input, step advances by deltaTime seconds and capture fills a snapshot
+        */
+        RMSimulation(std::function<void(const Input&)> handle, std::function<void(float)> step, std::function<void(RMSnapshot&)> capture, float tickRate = 120.f);
+        // Stops the thread
+        ~RMSimulation();
+
+        void start();
+        // Waits for the current tick, the shapes are the caller's again afterwards
+        void stop();
+
+        // Render thread only, false when the queue is full and the input was dropped
+        bool send(const Input& input);
+        bool send(const sf::Event& event);
+
+        // Render thread only, the newest snapshot (unchanged until the next call)
+        const RMSnapshot& getSnapshot();
+
+    private:
+        std::function<void(const Input&)> handle;
+        std::function<void(float)> step;
+        std::function<void(RMSnapshot&)> capture;
+        float tickRate;
+
+        std::thread thread;
+        std::atomic<bool> running;
+        unsigned long long ticks;
+
+        RMSpscQueue<Input, 1024> inputs;
+        RMTripleBuffer<RMSnapshot> snapshots;
+
+        void run();
+        void publish();
+    };
+}
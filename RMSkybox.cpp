@@ -0,0 +1,313 @@
+#include "RMSkybox.h"
+
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "RMShape.h"
+
+const float rm::RMSkybox::GAMMA = 2.5f;
+const unsigned int rm::RMSkybox::CACHE_VERSION = 2;
+
+static const float PI = 3.14159265359f;
+
+#pragma region Helpers
+// Same as octDecode in Marcher.frag (y is up)
+static Vec3 octDecode(float u, float v) {
+    float px = u * 2.f - 1.f;
+    float pz = v * 2.f - 1.f;
+    Vec3 n(px, 1.f - std::fabs(px) - std::fabs(pz), pz);
+
+    if (n.y < 0.f) {
+        float x = (1.f - std::fabs(n.z)) * (n.x >= 0.f ? 1.f : -1.f);
+        float z = (1.f - std::fabs(n.x)) * (n.z >= 0.f ? 1.f : -1.f);
+        n.x = x;
+        n.z = z;
+    }
+
+    return rm::VectorHelper::normalize(n);
+}
+
+// Same as octEncode in Marcher.frag
+static void octEncode(Vec3 n, float& u, float& v) {
+    n /= std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    u = n.x;
+    v = n.z;
+
+    if (n.y < 0.f) {
+        u = (1.f - std::fabs(n.z)) * (n.x >= 0.f ? 1.f : -1.f);
+        v = (1.f - std::fabs(n.x)) * (n.z >= 0.f ? 1.f : -1.f);
+    }
+
+    u = u * 0.5f + 0.5f;
+    v = v * 0.5f + 0.5f;
+}
+
+// Bilinear lookup of an equirectangular image using the same mapping the shader used
+// Adds the RGBA result (0 - 1) times weight to col
+static void sampleEquirect(const sf::Image& image, Vec3 d, float weight, float* col) {
+    const sf::Uint8* pixels = image.getPixelsPtr();
+    int width = image.getSize().x;
+    int height = image.getSize().y;
+
+    float u = 0.5f + atan2f(d.x, d.z) / (2.f * PI);
+    float v = 0.5f - asinf(rm::VectorHelper::clamp(d.y, -1.f, 1.f)) / PI;
+
+    float x = u * width - 0.5f;
+    float y = v * height - 0.5f;
+    int x0 = (int)floorf(x);
+    int y0 = (int)floorf(y);
+    float fx = x - x0;
+    float fy = y - y0;
+
+    for (int j = 0; j < 2; j++) {
+        // Wrap horizontally, clamp vertically
+        int row = std::min(std::max(y0 + j, 0), height - 1);
+        for (int i = 0; i < 2; i++) {
+            int column = ((x0 + i) % width + width) % width;
+            float w = (i ? fx : 1.f - fx) * (j ? fy : 1.f - fy) * weight / 255.f;
+            const sf::Uint8* p = pixels + 4 * (row * width + column);
+            for (int c = 0; c < 4; c++) {
+                col[c] += p[c] * w;
+            }
+        }
+    }
+}
+
+// Reinhard + gamma, previously done per sample in Marcher.frag
+static float tonemap(float c) {
+    return powf(c / (c + 1.f), 1.f / rm::RMSkybox::GAMMA);
+}
+
+// Real L2 spherical harmonics basis, same order as skyIrradiance in Marcher.frag
+static void shBasis(Vec3 d, float* y) {
+    y[0] = 0.282095f;
+    y[1] = 0.488603f * d.y;
+    y[2] = 0.488603f * d.z;
+    y[3] = 0.488603f * d.x;
+    y[4] = 1.092548f * d.x * d.y;
+    y[5] = 1.092548f * d.y * d.z;
+    y[6] = 0.315392f * (3.f * d.z * d.z - 1.f);
+    y[7] = 1.092548f * d.x * d.z;
+    y[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+#pragma endregion
+
+rm::RMSkybox::RMSkybox() {
+    for (int i = 0; i < 9; i++) {
+        irradiance[i] = Vec3(0, 0, 0);
+    }
+}
+
+bool rm::RMSkybox::loadFromFile(const std::string& filename, unsigned int size) {
+    return prepare(filename, size) && upload();
+}
+
+bool rm::RMSkybox::prepare(const std::string& filename, unsigned int size) {
+    // Re-exporting at the same resolution often keeps the size, so the modification time is checked too
+#ifdef _WIN32
+    struct _stat64 info;
+    bool exists = _stat64(filename.c_str(), &info) == 0;
+#else
+    struct stat info;
+    bool exists = stat(filename.c_str(), &info) == 0;
+#endif
+    if (!exists) {
+        return false;
+    }
+
+    Source from;
+    from.size = (unsigned long long)info.st_size;
+    from.modified = (long long)info.st_mtime;
+
+    std::string cachePath = filename + ".sky";
+
+    if (!loadCache(cachePath, from, size, baked)) {
+        sf::Image source;
+        if (!source.loadFromFile(filename)) {
+            return false;
+        }
+
+        bake(source, size, baked);
+        saveCache(cachePath, from, baked);
+    }
+
+    return true;
+}
+
+bool rm::RMSkybox::upload() {
+    if (!texture.loadFromImage(baked)) {
+        return false;
+    }
+
+    // Blurrier mips are used for rougher reflections
+    texture.setSmooth(true);
+    texture.generateMipmap();
+
+    // No need to keep the pixels around
+    baked = sf::Image();
+
+    return true;
+}
+
+void rm::RMSkybox::bake(const sf::Image& source, unsigned int size, sf::Image& baked) {
+    baked.create(size, size);
+
+    // Octahedral map, 2x2 samples per texel since it is smaller than the source
+    for (unsigned int y = 0; y < size; y++) {
+        for (unsigned int x = 0; x < size; x++) {
+            float col[4] = { 0, 0, 0, 0 };
+            for (int s = 0; s < 4; s++) {
+                float u = (x + 0.25f + 0.5f * (s % 2)) / size;
+                float v = (y + 0.25f + 0.5f * (s / 2)) / size;
+                sampleEquirect(source, octDecode(u, v), 0.25f, col);
+            }
+
+            baked.setPixel(x, y, sf::Color(
+                (sf::Uint8)(tonemap(col[0]) * 255.f + 0.5f),
+                (sf::Uint8)(tonemap(col[1]) * 255.f + 0.5f),
+                (sf::Uint8)(tonemap(col[2]) * 255.f + 0.5f),
+                (sf::Uint8)(tonemap(col[3]) * 255.f + 0.5f)
+            ));
+        }
+    }
+
+    // Project the tonemapped sky onto SH, a few hundred samples across is plenty
+    const sf::Uint8* pixels = source.getPixelsPtr();
+    unsigned int width = source.getSize().x;
+    unsigned int height = source.getSize().y;
+    unsigned int stride = std::max(1u, width / 512);
+
+    Vec3 coeffs[9];
+    float basis[9];
+    for (unsigned int y = 0; y < height; y += stride) {
+        float lat = PI * (0.5f - (y + 0.5f) / height);
+        float solidAngle = (2.f * PI * stride / width) * (PI * stride / height) * cosf(lat);
+
+        for (unsigned int x = 0; x < width; x += stride) {
+            float lon = 2.f * PI * ((x + 0.5f) / width - 0.5f);
+            Vec3 d(cosf(lat) * sinf(lon), sinf(lat), cosf(lat) * cosf(lon));
+
+            const sf::Uint8* p = pixels + 4 * (y * width + x);
+            Vec3 radiance(tonemap(p[0] / 255.f), tonemap(p[1] / 255.f), tonemap(p[2] / 255.f));
+
+            shBasis(d, basis);
+            for (int i = 0; i < 9; i++) {
+                coeffs[i] += radiance * (basis[i] * solidAngle);
+            }
+        }
+    }
+
+    // Convolve with the clamped cosine lobe and divide by PI (Ramamoorthi & Hanrahan)
+    const float band[9] = { 1.f, 2.f / 3.f, 2.f / 3.f, 2.f / 3.f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+    for (int i = 0; i < 9; i++) {
+        irradiance[i] = coeffs[i] * band[i];
+    }
+}
+
+// Cache layout: "RMSK", version, source size, source modification time, map size, 9 SH coefficients, RGBA pixels
+bool rm::RMSkybox::loadCache(const std::string& cachePath, const Source& source, unsigned int size, sf::Image& baked) {
+    std::ifstream cache(cachePath, std::ios::binary);
+    if (!cache) {
+        return false;
+    }
+
+    char magic[4];
+    unsigned int version;
+    Source cachedSource;
+    unsigned int cachedSize;
+
+    cache.read(magic, 4);
+    cache.read((char*)&version, sizeof(version));
+    cache.read((char*)&cachedSource.size, sizeof(cachedSource.size));
+    cache.read((char*)&cachedSource.modified, sizeof(cachedSource.modified));
+    cache.read((char*)&cachedSize, sizeof(cachedSize));
+
+    if (!cache || std::string(magic, 4) != "RMSK" || version != CACHE_VERSION ||
+        cachedSource.size != source.size || cachedSource.modified != source.modified || cachedSize != size) {
+        return false;
+    }
+
+    float sh[27];
+    cache.read((char*)sh, sizeof(sh));
+
+    std::vector<sf::Uint8> pixels(size * size * 4);
+    cache.read((char*)pixels.data(), pixels.size());
+
+    if (!cache) {
+        return false;
+    }
+
+    for (int i = 0; i < 9; i++) {
+        irradiance[i] = Vec3(sh[i * 3], sh[i * 3 + 1], sh[i * 3 + 2]);
+    }
+    baked.create(size, size, pixels.data());
+
+    return true;
+}
+
+void rm::RMSkybox::saveCache(const std::string& cachePath, const Source& source, const sf::Image& baked) {
+    std::ofstream cache(cachePath, std::ios::binary);
+    if (!cache) {
+        // Not fatal, it will just be baked again next time
+        return;
+    }
+
+    unsigned int size = baked.getSize().x;
+    float sh[27];
+    for (int i = 0; i < 9; i++) {
+        sh[i * 3] = irradiance[i].x;
+        sh[i * 3 + 1] = irradiance[i].y;
+        sh[i * 3 + 2] = irradiance[i].z;
+    }
+
+    cache.write("RMSK", 4);
+    cache.write((const char*)&CACHE_VERSION, sizeof(CACHE_VERSION));
+    cache.write((const char*)&source.size, sizeof(source.size));
+    cache.write((const char*)&source.modified, sizeof(source.modified));
+    cache.write((const char*)&size, sizeof(size));
+    cache.write((const char*)sh, sizeof(sh));
+    cache.write((const char*)baked.getPixelsPtr(), size * size * 4);
+}
+
+void rm::RMSkybox::bind(sf::Shader* shader) {
+    shader->setUniform("skybox", texture);
+    shader->setUniformArray("skyIrradiance", irradiance, 9);
+
+    // Highest mip level available to textureLod
+    float lods = floorf(log2f((float)texture.getSize().x));
+    shader->setUniform("skyLods", lods);
+}
+
+Vec3 rm::RMSkybox::sample(Vec3 direction, float roughness) {
+    unsigned int size = baked.getSize().x;
+    if (size == 0) {
+        return Vec3(0, 0, 0);
+    }
+
+    float u, v;
+    octEncode(direction, u, v);
+    unsigned int x = std::min((unsigned int)(u * size), size - 1);
+    unsigned int y = std::min((unsigned int)(v * size), size - 1);
+
+    sf::Color texel = baked.getPixel(x, y);
+    Vec3 sky(texel.r / 255.f, texel.g / 255.f, texel.b / 255.f);
+
+    // No mips here, rough surfaces only get the irradiance blend
+    float basis[9];
+    shBasis(rm::VectorHelper::normalize(direction), basis);
+
+    Vec3 diffuse(0, 0, 0);
+    for (int i = 0; i < 9; i++) {
+        diffuse += irradiance[i] * basis[i];
+    }
+
+    return sky + (diffuse - sky) * (roughness * roughness);
+}
+
+sf::Texture& rm::RMSkybox::getTexture() {
+    return texture;
+}
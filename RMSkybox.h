@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <SFML/Graphics.hpp>
+
+using namespace sf::Glsl;
+
+namespace rm {
+
+    /*
+    Preprocessed skybox for Marcher.frag
+    The equirectangular source is converted once into a tonemapped octahedral map
+    (no atan/asin or pow per sample, mipmapped for rough reflections)
+    and a set of L2 spherical harmonics for diffuse irradiance.
+    The result is cached next to the source so later runs skip the conversion.
+    */
+    class RMSkybox {
+    private:
+        sf::Texture texture;
+        // Result of prepare until it is uploaded
+        sf::Image baked;
+
+        // Irradiance / PI as 9 SH coefficients so the shader only has to evaluate them
+        Vec3 irradiance[9];
+
+        // What the cache remembers about the file it was made from
+        struct Source {
+            unsigned long long size = 0;
+            long long modified = 0;
+        };
+
+        void bake(const sf::Image& source, unsigned int size, sf::Image& baked);
+        bool loadCache(const std::string& cachePath, const Source& source, unsigned int size, sf::Image& baked);
+        void saveCache(const std::string& cachePath, const Source& source, const sf::Image& baked);
+
+    public:
+        RMSkybox();
+
+        /*
+        Loads an equirectangular image and converts it to a size x size octahedral map
+        Uses the cache at <filename>.sky when it was made from the same file
+        */
+        bool loadFromFile(const std::string& filename, unsigned int size = 1024);
+
+        // The part of loadFromFile that doesn't need OpenGL, safe to call from another thread
+        bool prepare(const std::string& filename, unsigned int size = 1024);
+        // Creates the texture from the prepared map, must be called where OpenGL is available
+        bool upload();
+
+        // Sends the map, its mip count and the irradiance to the shader
+        void bind(sf::Shader* shader);
+
+        // CPU version of sampleSky in Marcher.frag, only has the map between prepare and upload
+        Vec3 sample(Vec3 direction, float roughness = 0.f);
+
+        sf::Texture& getTexture();
+
+        // Same as GAMMA in Marcher.frag
+        static const float GAMMA;
+        static const unsigned int CACHE_VERSION;
+    };
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+namespace rm {
+
+    /*
+    Fixed size queue from one producer thread to one consumer thread without locks
+    Holds up to Capacity - 1 items, push fails instead of waiting when it is full.
+    */
+    template <class T, size_t Capacity>
+    class RMSpscQueue {
+    public:
+        // Producer only
+        bool push(const T& item) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            size_t next = (t + 1) % Capacity;
+            if (next == head.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            items[t] = item;
+            tail.store(next, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer only
+        bool pop(T& item) {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            item = items[h];
+            head.store((h + 1) % Capacity, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        T items[Capacity];
+        // Apart so the two threads don't keep taking the same cache line from each other
+        alignas(64) std::atomic<size_t> head{ 0 };
+        alignas(64) std::atomic<size_t> tail{ 0 };
+    };
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+
+namespace rm {
+
+    /*
+    Hands the newest value from one writer thread to one reader thread without locks
+    The writer fills back() and publishes it, the reader picks up the newest published slot with update()
+    and reads front() until its next update. The third slot sits between them, so neither ever waits
+    and values the reader didn't get to in time are skipped. Slots are reused, so containers inside T
+    keep their capacity.
+    */
+    template <class T>
+    class RMTripleBuffer {
+    public:
+        // Writer only
+        T& back() {
+            return slots[backIndex];
+        }
+
+        // Writer only, back() is a different slot afterwards
+        void publish() {
+            backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+        }
+
+        // Reader only, returns whether a newer slot was published since the last call
+        bool update() {
+            if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+                return false;
+            }
+
+            frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+            return true;
+        }
+
+        // Reader only
+        const T& front() const {
+            return slots[frontIndex];
+        }
+
+    private:
+        // middle holds a slot index and whether the writer put it there since the reader last took it
+        static const unsigned int INDEX = 3;
+        static const unsigned int FRESH = 4;
+
+        T slots[3];
+        unsigned int backIndex = 0;
+        unsigned int frontIndex = 1;
+        std::atomic<unsigned int> middle{ 2 };
+    };
+}
@@ -1,5 +1,7 @@
 #include "Rotations.h"
 
+#include <cmath>
+
 using namespace sf;
 
 Vector3f rotateX(Vector3f p, float theta) {
@@ -26,77 +28,148 @@ Vector3f rotateZ(Vector3f p, float theta) {
 	);
 }
 
-Vector3f rotateXYZ(Vector3f p, Vector3f rot) {
-	
-	Transform trans;
-	priv::Matrix<3, 3> rotation(trans);
+// Matrix of rotateXYZ, column major
+static void eulerXYZ(Vector3f rot, float* m) {
+	float cx = cos(rot.x), sx = sin(rot.x);
+	float cy = cos(rot.y), sy = sin(rot.y);
+	float cz = cos(rot.z), sz = sin(rot.z);
 
-	rotation.array[0] = cos(rot.z) * cos(rot.y);
-	rotation.array[1] = sin(rot.z) * cos(rot.y);
-	rotation.array[2] = -sin(rot.y);
+	m[0] = cz * cy;
+	m[1] = sz * cy;
+	m[2] = -sy;
 
-	rotation.array[3] = cos(rot.z) * sin(rot.y) * sin(rot.x) - sin(rot.z) * cos(rot.x);
-	rotation.array[4] = sin(rot.z) * sin(rot.y) * sin(rot.x) + cos(rot.z) * cos(rot.x);
-	rotation.array[5] = cos(rot.y) * sin(rot.x);
+	m[3] = cz * sy * sx - sz * cx;
+	m[4] = sz * sy * sx + cz * cx;
+	m[5] = cy * sx;
 
-	rotation.array[6] = cos(rot.z) * sin(rot.y) * cos(rot.x) + sin(rot.z) * sin(rot.x);
-	rotation.array[7] = sin(rot.z) * sin(rot.y) * cos(rot.x) - cos(rot.z) * sin(rot.x);
-	rotation.array[8] = cos(rot.y) * cos(rot.x);
+	m[6] = cz * sy * cx + sz * sx;
+	m[7] = sz * sy * cx - cz * sx;
+	m[8] = cy * cx;
+}
 
-	Vector3f rotatedPoint;
-	rotatedPoint.x = p.x * rotation.array[0] + p.y * rotation.array[3] + p.z * rotation.array[6];
-	rotatedPoint.y = p.x * rotation.array[1] + p.y * rotation.array[4] + p.z * rotation.array[7];
-	rotatedPoint.z = p.x * rotation.array[2] + p.y * rotation.array[5] + p.z * rotation.array[8];
+Vector3f rotateXYZ(Vector3f p, Vector3f rot) {
+	float m[9];
+	eulerXYZ(rot, m);
 
-	return rotatedPoint;
+	return Vector3f(
+		p.x * m[0] + p.y * m[3] + p.z * m[6],
+		p.x * m[1] + p.y * m[4] + p.z * m[7],
+		p.x * m[2] + p.y * m[5] + p.z * m[8]
+	);
 }
 
+// Same matrix as rotateXYZ with the x and z angles swapped
 Vector3f rotateZYX(Vector3f p, Vector3f rot) {
+	return rotateXYZ(p, Vector3f(rot.z, rot.y, rot.x));
+}
 
-	Transform trans;
-	priv::Matrix<3, 3> rotation(trans);
+sf::Vector3f inverseRotateXYZ(sf::Vector3f p, sf::Vector3f rot)
+{
+	float m[9];
+	eulerXYZ(rot, m);
 
-	rotation.array[0] = cos(rot.x) * cos(rot.y);
-	rotation.array[1] = sin(rot.x) * cos(rot.y);
-	rotation.array[2] = -sin(rot.y);
+	return Vector3f(
+		p.x * m[0] + p.y * m[1] + p.z * m[2],
+		p.x * m[3] + p.y * m[4] + p.z * m[5],
+		p.x * m[6] + p.y * m[7] + p.z * m[8]
+	);
+}
 
-	rotation.array[3] = cos(rot.x) * sin(rot.y) * sin(rot.z) - sin(rot.x) * cos(rot.z);
-	rotation.array[4] = sin(rot.x) * sin(rot.y) * sin(rot.z) + cos(rot.x) * cos(rot.z);
-	rotation.array[5] = cos(rot.y) * sin(rot.z);
+#pragma region Rotation
+Rotation Rotation::fromEulerXYZ(Vector3f rot) {
+	Rotation r;
+	eulerXYZ(rot, r.m);
+
+	// Quaternion from the matrix, pivoting on the largest diagonal term for precision
+	float trace = r.m[0] + r.m[4] + r.m[8];
+	if (trace > 0.f) {
+		float s = sqrt(trace + 1.f) * 2.f;
+		r.w = 0.25f * s;
+		r.x = (r.m[5] - r.m[7]) / s;
+		r.y = (r.m[6] - r.m[2]) / s;
+		r.z = (r.m[1] - r.m[3]) / s;
+	}
+	else if (r.m[0] > r.m[4] && r.m[0] > r.m[8]) {
+		float s = sqrt(1.f + r.m[0] - r.m[4] - r.m[8]) * 2.f;
+		r.w = (r.m[5] - r.m[7]) / s;
+		r.x = 0.25f * s;
+		r.y = (r.m[3] + r.m[1]) / s;
+		r.z = (r.m[6] + r.m[2]) / s;
+	}
+	else if (r.m[4] > r.m[8]) {
+		float s = sqrt(1.f + r.m[4] - r.m[0] - r.m[8]) * 2.f;
+		r.w = (r.m[6] - r.m[2]) / s;
+		r.x = (r.m[3] + r.m[1]) / s;
+		r.y = 0.25f * s;
+		r.z = (r.m[7] + r.m[5]) / s;
+	}
+	else {
+		float s = sqrt(1.f + r.m[8] - r.m[0] - r.m[4]) * 2.f;
+		r.w = (r.m[1] - r.m[3]) / s;
+		r.x = (r.m[6] + r.m[2]) / s;
+		r.y = (r.m[7] + r.m[5]) / s;
+		r.z = 0.25f * s;
+	}
+
+	return r;
+}
 
-	rotation.array[6] = cos(rot.x) * sin(rot.y) * cos(rot.z) + sin(rot.x) * sin(rot.z);
-	rotation.array[7] = sin(rot.x) * sin(rot.y) * cos(rot.z) - cos(rot.x) * sin(rot.z);
-	rotation.array[8] = cos(rot.y) * cos(rot.z);
+Rotation Rotation::fromQuaternion(float x, float y, float z, float w) {
+	float length = sqrt(x * x + y * y + z * z + w * w);
 
-	Vector3f rotatedPoint;
-	rotatedPoint.x = p.x * rotation.array[0] + p.y * rotation.array[3] + p.z * rotation.array[6];
-	rotatedPoint.y = p.x * rotation.array[1] + p.y * rotation.array[4] + p.z * rotation.array[7];
-	rotatedPoint.z = p.x * rotation.array[2] + p.y * rotation.array[5] + p.z * rotation.array[8];
+	Rotation r;
+	if (length > 0.f) {
+		r.x = x / length;
+		r.y = y / length;
+		r.z = z / length;
+		r.w = w / length;
+	}
+	r.updateMatrix();
 
-	return rotatedPoint;
+	return r;
 }
 
-sf::Vector3f inverseRotateXYZ(sf::Vector3f p, sf::Vector3f rot)
-{
-	Transform trans;
-	priv::Matrix<3, 3> rotation(trans);
+Rotation Rotation::fromAxisAngle(Vector3f axis, float angle) {
+	float s = sin(angle * 0.5f);
+	return fromQuaternion(axis.x * s, axis.y * s, axis.z * s, cos(angle * 0.5f) * sqrt(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z));
+}
+
+Vector3f Rotation::toEulerXYZ() const {
+	float cy = sqrt(m[0] * m[0] + m[1] * m[1]);
+	float y = atan2(-m[2], cy);
 
-	rotation.array[0] = cos(rot.z) * cos(rot.y);
-	rotation.array[3] = sin(rot.z) * cos(rot.y);
-	rotation.array[6] = -sin(rot.y);
+	// Looking straight up or down x and z turn about the same axis, all of it goes to z
+	if (cy < 1e-6f) {
+		return Vector3f(0.f, y, atan2(-m[3], m[4]));
+	}
 
-	rotation.array[1] = cos(rot.z) * sin(rot.y) * sin(rot.x) - sin(rot.z) * cos(rot.x);
-	rotation.array[4] = sin(rot.z) * sin(rot.y) * sin(rot.x) + cos(rot.z) * cos(rot.x);
-	rotation.array[7] = cos(rot.y) * sin(rot.x);
+	return Vector3f(atan2(m[5], m[8]), y, atan2(m[1], m[0]));
+}
+
+Rotation Rotation::operator*(const Rotation& b) const {
+	return fromQuaternion(
+		w * b.x + x * b.w + y * b.z - z * b.y,
+		w * b.y - x * b.z + y * b.w + z * b.x,
+		w * b.z + x * b.y - y * b.x + z * b.w,
+		w * b.w - x * b.x - y * b.y - z * b.z
+	);
+}
+
+Rotation Rotation::inverse() const {
+	return fromQuaternion(-x, -y, -z, w);
+}
 
-	rotation.array[2] = cos(rot.z) * sin(rot.y) * cos(rot.x) + sin(rot.z) * sin(rot.x);
-	rotation.array[5] = sin(rot.z) * sin(rot.y) * cos(rot.x) - cos(rot.z) * sin(rot.x);
-	rotation.array[8] = cos(rot.y) * cos(rot.x);
+void Rotation::updateMatrix() {
+	m[0] = 1.f - 2.f * (y * y + z * z);
+	m[1] = 2.f * (x * y + w * z);
+	m[2] = 2.f * (x * z - w * y);
 
-	Vector3f rotatedPoint;
-	rotatedPoint.x = p.x * rotation.array[0] + p.y * rotation.array[3] + p.z * rotation.array[6];
-	rotatedPoint.y = p.x * rotation.array[1] + p.y * rotation.array[4] + p.z * rotation.array[7];
-	rotatedPoint.z = p.x * rotation.array[2] + p.y * rotation.array[5] + p.z * rotation.array[8];
+	m[3] = 2.f * (x * y - w * z);
+	m[4] = 1.f - 2.f * (x * x + z * z);
+	m[5] = 2.f * (y * z + w * x);
 
-	return rotatedPoint;
+	m[6] = 2.f * (x * z + w * y);
+	m[7] = 2.f * (y * z - w * x);
+	m[8] = 1.f - 2.f * (x * x + y * y);
 }
+#pragma endregion
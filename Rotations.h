@@ -2,10 +2,69 @@
 
 #include <SFML/Graphics.hpp>
 
+#include "RMSimd.h"
+
 sf::Vector3f rotateX(sf::Vector3f p, float theta);
 sf::Vector3f rotateY(sf::Vector3f p, float theta);
 sf::Vector3f rotateZ(sf::Vector3f p, float theta);
 sf::Vector3f rotateXYZ(sf::Vector3f p, sf::Vector3f rot);
 sf::Vector3f rotateZYX(sf::Vector3f p, sf::Vector3f rot);
 
-sf::Vector3f inverseRotateXYZ(sf::Vector3f p, sf::Vector3f rot);
\ No newline at end of file
+sf::Vector3f inverseRotateXYZ(sf::Vector3f p, sf::Vector3f rot);
+
+/*
+Rotation kept as a unit quaternion with its 3x3 matrix cached
+Build it once when the rotation changes, after that rotating a point is a matrix multiply
+instead of the sin and cos calls rotateXYZ makes every time.
+*/
+struct Rotation {
+	// Quaternion, w is the real part
+	float x, y, z, w;
+	// Column major like rotateXYZ, m[0 - 2] is where the x axis ends up
+	float m[9];
+
+	constexpr Rotation() : x(0), y(0), z(0), w(1), m{ 1, 0, 0, 0, 1, 0, 0, 0, 1 } {}
+
+	// Same angles and order as rotateXYZ (and rotateXYZ in Marcher.frag)
+	static Rotation fromEulerXYZ(sf::Vector3f rot);
+	static Rotation fromQuaternion(float x, float y, float z, float w);
+	static Rotation fromAxisAngle(sf::Vector3f axis, float angle);
+
+	// Angles that give this rotation through fromEulerXYZ, for the shader
+	sf::Vector3f toEulerXYZ() const;
+
+	// Applies b first, then this
+	Rotation operator*(const Rotation& b) const;
+	Rotation inverse() const;
+
+	sf::Vector3f rotate(sf::Vector3f p) const {
+		return sf::Vector3f(
+			p.x * m[0] + p.y * m[3] + p.z * m[6],
+			p.x * m[1] + p.y * m[4] + p.z * m[7],
+			p.x * m[2] + p.y * m[5] + p.z * m[8]
+		);
+	}
+
+	// The matrix is orthonormal so the inverse is its transpose
+	sf::Vector3f inverseRotate(sf::Vector3f p) const {
+		return sf::Vector3f(
+			p.x * m[0] + p.y * m[1] + p.z * m[2],
+			p.x * m[3] + p.y * m[4] + p.z * m[5],
+			p.x * m[6] + p.y * m[7] + p.z * m[8]
+		);
+	}
+
+	// Same for several points at once
+	template <class F>
+	rm::simd::vec3w<F> rotate(const rm::simd::vec3w<F>& p) const {
+		return rm::simd::multiply(m, p);
+	}
+
+	template <class F>
+	rm::simd::vec3w<F> inverseRotate(const rm::simd::vec3w<F>& p) const {
+		return rm::simd::multiplyTransposed(m, p);
+	}
+
+private:
+	void updateMatrix();
+};
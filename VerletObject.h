@@ -10,6 +10,8 @@ using namespace sf;
 class VerletObject {
 private:
 	friend struct VerletSolver;
+	friend class rm::RMSceneFile;
+	friend class rm::RMSceneText;
 
 	Vector3f positionCurrent;
 	Vector3f positionOld;
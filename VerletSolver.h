@@ -2,21 +2,26 @@
 
 #include <thread>
 #include <future>
+#include <algorithm>
 
 #include <SFML/System.hpp>
 #include "VerletObject.h"
 #include "RMShape.h"
+#include "RMProfiler.h"
 
 using namespace sf;
 
 struct VerletSolver {
 	static void update(float deltaTime) {
+		RM_PROFILE_SCOPE("Physics");
 
 		const int subSteps = 4;
 		const float subDelta = deltaTime / (float)subSteps;
 		const unsigned int numChecks = 2;
 
 		for (unsigned int step = 0; step < subSteps; step++) {
+			RM_PROFILE_SCOPE("Substep");
+
 			// Gravity
 			applyGravity();
 
@@ -40,11 +45,16 @@ struct VerletSolver {
 	static void solveCollsions() {
 		for (unsigned int i = 0; i < VerletObject::verletObjects.size(); i++) {
 			VerletObject* s1 = VerletObject::verletObjects[i];
+
+			// Hidden shapes (operands) only count through the shape operating on them, as in SceneSDF
+			if (!s1->collider->isVisible()) continue;
+
 			for (unsigned int j = i; j < VerletObject::verletObjects.size(); j++) {
 				// Don't check collisions against the same two objects
 				if (i == j) continue;
 
 				VerletObject* s2 = VerletObject::verletObjects[j];
+				if (!s2->collider->isVisible()) continue;
 
 				// Collision variable
 				bool isCollision;
@@ -98,6 +108,23 @@ struct VerletSolver {
 			-rm::VectorHelper::normalize({startOffset.x, startOffset.y, startOffset.z + minDist}),
 		};
 
+		// Both distances for every check point, 8 at a time (the last batch repeats the last point)
+		float s1Dist[16];
+		float s2Dist[16];
+		for (unsigned int b = 0; b < numOffsets; b += 8) {
+			float xs[8], ys[8], zs[8];
+			for (unsigned int k = 0; k < 8; k++) {
+				Vector3f p = s1.getPosition() + offsets[std::min(b + k, numOffsets - 1)];
+				xs[k] = p.x;
+				ys[k] = p.y;
+				zs[k] = p.z;
+			}
+
+			rm::simd::vec3x8 points(rm::simd::float8::load(xs), rm::simd::float8::load(ys), rm::simd::float8::load(zs));
+			s1.getSignedDistance(points).store(s1Dist + b);
+			s2.getSignedDistance(points).store(s2Dist + b);
+		}
+
 		// Assume there is no collision until proven otherwise
 		bool possibleCollision = false;
 		Vector3f closestOffset = { 0, 0, 0 };
@@ -105,10 +132,10 @@ struct VerletSolver {
 		for (unsigned int i = 0; i < numOffsets; i++) {
 
 			// Make sure the check point is within the shape
-			if (s1.getSignedDistance(s1.getPosition() + offsets[i]) > FLT_EPSILON) continue;
+			if (s1Dist[i] > FLT_EPSILON) continue;
 
 			// Find the closest check point
-			float dist = s2.getSignedDistance(s1.getPosition() + offsets[i]);
+			float dist = s2Dist[i];
 			if (abs(dist) < minDist) {
 				minDist = dist;
 				closestOffset = offsets[i];
@@ -8,6 +8,11 @@
 #include "Rotations.h"
 #include "VerletObject.h"
 #include "VerletSolver.h"
+#include "RMSceneText.h"
+#include "RMSimulation.h"
+
+#include <iostream>
+#include <cmath>
 
 // Global variables
 float gameTime;
@@ -25,7 +30,10 @@ sf::Vector3f forward(0, 0, 1);
 float walkScalar = 3;
 float rotateScalar = 0.7f;
 bool allowRotation = false;
-sf::Window* window;
+// Same as FOCAL_LENGTH in Marcher.frag
+float focalLength = 1.5f;
+// Kept from Resized events, the simulation thread doesn't touch the window
+unsigned int windowHeight;
 
 // Shapes
 rm::RMShape* sphere1;
@@ -38,6 +46,10 @@ rm::RMShape* box2;
 
 rm::RMShape* selected;
 
+// Shapes from the scene file
+const char* sceneFile = "Scene.rms";
+rm::RMSceneText sceneText;
+
 // Materials
 rm::RMMaterial sphereMat1;
 rm::RMMaterial boxMat1;
@@ -62,7 +74,7 @@ VerletObject* wall4;
 
 // Initilization of global variables
 void init(sf::Window* win) {
-	window = win;
+	windowHeight = win->getSize().y;
 	gameTime = 0;
 
 	userInput = rm::None;
@@ -141,39 +153,101 @@ void init(sf::Window* win) {
 	/*testSphere = new VerletObject(sphere2);
 	testBox = new VerletObject(box2);
 	testPlane = new VerletObject(ground, true);*/
+
+	reloadScene();
+}
+
+void reloadScene() {
+	std::string error;
+	rm::RMSceneText::Stats stats;
+
+	// A file that doesn't parse leaves the current scene alone
+	if (sceneText.applyFile(sceneFile, &error, &stats)) {
+		std::cout << "Loaded " << sceneFile << " (" << stats.changes << " changes, parsed at "
+			<< std::round(stats.megabytesPerSecond * 10) / 10 << " MB/s)" << std::endl;
+	}
+	else {
+		std::cout << sceneFile << ": " << error << std::endl;
+	}
 }
 
-void draw(sf::Shader* shader, sf::RectangleShape screen) {
+void capture(rm::RMSnapshot* snapshot) {
+	snapshot->cameraPosition = position;
+	snapshot->cameraRotation = rotation;
+
+	// Same order they were drawn in (Gets recaptured every tick so positions could be modified)
+	box1->getState(snapshot->shapes);
 
-	// Send variables to the shader
-	shader->setUniform("camPosition", position);
-	shader->setUniform("camRotation", rotation);
+	sphere2->getState(snapshot->shapes);
 
-	// Start drawing here (Gets redrawn every frame so positions could be modified)
-	box1->draw(shader);
+	sphere3->getState(snapshot->shapes);
 
-	sphere2->draw(shader);
+	line->getState(snapshot->shapes);
 
-	sphere3->draw(shader);
+	box2->getState(snapshot->shapes);
 
-	line->draw(shader);
+	ground->getState(snapshot->shapes);
 
-	box2->draw(shader);
+	sceneText.getState(snapshot->shapes);
+}
 
-	ground->draw(shader);
+void handleEvent(sf::Event* event) {
+	switch (event->type) {
+	case sf::Event::Resized:
+		windowHeight = event->size.height;
+		break;
+	// Go in the direction that was pressed
+	case sf::Event::KeyPressed:
+		keyPressed(event);
+		break;
+	// Stop moving in whichever direction was released
+	case sf::Event::KeyReleased:
+		keyReleased(event);
+		break;
+	case sf::Event::MouseButtonPressed:
+		mousePressed(event);
+		break;
+	case sf::Event::MouseButtonReleased:
+		mouseReleased(event);
+		break;
+	case sf::Event::MouseMoved:
+		mouseMoved(event);
+		break;
+	default:
+		break;
+	}
 }
 
-void update(sf::Clock* gameClock) {
-	// Grab deltaTime
-	float deltaTime = gameClock->getElapsedTime().asSeconds();
+void handleWindowEvent(sf::Window* window, sf::Event* event) {
+	static bool captured = false;
 
+	// Hide the cursor and keep it centred while the right mouse button turns the camera
+	if (event->type == sf::Event::MouseButtonPressed && event->mouseButton.button == sf::Mouse::Right) {
+		captured = true;
+		sf::Mouse::setPosition({ 500, 375 }, *window);
+		window->setMouseCursorVisible(false);
+	}
+
+	if (event->type == sf::Event::MouseMoved && captured) {
+		sf::Mouse::setPosition({ 500, 375 }, *window);
+	}
+
+	if (event->type == sf::Event::MouseButtonReleased && event->mouseButton.button == sf::Mouse::Right) {
+		captured = false;
+		window->setMouseCursorVisible(true);
+	}
+}
+
+void update(float deltaTime) {
 	// Update total game time
 	gameTime += deltaTime;
 
 	// Rotate the user's look vector
-	look = rotateXYZ(sf::Vector3f(0, 0, 1), rotation);
-	right = rotateXYZ(sf::Vector3f(1, 0, 0), sf::Vector3f(0, rotation.y, 0));
-	forward = rotateXYZ(sf::Vector3f(0, 0, 1), sf::Vector3f(0, rotation.y, 0));
+	Rotation view = Rotation::fromEulerXYZ(rotation);
+	Rotation heading = Rotation::fromEulerXYZ(sf::Vector3f(0, rotation.y, 0));
+	look = view.rotate(sf::Vector3f(0, 0, 1));
+	right = heading.rotate(sf::Vector3f(1, 0, 0));
+	forward = heading.rotate(sf::Vector3f(0, 0, 1));
 
 	/*sf::Glsl::Vec3 spherePos = sphere1->getPosition();
 	spherePos.x = -1.5f + cosf(0.5f * gameTime);
@@ -186,7 +260,7 @@ void update(sf::Clock* gameClock) {
 	));*/
 
 	// Physics updates
-	//VerletSolver::update(deltaTime);
+	VerletSolver::update(deltaTime);
 
 	//sphere2->setPosition(testSphere->getPosition());
 
@@ -357,8 +431,6 @@ void keyReleased(sf::Event* event) {
 void mousePressed(sf::Event* event) {
 	if (event->mouseButton.button == sf::Mouse::Right) {
 		allowRotation = true;
-		sf::Mouse::setPosition({ 500, 375 }, *window);
-		window->setMouseCursorVisible(false);
 	}
 
 	if (event->mouseButton.button == sf::Mouse::Left) {
@@ -368,7 +440,8 @@ void mousePressed(sf::Event* event) {
 		}
 
 		// Raymarch
-		rm::RMShape* hit = rm::RMShape::raymarch(position, forward, 10.f, 1000.f);
+		float pixelCone = 1.f / (windowHeight * focalLength);
+		rm::RMShape* hit = rm::RMShape::raymarch(position, forward, 10.f, 1000.f, nullptr, pixelCone);
 		if (hit != nullptr) {
 			// Save hit shape's material and set material to selected
 			if (hit->getMaterial() != selectedMat) {
@@ -389,14 +462,11 @@ void mouseMoved(sf::Event* event) {
 
 		rotation.y += rotY / 500.f;
 		rotation.x += rotX / 500.f;
-
-		sf::Mouse::setPosition({ 500, 375 }, *window);
 	}
 }
 
 void mouseReleased(sf::Event* event) {
 	if (event->mouseButton.button == sf::Mouse::Right) {
 		allowRotation = false;
-		window->setMouseCursorVisible(true);
 	}
 }
\ No newline at end of file
@@ -3,8 +3,23 @@
 #include <SFML/Window.hpp>
 #include <SFML/Graphics.hpp>
 
+namespace rm {
+	struct RMSnapshot;
+}
+
 void init(sf::Window* win);
 
+// The part of the input that needs the window (hiding and centring the cursor), called on the render thread
+void handleWindowEvent(sf::Window* window, sf::Event* event);
+
+// Everything below runs on the simulation thread once it has started (see RMSimulation.h)
+
+// Text scene added on top of the built in shapes
+extern const char* sceneFile;
+
+// Loads the scene file or applies what changed in it since the last call
+void reloadScene();
+
 void keyPressed(sf::Event* event);
 
 void keyReleased(sf::Event* event);
@@ -15,6 +30,11 @@ void mouseReleased(sf::Event* event);
 
 void mouseMoved(sf::Event* event);
 
-void draw(sf::Shader* shader, sf::RectangleShape screen);
+// Input from the window, passed on to the handlers above
+void handleEvent(sf::Event* event);
+
+// Copies the camera and shapes into a snapshot for the render thread
+void capture(rm::RMSnapshot* snapshot);
 
-void update(sf::Clock* gameClock);
\ No newline at end of file
+// Moves the camera and steps physics by deltaTime seconds
+void update(float deltaTime);
\ No newline at end of file
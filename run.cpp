@@ -11,14 +11,122 @@
 
 #include "RMEnums.h"
 #include "RMShape.h"
+#include "RMSkybox.h"
+#include "RMAssetLoader.h"
+#include "RMFileWatcher.h"
+#include "RMOfflineRenderer.h"
+#include "RMDistributedRenderer.h"
+#include "RMMeshExporter.h"
+#include "RMSceneFile.h"
+#include "RMBenchmark.h"
+#include "RMProfiler.h"
+#include "RMMarchStats.h"
+#include "RMSimulation.h"
 #include "Rotations.h"
 
 using namespace sf;
 
-int main() {
+int main(int argc, char** argv) {
+	// Batch rendering without a window, see RMOfflineRenderer.h
+	if (argc > 1 && std::string(argv[1]) == "render") {
+		return rm::RMOfflineRenderer::runCommandLine(argc - 1, argv + 1);
+	}
+
+	// Same, split between worker processes (see RMDistributedRenderer.h)
+	if (argc > 1 && std::string(argv[1]) == "coordinate") {
+		return rm::RMDistributedRenderer::runCoordinator(argc - 1, argv + 1, argv[0]);
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "worker") {
+		return rm::RMDistributedRenderer::runWorker(argc - 1, argv + 1);
+	}
+
+	// Triangle mesh export, see RMMeshExporter.h
+	if (argc > 1 && std::string(argv[1]) == "mesh") {
+		return rm::RMMeshExporter::runCommandLine(argc - 1, argv + 1);
+	}
+
+	// CPU microbenchmarks, see RMBenchmark.h
+	if (argc > 1 && std::string(argv[1]) == "bench") {
+		return rm::RMBenchmark::runCommandLine(argc - 1, argv + 1);
+	}
+
+	// Checks that don't need a window, exits with 1 when one fails
+	if (argc > 1 && std::string(argv[1]) == "selftest") {
+		std::string error;
+		if (!rm::RMSceneFile::testRoundTrip("selftest.rmsc", &error)) {
+			std::cout << "Scene file round trip: " << error << std::endl;
+			return 1;
+		}
+		std::cout << "Scene file round trip: ok" << std::endl;
+
+		if (!rm::RMSceneFile::testRejectsCorrupt("selftest.rmsc", &error)) {
+			std::cout << "Corrupt scene files: " << error << std::endl;
+			return 1;
+		}
+		std::cout << "Corrupt scene files: ok" << std::endl;
+
+		return 0;
+	}
+
+	RenderWindow window;
+
+	Shader rayMarchingShader;
+	Shader fxaaShader;
+	Shader heatmapShader;
+	rm::RMSkybox skybox;
+	Texture testTex;
+	bool marcherReady = false;
+	// The loader thread writes the skybox's irradiance until its onReady runs, bind reads it
+	bool skyboxReady = false;
+
+	// Start loading assets right away so decoding overlaps with creating the window
+	// (Declared after the assets so it waits for its workers before they are destroyed)
+	std::cout << "Loading Assets" << std::endl;
+	rm::RMAssetLoader loader;
+
+	// Textures are placeholders until they load, rebinding picks up the real ones
+	auto bindMarcher = [&]() {
+		if (!marcherReady) return;
+
+		if (skyboxReady) {
+			skybox.bind(&rayMarchingShader);
+		}
+		rayMarchingShader.setUniform("testTex", testTex);
+	};
+
+	// Also used after a reload, a new program starts without any uniforms
+	auto onMarcherLoaded = [&]() {
+		marcherReady = true;
+
+		// Send initial size to shader
+		rayMarchingShader.setUniform("windowDimensions", window.getView().getSize());
+		bindMarcher();
+	};
+
+	// Ray marcher
+	loader.loadShader(&rayMarchingShader, "Marcher.frag", Shader::Type::Fragment, onMarcherLoaded);
+
+	loader.loadShader(&fxaaShader, "FXAA.frag", Shader::Type::Fragment, [&]() {
+		fxaaShader.setUniform("windowDimensions", sf::Vector2f((float)window.getSize().x, (float)window.getSize().y));
+	});
+
+	// Colours the march statistics
+	loader.loadShader(&heatmapShader, "Heatmap.frag", Shader::Type::Fragment, [&]() {
+		heatmapShader.setUniform("tex", Shader::CurrentTexture);
+	});
+
+	// Load texture(s)
+	// The skybox is converted once and cached next to the source
+	loader.loadSkybox(&skybox, "alps_field_4k.hdr", [&]() {
+		skyboxReady = true;
+		bindMarcher();
+	});
+	loader.loadTexture(&testTex, "testTexture.jpg", bindMarcher);
+
 	// Scene window
 	std::cout << "Creating Window" << std::endl;
-	RenderWindow window(VideoMode(1000, 750), "Ray Marcher");
+	window.create(VideoMode(1000, 750), "Ray Marcher");
 	RenderTexture scene;
 	scene.create(window.getSize().x, window.getSize().y);
 	scene.clear(Color::Black);
@@ -29,32 +137,10 @@ int main() {
 	// Inputs
 	short userInput = rm::None;
 
-	// Ray marcher
-	std::cout << "Loading Marcher" << std::endl;
-	Shader rayMarchingShader;
-	rayMarchingShader.loadFromFile("Marcher.frag", Shader::Type::Fragment);
-
-	// Send initial size to shader
-	rayMarchingShader.setUniform("windowDimensions", window.getView().getSize());
-
-	Shader fxaaShader;
-	fxaaShader.loadFromFile("FXAA.frag", Shader::Type::Fragment);
-	fxaaShader.setUniform("windowDimensions", sf::Vector2f((float)window.getSize().x, (float)window.getSize().y));
-
-	// Load texture(s)
-	Texture skybox;
-	skybox.loadFromFile("alps_field_4k.hdr");
-	rayMarchingShader.setUniform("skybox", skybox);
-
-	Texture testTex;
-	testTex.loadFromFile("testTexture.jpg");
-	rayMarchingShader.setUniform("testTex", testTex);
-
 	// Buffer texture for progressive rendering
 	Texture buffer;
 	buffer.create(window.getSize().x, window.getSize().y);
 	buffer.update(window);
-	rayMarchingShader.setUniform("buff", buffer);
 
 	std::cout << "Begin Drawing" << std::endl;
 	// Some shapes
@@ -70,81 +156,186 @@ int main() {
 	// Initializes global variable within main.cpp before starting
 	init(&window);
 
+	// From here on update, physics and input run on their own thread, the loop below only draws its snapshots
+	rm::RMSimulation simulation(
+		[](const rm::RMSimulation::Input& input) {
+			if (input.type == rm::RMSimulation::Input::ReloadScene) {
+				reloadScene();
+				return;
+			}
+
+			sf::Event event = input.event;
+			handleEvent(&event);
+		},
+		update,
+		[](rm::RMSnapshot& snapshot) { capture(&snapshot); }
+	);
+	simulation.start();
+
+	// Pick up edits to the shader and scene without restarting
+	rm::RMFileWatcher watcher;
+	watcher.watch("Marcher.frag", [&]() {
+		// A failed compile leaves the shader empty, so try the edit on a scratch shader first
+		Shader edited;
+		if (!edited.loadFromFile("Marcher.frag", Shader::Type::Fragment) ||
+			!rayMarchingShader.loadFromFile("Marcher.frag", Shader::Type::Fragment)) {
+			std::cout << "Keeping the previous Marcher.frag" << std::endl;
+			return;
+		}
+
+		std::cout << "Reloaded Marcher.frag" << std::endl;
+		onMarcherLoaded();
+	});
+	// The shapes belong to the simulation thread now
+	watcher.watch(sceneFile, [&]() {
+		rm::RMSimulation::Input reload;
+		reload.type = rm::RMSimulation::Input::ReloadScene;
+		simulation.send(reload);
+	});
+
 	// Check for window events
 	Event event;
 
-	while (window.isOpen()) {
+	// F3 toggles the frame profiler, F4 saves the last few seconds of every thread as trace.json
+	bool showProfiler = true;
+	rm::RMProfiler::setThreadName("Main");
+	rm::RMProfiler::setTracing(true);
 
-		while (window.pollEvent(event)) {
-			ImGui::SFML::ProcessEvent(window, event);
+	// F5 toggles the march statistics, the heatmap's counts are read back a few times a second
+	bool showMarchStats = false;
+	int marchView = 0;
+	float marchScale = 500.f;
+	rm::RMMarchStats marchStats;
+	Clock marchReadback;
 
-			if (event.type == Event::Closed) {
-				window.close();
+	while (window.isOpen()) {
+		rm::RMProfiler::beginFrame();
+
+		{
+			RM_PROFILE_SCOPE("Events");
+			while (window.pollEvent(event)) {
+				ImGui::SFML::ProcessEvent(window, event);
+
+				if (event.type == Event::Closed) {
+					window.close();
+				}
+
+				if (event.key.code == sf::Keyboard::Escape) {
+					window.close();
+				}
+
+				// Dynamically change the size of the window
+				if (event.type == Event::Resized) {
+					rayMarchingShader.setUniform("windowDimensions", sf::Vector2f((float)window.getSize().x, (float)window.getSize().y));
+					fxaaShader.setUniform("windowDimensions", sf::Vector2f((float)window.getSize().x, (float)window.getSize().y));
+					screen.setSize(sf::Vector2f((float)window.getSize().x, (float)window.getSize().y));
+					buffer.create(window.getSize().x, window.getSize().y);
+				}
+
+				// Everything else about input is handled on the simulation thread
+				handleWindowEvent(&window, &event);
+				simulation.send(event);
+
+				if (event.type == Event::KeyPressed && event.key.code == Keyboard::F3) {
+					showProfiler = !showProfiler;
+				}
+
+				if (event.type == Event::KeyPressed && event.key.code == Keyboard::F5) {
+					showMarchStats = !showMarchStats;
+				}
+
+				if (event.type == Event::KeyPressed && event.key.code == Keyboard::F4) {
+					std::string error;
+					if (rm::RMProfiler::saveTrace("trace.json", &error)) {
+						std::cout << "Saved trace.json" << std::endl;
+					}
+					else {
+						std::cout << error << std::endl;
+					}
+				}
 			}
+		}
 
-			if (event.key.code == sf::Keyboard::Escape) {
-				window.close();
-			}
+		// Compile/upload anything that finished loading in the background
+		{
+			RM_PROFILE_SCOPE("Loading");
+			loader.update();
+			watcher.update();
+		}
 
-			// Dynamically change the size of the window
-			if (event.type == Event::Resized) {
-				rayMarchingShader.setUniform("windowDimensions", sf::Vector2f((float)window.getSize().x, (float)window.getSize().y));
-				fxaaShader.setUniform("windowDimensions", sf::Vector2f((float)window.getSize().x, (float)window.getSize().y));
-				screen.setSize(sf::Vector2f((float)window.getSize().x, (float)window.getSize().y));
-				buffer.create(window.getSize().x, window.getSize().y);
+		{
+			RM_PROFILE_SCOPE("ImGui update");
+			ImGui::SFML::Update(window, deltaClock.getElapsedTime());
+
+			if (showProfiler) {
+				rm::RMProfiler::drawOverlay(&showProfiler);
 			}
 
-			// Go in the direction that was pressed
-			if (event.type == Event::KeyPressed) {
-				keyPressed(&event);
+			if (showMarchStats) {
+				marchStats.drawOverlay(&marchView, &marchScale, &showMarchStats);
+			}
+			else {
+				marchView = 0;
 			}
 
-			// Stop moving in whichever direction was released
-			if (event.type == Event::KeyReleased) {
-				keyReleased(&event);
+			if (!loader.isDone()) {
+				ImGui::Begin("Loading");
+				ImGui::ProgressBar(loader.getProgress());
+				ImGui::End();
 			}
+		}
 
-			// Mouse pressed
-			if (event.type == Event::MouseButtonPressed) {
-				mousePressed(&event);
+		// Nothing to march with until the shader compiles
+		if (marcherReady) {
+			{
+				RM_PROFILE_SCOPE("Uniforms");
+				// Update the buffer
+				//buffer.update(window);
+				rayMarchingShader.setUniform("buff", scene.getTexture());
+				rayMarchingShader.setUniform("debugView", marchView);
+
+				// Draw the newest tick the simulation finished (Sends objects to the shader)
+				simulation.getSnapshot().draw(&rayMarchingShader);
 			}
 
-			// Mouse released
-			if (event.type == Event::MouseButtonReleased) {
-				mouseReleased(&event);
+			// Ray march
+			{
+				RM_PROFILE_GPU_SCOPE("Ray march");
+				scene.draw(screen, &rayMarchingShader);
 			}
 
-			if (event.type == Event::MouseMoved) {
-				mouseMoved(&event);
+			// Reading back stalls until the GPU is done, so not every frame
+			if (marchView != 0 && marchReadback.getElapsedTime().asSeconds() > 0.25f) {
+				RM_PROFILE_SCOPE("March stats");
+				scene.display();
+				marchStats.clear();
+				marchStats.addImage((rm::RMMarchStats::Counter)(marchView - 1), scene.getTexture().copyToImage());
+				marchReadback.restart();
 			}
 		}
 
-		ImGui::SFML::Update(window, deltaClock.getElapsedTime());
-
-		ImGui::Begin("Hello, world!");
-		ImGui::Button("A Button");
-		ImGui::End();
-
-		// Update the buffer
-		//buffer.update(window);
-		rayMarchingShader.setUniform("buff", scene.getTexture());
-
-		// Draw the scene (Sends objects to the shader)
-		draw(&rayMarchingShader, screen);
-
-		// Ray march
-		scene.draw(screen, &rayMarchingShader);
-
 		// End the frame and actually draw it to the window
-		window.clear(Color::Black);
-		window.draw(Sprite(scene.getTexture()));
-		ImGui::SFML::Render(window);
-
-		window.display();
+		{
+			RM_PROFILE_GPU_SCOPE("Present");
+			window.clear(Color::Black);
+			if (marchView != 0) {
+				heatmapShader.setUniform("scale", marchScale);
+				window.draw(Sprite(scene.getTexture()), &heatmapShader);
+			}
+			else {
+				window.draw(Sprite(scene.getTexture()));
+			}
+		}
 
+		{
+			RM_PROFILE_GPU_SCOPE("ImGui render");
+			ImGui::SFML::Render(window);
+		}
 
-		// Update here
-		update(&deltaClock);
+		{
+			RM_PROFILE_SCOPE("Display");
+			window.display();
+		}
 
 		// Reset clock for calculating delta time
 		deltaClock.restart();
@@ -156,6 +347,7 @@ int main() {
 	}
 
 	// Cleanup any shapes that were created
+	simulation.stop();
 	for (rm::RMShape* s : rm::RMShape::shapes) {
 		delete s;
 	}